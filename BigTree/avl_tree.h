@@ -2,13 +2,348 @@
 #define AVL_TREE_H_
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <iomanip>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
+#include <set>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "node_pool.h"
+#include "prefetch.h"
+#include "tree_codec.h"
 
 namespace nwacc
 {
-	template<typename T, typename K>
+	/**
+	 * Compile time options for avl_tree. Derive from this struct and hide
+	 * a member to switch a feature on.
+	 */
+	struct avl_tree_options
+	{
+		/**
+		 * Keep the size of every subtree in its node. This costs one word
+		 * per node and keeps rank, select and count_in_range at O(log n).
+		 */
+		static constexpr bool order_statistics = false;
+
+		/**
+		 * Keep a second index from each value to the keys that hold it,
+		 * so contains_value and keys_for_value cost O(log n) instead of a
+		 * walk over every node. T must be ordered by std::less. Values
+		 * can then only be changed through the tree, so operator[]
+		 * returns a value_reference and iterators hand out const values.
+		 */
+		static constexpr bool value_index = false;
+
+		/**
+		 * Count comparisons, rotations and allocations as the tree works,
+		 * for stats() to report. Off, nothing is counted or stored.
+		 */
+		static constexpr bool stats = false;
+
+		/**
+		 * Link every node to the nodes before and after it, so iterators,
+		 * range scans and operator<< step along a list instead of
+		 * climbing parent pointers. This costs two words per node. Insert
+		 * and remove keep the links in O(1), split and join in O(log n);
+		 * bulk_load, insert_many, copies and the set operations relink
+		 * the whole tree, which makes the set operations O(n + m).
+		 */
+		static constexpr bool threaded = false;
+	};
+
+	/**
+	 * avl_tree_options with order statistics switched on.
+	 */
+	struct order_statistics_options : avl_tree_options
+	{
+		static constexpr bool order_statistics = true;
+	};
+
+	/**
+	 * avl_tree_options with the value index switched on.
+	 */
+	struct value_index_options : avl_tree_options
+	{
+		static constexpr bool value_index = true;
+	};
+
+	/**
+	 * avl_tree_options with the stats counters switched on.
+	 */
+	struct stats_options : avl_tree_options
+	{
+		static constexpr bool stats = true;
+	};
+
+	/**
+	 * avl_tree_options with in order links switched on.
+	 */
+	struct threaded_options : avl_tree_options
+	{
+		static constexpr bool threaded = true;
+	};
+
+	/**
+	 * What avl_tree::stats reports: counters since the tree was created
+	 * or last reset_stats, and the shape of the tree right now.
+	 */
+	struct avl_tree_stats
+	{
+		/**
+		 * Histograms have a bucket per length from 0 up; anything longer
+		 * lands in the last one. An AVL tree this deep would need about
+		 * 10^13 nodes.
+		 */
+		static constexpr std::size_t histogram_buckets = 64;
+
+		/**
+		 * Searches down the tree for a key: every lookup, insert and
+		 * remove makes one.
+		 */
+		std::uint64_t searches = 0;
+
+		/**
+		 * Calls to Compare made by those searches.
+		 */
+		std::uint64_t comparisons = 0;
+
+		/**
+		 * Rotations made by balance after inserts and removes.
+		 */
+		std::uint64_t single_rotations = 0;
+		std::uint64_t double_rotations = 0;
+
+		/**
+		 * Nodes taken from and given back to the allocator.
+		 */
+		std::uint64_t allocations = 0;
+		std::uint64_t deallocations = 0;
+
+		/**
+		 * search_path_lengths[n] is the number of searches that visited
+		 * n nodes.
+		 */
+		std::array<std::uint64_t, histogram_buckets> search_path_lengths{};
+
+		/**
+		 * node_depths[n] is the number of nodes n links below the root.
+		 */
+		std::array<std::uint64_t, histogram_buckets> node_depths{};
+
+		/**
+		 * @return the mean comparisons per search.
+		 */
+		double comparisons_per_search() const
+		{
+			return this->searches == 0 ? 0 : static_cast<double>(this->comparisons) / this->searches;
+		}
+	};
+
+	/**
+	 * The subtree size kept in each node when order statistics are on.
+	 */
+	template<bool Enabled>
+	struct subtree_count
+	{
+		std::size_t count = 1;
+	};
+
+	/**
+	 * Nothing is stored when order statistics are off.
+	 */
+	template<>
+	struct subtree_count<false>
+	{
+	};
+
+	/**
+	 * The links to the previous and next node in key order kept in each
+	 * node when the tree is threaded.
+	 */
+	template<typename Node, bool Enabled>
+	struct in_order_links
+	{
+		Node *previous = nullptr;
+		Node *next = nullptr;
+	};
+
+	/**
+	 * Nothing is stored when the tree is not threaded.
+	 */
+	template<typename Node>
+	struct in_order_links<Node, false>
+	{
+	};
+
+	/**
+	 * Orders a search key against the keys met on the way down the tree,
+	 * one node at a time.
+	 * @param K the key type of the tree
+	 * @param Compare orders the keys
+	 * @param Key the type searched for
+	 */
+	template<typename K, typename Compare, typename Key, typename Enable = void>
+	class key_probe
+	{
+	public:
+		key_probe(const Key &key, const Compare &compare) : key{ key }, compare{ compare } {}
+
+		/**
+		 * @param other the key of the node reached
+		 * @return negative if the search key goes before other, positive
+		 * if after and zero if they are equal.
+		 */
+		int order(const K &other)
+		{
+			if (this->compare(this->key, other))
+			{
+				return -1;
+			} // else, do_nothing();
+			return this->compare(other, this->key) ? 1 : 0;
+		}
+
+		/**
+		 * @param order what order returned
+		 * @return the calls to Compare it took.
+		 */
+		static int comparisons(int order)
+		{
+			return order < 0 ? 1 : 2;
+		}
+
+	private:
+		const Key &key;
+		const Compare &compare;
+	};
+
+	/**
+	 * Compares std::string keys in plain byte order without starting at
+	 * the first byte every time. Every key below a node lies between the
+	 * nearest ancestors the search turned right and left at, so it shares
+	 * with the search key at least the shorter of the prefixes those two
+	 * shared with it, and comparing can start there. Keys with long
+	 * common prefixes, such as paths, then cost one pass over each byte
+	 * per search rather than one per node.
+	 */
+	template<typename Compare, typename Key>
+	class key_probe<std::string, Compare, Key,
+		typename std::enable_if<(std::is_same<Compare, std::less<std::string>>::value ||
+								 std::is_same<Compare, std::less<>>::value) &&
+								std::is_convertible<const Key &, std::string_view>::value>::type>
+	{
+	public:
+		key_probe(const Key &key, const Compare &) : key{ key } {}
+
+		int order(const std::string &other)
+		{
+			std::size_t common = std::min(this->after_low, this->before_high);
+			const std::size_t length = std::min(this->key.size(), other.size());
+			// skip equal words first, then find the byte that differs
+			while (common + sizeof(std::uint64_t) <= length)
+			{
+				std::uint64_t lhs;
+				std::uint64_t rhs;
+				std::memcpy(&lhs, this->key.data() + common, sizeof(lhs));
+				std::memcpy(&rhs, other.data() + common, sizeof(rhs));
+				if (lhs != rhs)
+				{
+					break;
+				} // else, do_nothing();
+				common += sizeof(std::uint64_t);
+			}
+			while (common < length && this->key[common] == other[common])
+			{
+				common += 1;
+			}
+
+			int result;
+			if (common < length)
+			{
+				result = static_cast<unsigned char>(this->key[common]) < static_cast<unsigned char>(other[common]) ? -1 : 1;
+			}
+			else
+			{
+				result = this->key.size() < other.size() ? -1 : (this->key.size() > other.size() ? 1 : 0);
+			}
+
+			if (result < 0)
+			{
+				this->before_high = common;
+			}
+			else
+			{
+				this->after_low = common;
+			}
+			return result;
+		}
+
+		static int comparisons(int)
+		{
+			return 1;
+		}
+
+	private:
+		std::string_view key;
+
+		/**
+		 * The prefix the search key shares with the nearest ancestor it
+		 * went right at, and with the nearest it went left at.
+		 */
+		std::size_t after_low = 0;
+		std::size_t before_high = 0;
+	};
+
+	/**
+	 * A self balancing binary search tree that maps keys of type K to
+	 * values of type T.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Compare orders the keys. When it is transparent, such as
+	 * std::less<>, lookups accept any type it can compare with K, so a
+	 * std::string keyed tree can be searched with a const char * or a
+	 * std::string_view without building a temporary key. With
+	 * std::string keys and std::less, searches skip the prefix a key is
+	 * known to share with the node reached, see key_probe.
+	 * @param Allocator the allocator nodes are carved from, node_pool by
+	 * default. Pass std::allocator to get a plain new/delete per node.
+	 * @param Options compile time feature switches, see avl_tree_options.
+	 *
+	 * compact_avl_tree offers the same interface with index linked nodes
+	 * in a single array, for small keys and values where pointers would
+	 * take most of the space.
+	 * persistent_avl_tree copies paths instead of changing nodes, for
+	 * readers that need a stable snapshot while a writer carries on.
+	 * concurrent_avl_tree lets many threads read and write at once, with
+	 * lock free reads and per node locks for writers.
+	 * sharded_avl_map spreads keys over several avl_trees, each behind
+	 * its own reader/writer lock.
+	 * b_plus_tree offers the same interface with wide nodes and linked
+	 * leaves, and tree_engine.h picks between the two by template policy.
+	 * freeze, in frozen_avl_tree.h, copies the tree into a
+	 * frozen_avl_tree, a read only layout without pointers for data that
+	 * is written once and read often.
+	 * durable_avl_tree keeps an avl_tree on disk with a write ahead log
+	 * and periodic snapshots.
+	 */
+	template<typename T, typename K, typename Compare = std::less<K>,
+			 template<typename> class Allocator = node_pool, typename Options = avl_tree_options>
 	class avl_tree
 	{
 	private:
@@ -20,7 +355,7 @@ namespace nwacc
 		/**
 		 * Represents the number of items in the tree.
 		 */
-		int tree_size = 0;
+		std::size_t tree_size = 0;
 
 		/**
 		 * Construct the node with all of the necessary components.
@@ -32,7 +367,7 @@ namespace nwacc
 		 * @param height
 		 * @reutrn the completed node struct
 		 */
-		struct node
+		struct node : subtree_count<Options::order_statistics>, in_order_links<node, Options::threaded>
 		{
 			T element;
 			K key;
@@ -41,44 +376,164 @@ namespace nwacc
 			node *right;
 			int height;
 
-			node(const T &the_element, const K &the_key, node *the_parent, node *the_left, node *the_right, int the_height = 0)
-				: element{ the_element }, key{ the_key }, parent{ the_parent }, left{ the_left },
-				right{ the_right }, height{ the_height } {}
+			template<typename V, typename Key>
+			node(V &&the_element, Key &&the_key, node *the_parent, node *the_left, node *the_right, int the_height = 0)
+				: element(std::forward<V>(the_element)), key(std::forward<Key>(the_key)), parent{ the_parent },
+				left{ the_left }, right{ the_right }, height{ the_height } {}
 
-			node(const T && the_element, const K &&the_key, node *the_parent, node *the_left, node *the_right, int the_height = 0)
-				: element{ std::move(the_element) }, key{ the_key }, parent{ the_parent }, left{ the_left },
-				right{ the_right }, height{ the_height } {}
+			/**
+			 * Construct the key from the_key and the value from args
+			 * directly inside the node.
+			 */
+			template<typename Key, typename... Args>
+			node(std::in_place_t, node *the_parent, Key &&the_key, Args &&... args)
+				: element(std::forward<Args>(args)...), key(std::forward<Key>(the_key)), parent{ the_parent },
+				left{ nullptr }, right{ nullptr }, height{ 0 } {}
 		};
 
+		using node_allocator = Allocator<node>;
+
 		/**
 		 * The root value of the tree.
 		 * @value root
 		 */
 		node *root;
 
+		/**
+		 * Where every node of this tree is allocated from.
+		 */
+		node_allocator allocator;
+
+		/**
+		 * Orders the keys.
+		 */
+		Compare compare;
+
+		/**
+		 * Stands in for the value index when it is switched off.
+		 */
+		struct no_value_index {};
+
+		using value_index_type = typename std::conditional<Options::value_index,
+			std::map<T, std::set<K, Compare>>, no_value_index>::type;
+
+		/**
+		 * The keys that hold each value, when Options::value_index is on.
+		 */
+		value_index_type keys_by_value;
+
+		/**
+		 * What iterators and for_each_in_range hand out. Writing through
+		 * it would go around the value index, so it is const when the
+		 * index is on.
+		 */
+		using element_reference = typename std::conditional<Options::value_index, const T &, T &>::type;
+
+		/**
+		 * The counters behind stats(). Lookups bump them from const
+		 * members, and readers sharing a tree may do so at once, so each
+		 * is an atomic read and then written back rather than a locked
+		 * increment: two readers racing can lose a count, but a search
+		 * stays free of locked instructions.
+		 */
+		struct stats_counters
+		{
+			std::atomic<std::uint64_t> searches{ 0 };
+			std::atomic<std::uint64_t> comparisons{ 0 };
+			std::atomic<std::uint64_t> single_rotations{ 0 };
+			std::atomic<std::uint64_t> double_rotations{ 0 };
+			std::atomic<std::uint64_t> allocations{ 0 };
+			std::atomic<std::uint64_t> deallocations{ 0 };
+			std::array<std::atomic<std::uint64_t>, avl_tree_stats::histogram_buckets> search_path_lengths{};
+
+			static void add(std::atomic<std::uint64_t> &counter, std::uint64_t amount)
+			{
+				counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			}
+
+			static std::uint64_t read(const std::atomic<std::uint64_t> &counter)
+			{
+				return counter.load(std::memory_order_relaxed);
+			}
+		};
+
+		/**
+		 * Stands in for the counters when stats are switched off.
+		 */
+		struct no_stats_counters {};
+
+		using stats_counters_type = typename std::conditional<Options::stats, stats_counters, no_stats_counters>::type;
+
+		/**
+		 * Counts what the tree does, when Options::stats is on. Copies and
+		 * moves of the tree start counting from zero.
+		 */
+		mutable stats_counters_type counters;
+
+		/**
+		 * The nodes visited and comparisons made by one search.
+		 */
+		struct search_tally
+		{
+			std::uint64_t nodes = 0;
+			std::uint64_t comparisons = 0;
+		};
+
 	public:
 
 		/**
 		 * Create the root with a null pointer.
 		 */
 		avl_tree() : root { nullptr } {}
+
+		/**
+		 * Create an empty tree that orders its keys with compare.
+		 * @param compare
+		 */
+		explicit avl_tree(const Compare &compare) : root{ nullptr }, compare{ compare } {}
+
+		/**
+		 * Build a perfectly balanced tree from key/value pairs that are
+		 * already sorted by key. See bulk_load.
+		 * @param first
+		 * @param last
+		 */
+		template<typename Iterator>
+		avl_tree(Iterator first, Iterator last) : root{ nullptr }
+		{
+			this->bulk_load(first, last);
+		}
 				
 		/**
 		 * Create a clone of the right hand side of the root with a null pointer.
 		 * @return true if the clone of the rhs of the root is a null pointer.
 		 */
-		avl_tree(const avl_tree &rhs) : root{ nullptr }
+		avl_tree(const avl_tree &rhs) : root{ nullptr }, compare{ rhs.compare }, keys_by_value{ rhs.keys_by_value }
 		{
-			this->root = this->clone(rhs.root);
+			try
+			{
+				this->clone(rhs.root, this->root);
+			}
+			catch (...)
+			{
+				this->empty();
+				throw;
+			}
+			this->tree_size = rhs.tree_size;
+			this->thread_all();
 		}
 
 		/**
 		 * Create the right hand side of the root with a null pointer.
 		 * @return true if the rhs of the root is equal to a null pointer.
 		 */
-		avl_tree(avl_tree &&rhs) : root { rhs.root }
+		avl_tree(avl_tree &&rhs) : tree_size{ rhs.tree_size }, root { rhs.root },
+			allocator{ std::move(rhs.allocator) }, compare{ rhs.compare },
+			keys_by_value{ std::move(rhs.keys_by_value) }
 		{
 			rhs.root = nullptr;
+			rhs.tree_size = 0;
+			rhs.keys_by_value = value_index_type();
 		}
 
 		/**
@@ -104,7 +559,12 @@ namespace nwacc
 		 */
 		avl_tree &operator=(avl_tree &&rhs)
 		{
-			std::swap(this->root, rhs.root);
+			using std::swap;
+			swap(this->root, rhs.root);
+			swap(this->tree_size, rhs.tree_size);
+			swap(this->allocator, rhs.allocator);
+			swap(this->compare, rhs.compare);
+			swap(this->keys_by_value, rhs.keys_by_value);
 			return *this;
 		}
 
@@ -117,30 +577,95 @@ namespace nwacc
 			return this->root == nullptr;
 		}
 
+		/**
+		 * @return the number of keys in the tree.
+		 */
+		std::size_t size() const
+		{
+			return this->tree_size;
+		}
+
 		/**
 		 * Set the root equal to empty.
+		 * A pooled allocator gets its slabs back in one pass instead of
+		 * one deallocate per node, and when the nodes need no destructor
+		 * the walk over the tree is skipped altogether.
 		 */
 		void empty()
 		{
-			this->empty(this->root);
+			if constexpr (releases_in_bulk<node_allocator>::value)
+			{
+				if constexpr (!std::is_trivially_destructible<node>::value)
+				{
+					this->destruct(this->root);
+				} // else, nothing to run per node, do_nothing();
+
+				this->allocator.release();
+				this->root = nullptr;
+				if constexpr (Options::stats)
+				{
+					stats_counters::add(this->counters.deallocations, this->tree_size);
+				} // else, do_nothing();
+			}
+			else
+			{
+				this->empty(this->root);
+			}
+			this->tree_size = 0;
+			this->keys_by_value = value_index_type();
 		}
 
 		/**
-		 * Determine if the root contains data.
-		 * @return true if the root contains data.
+		 * Determine if the key is in the tree.
+		 * @param key
+		 * @return true if the key is in the tree.
 		 */
-		bool contains(const T &value) const
+		bool contains(const K &key) const
 		{
-			return this->contains(value, this->root);
+			return this->find_node(key) != nullptr;
 		}
 
 		/**
-		 * Remove the value at the root.
-		 * @param value
+		 * Determine if a key equivalent to key is in the tree. Only
+		 * available when Compare is transparent.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		bool contains(const Key &key) const
+		{
+			return this->find_node(key) != nullptr;
+		}
+
+		/**
+		 * Remove the key and its value from the tree.
+		 * @param key
+		 */
+		void remove(const K &key)
+		{
+			this->remove_node(key);
+		}
+
+		/**
+		 * Remove the key and its value from the tree.
+		 * @param key
+		 * @return the number of keys removed, 0 or 1.
+		 */
+		std::size_t erase(const K &key)
+		{
+			return this->remove_node(key) ? 1 : 0;
+		}
+
+		/**
+		 * Remove the key equivalent to key. Only available when Compare is
+		 * transparent.
+		 * @param key
+		 * @return the number of keys removed, 0 or 1.
 		 */
-		void remove(const T &value)
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		std::size_t erase(const Key &key)
 		{
-			this->remove(value, this->root);
+			return this->remove_node(key) ? 1 : 0;
 		}
 
 		/**
@@ -150,47 +675,482 @@ namespace nwacc
 		 */
 		T get(const K &key) const
 		{
-			return this->get(key, this->root);
+			return this->get_node(key)->element;
 		}
 
-#pragma region const_iterator
-		class const_iterator
+		/**
+		 * Get the value associated with a key equivalent to key. Only
+		 * available when Compare is transparent.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		T get(const Key &key) const
 		{
-		public:
+			return this->get_node(key)->element;
+		}
 
-			/**
-			 * Construct the const_iterator iterator with a null pointer.
-			 * @return const_iterator
-			 */
-			const_iterator() : current{ nullptr } {}
+		/**
+		 * Look up a batch of keys at once. Up to lookup_lanes descents are
+		 * in flight together: each takes one step in turn and prefetches
+		 * the child it moves to, so by the time it comes round again the
+		 * node is usually in cache and the misses of the batch overlap
+		 * instead of following one another. Worth it once the tree no
+		 * longer fits in cache.
+		 * @param first random access iterator to the keys
+		 * @param last
+		 * @param values random access iterator, values[i] is set to a
+		 * pointer to the value of key i or a null pointer if it is not in
+		 * the tree
+		 */
+		template<typename KeyIterator, typename ValueIterator>
+		void get_many(KeyIterator first, KeyIterator last, ValueIterator values) const
+		{
+			this->find_many(first, last, [&values](std::size_t index, const node *found)
+			{
+				values[index] = found != nullptr ? &found->element : nullptr;
+			});
+		}
 
-			/**
-			 * Overload the pointer operator.
-			 * @return const_iterator
-			 */
-			const T &operator*() const
+		/**
+		 * Look up a batch of keys at once as above, handing out pointers
+		 * the caller may write through. They are const T * when the value
+		 * index is on, since a write would go around the index.
+		 * @param first random access iterator to the keys
+		 * @param last
+		 * @param values random access iterator, values[i] is set to a
+		 * pointer to the value of key i or a null pointer if it is not in
+		 * the tree
+		 */
+		template<typename KeyIterator, typename ValueIterator>
+		void get_many(KeyIterator first, KeyIterator last, ValueIterator values)
+		{
+			this->find_many(first, last, [&values](std::size_t index, const node *found)
 			{
-				return this->retrieve();
+				values[index] = found != nullptr ? &static_cast<element_reference>(const_cast<node *>(found)->element) : nullptr;
+			});
+		}
+
+		/**
+		 * Determine which of a batch of keys are in the tree, with the
+		 * descents interleaved as in get_many.
+		 * @param first random access iterator to the keys
+		 * @param last
+		 * @param found random access iterator, found[i] is set to true if
+		 * key i is in the tree
+		 */
+		template<typename KeyIterator, typename FoundIterator>
+		void contains_many(KeyIterator first, KeyIterator last, FoundIterator found) const
+		{
+			this->find_many(first, last, [&found](std::size_t index, const node *match)
+			{
+				found[index] = match != nullptr;
+			});
+		}
+
+		/**
+		 * Replace the contents of the tree with key/value pairs that are
+		 * sorted by strictly increasing key. Each pair is read once and
+		 * the tree is built directly in its final shape, so this runs in
+		 * linear time and does no rotations. Large random access input is
+		 * built on several threads, one subtree each.
+		 * @param first forward iterator to pairs of (key, value)
+		 * @param last
+		 * @throws std::invalid_argument if the keys are not strictly
+		 * increasing. The tree is left empty.
+		 */
+		template<typename Iterator>
+		void bulk_load(Iterator first, Iterator last)
+		{
+			this->empty();
+			if (first == last)
+			{
+				return;
+			} // else, there is something to load, do_nothing();
+
+			std::size_t count = 1;
+			for (Iterator previous = first, current = std::next(first); current != last; ++previous, ++current)
+			{
+				if (!this->compare(previous->first, current->first))
+				{
+					throw std::invalid_argument("bulk_load keys are not sorted");
+				} // else, still in order, do_nothing();
+				count += 1;
 			}
 
-			/**
-			 * prefix ++ operator
-			 * @return const_iterator
-			 */
-			const_iterator &operator++()
+			if constexpr (std::is_base_of<std::random_access_iterator_tag,
+							  typename std::iterator_traits<Iterator>::iterator_category>::value)
 			{
-				if (this->current->right != nullptr)
+				if (count >= parallel_grain && fork_depth() > 0)
 				{
-					this->current = this->find_first(this->current->right);
+					this->root = this->build_all_parallel(first, count);
 				}
 				else
 				{
-					while (this->current->parent != nullptr && this->current == this->current->parent->right)
-					{
-						this->current->right = this->current->parent;
-					}
-					this->current = this->current->parent;
+					this->root = this->build(first, count);
 				}
+			}
+			else
+			{
+				this->root = this->build(first, count);
+			}
+			this->tree_size = count;
+			this->thread_all();
+			for (node *current = find_min(this->root); current != nullptr; current = next_node(current))
+			{
+				this->index_value(current);
+			}
+		}
+
+		/**
+		 * Insert a batch of key/value pairs. The batch is sorted and then
+		 * merged into the tree in a single pass: each subtree is split
+		 * around its root key and the two halves are joined back, so the
+		 * cost is O(m log(n / m + 1)) rather than m separate descents.
+		 * When a key appears more than once the last pair wins, as it
+		 * would with repeated calls to insert.
+		 * @param first input iterator to pairs of (key, value)
+		 * @param last
+		 */
+		template<typename Iterator>
+		void insert_many(Iterator first, Iterator last)
+		{
+			std::vector<std::pair<K, T>> batch(first, last);
+			std::stable_sort(batch.begin(), batch.end(),
+				[this](const std::pair<K, T> &lhs, const std::pair<K, T> &rhs) { return this->compare(lhs.first, rhs.first); });
+
+			// every node is made up front so the merge itself cannot fail
+			std::vector<node *> fresh;
+			fresh.reserve(batch.size());
+			try
+			{
+				for (std::size_t index = 0; index < batch.size(); index++)
+				{
+					if (index + 1 < batch.size() && !this->compare(batch[index].first, batch[index + 1].first))
+					{
+						continue;
+					} // else, this is the last pair for its key, do_nothing();
+					fresh.push_back(this->create_node(std::move(batch[index].second),
+													  std::move(batch[index].first),
+													  nullptr, nullptr, nullptr));
+				}
+			}
+			catch (...)
+			{
+				for (node *unused : fresh)
+				{
+					this->destroy_node(unused);
+				}
+				throw;
+			}
+
+			for (node *current : fresh)
+			{
+				this->index_value(current);
+			}
+			this->tree_size += fresh.size();
+			this->root = this->merge_nodes(this->root, fresh.data(), fresh.data() + fresh.size());
+			if (this->root != nullptr)
+			{
+				this->root->parent = nullptr;
+			} // else, do_nothing();
+			this->thread_all();
+		}
+
+		/**
+		 * Remove a batch of keys. The keys are sorted and removed in a
+		 * single pass over the tree, joining the pieces that are left
+		 * around each removed node.
+		 * @param first input iterator to keys
+		 * @param last
+		 */
+		template<typename Iterator>
+		void erase_many(Iterator first, Iterator last)
+		{
+			std::vector<K> batch(first, last);
+			std::sort(batch.begin(), batch.end(), this->compare);
+			batch.erase(std::unique(batch.begin(), batch.end(),
+				[this](const K &lhs, const K &rhs) { return !this->compare(lhs, rhs); }), batch.end());
+
+			this->root = this->erase_keys(this->root, batch.data(), batch.data() + batch.size());
+			if (this->root != nullptr)
+			{
+				this->root->parent = nullptr;
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Move every key that is not less than key into a new tree. This
+		 * tree keeps the smaller keys. The tree is cut along the path to
+		 * key and the pieces on each side are joined back in O(log n),
+		 * but the whole call is only O(log n) with order statistics on
+		 * and an allocator whose nodes can change trees, as
+		 * std::allocator's can. Without order statistics the sizes of the
+		 * two parts are found by walking the smaller one, O(min(kept,
+		 * moved)). With node_pool, the default, the moved part is also
+		 * copied into the new tree's pool, O(moved).
+		 * @param key
+		 * @return a tree holding every key not less than key.
+		 */
+		avl_tree split(const K &key)
+		{
+			node *left = nullptr;
+			node *right = nullptr;
+			node *match = this->split_node(this->root, key, left, right);
+			if (match != nullptr)
+			{
+				right = this->join(nullptr, match, right);
+			} // else, key was not in the tree, do_nothing();
+			this->root = this->detach(left);
+			right = this->detach(right);
+			this->cut_threads(find_max(this->root), find_min(right));
+
+			avl_tree result(this->compare);
+			const std::size_t moved = this->split_size(this->root, right, this->tree_size);
+			if constexpr (std::allocator_traits<node_allocator>::is_always_equal::value)
+			{
+				this->unindex_subtree(right);
+				result.root = right;
+			}
+			else
+			{
+				// the nodes live in our storage, so the new tree gets copies
+				try
+				{
+					result.clone(right, result.root);
+				}
+				catch (...)
+				{
+					result.empty();
+					this->join_threads(find_max(this->root), find_min(right));
+					this->root = this->detach(this->join(this->root, right));
+					throw;
+				}
+				this->unindex_subtree(right);
+				this->empty(right);
+				result.thread_all();
+			}
+			this->tree_size -= moved;
+			result.tree_size = moved;
+			result.index_subtree(result.root);
+			return result;
+		}
+
+		/**
+		 * Add key, value and every key of right after the keys of this
+		 * tree. Every key here must be less than key, and key less than
+		 * every key of right. The middle node is hung on the spine of the
+		 * taller tree, so this costs O(|height difference| + 1).
+		 * @param key
+		 * @param value
+		 * @param right consumed; pass std::move(tree) to avoid a copy
+		 * @throws std::invalid_argument if the keys are not in that order.
+		 */
+		void join(K key, T value, avl_tree right)
+		{
+			node *largest = find_max(this->root);
+			node *smallest = find_min(right.root);
+			if ((largest != nullptr && !this->compare(largest->key, key)) ||
+				(smallest != nullptr && !this->compare(key, smallest->key)))
+			{
+				throw std::invalid_argument("join keys are not in order");
+			} // else, every key is on its side, do_nothing();
+
+			node *middle = this->create_node(std::in_place, nullptr, std::move(key), std::move(value));
+			this->adopt_nodes(right);
+			this->index_value(middle);
+			this->absorb_index(right);
+			this->tree_size += right.tree_size + 1;
+			this->join_threads(largest, middle);
+			this->join_threads(middle, smallest);
+			this->root = this->detach(this->join(this->root, middle, right.root));
+			right.root = nullptr;
+			right.tree_size = 0;
+		}
+
+		/**
+		 * Add every key of right after the keys of this tree. Every key
+		 * here must be less than every key of right.
+		 * @param right consumed; pass std::move(tree) to avoid a copy
+		 * @throws std::invalid_argument if the keys are not in that order.
+		 */
+		void join(avl_tree right)
+		{
+			node *largest = find_max(this->root);
+			node *smallest = find_min(right.root);
+			if (largest != nullptr && smallest != nullptr && !this->compare(largest->key, smallest->key))
+			{
+				throw std::invalid_argument("join keys are not in order");
+			} // else, every key is on its side, do_nothing();
+
+			this->adopt_nodes(right);
+			this->absorb_index(right);
+			this->tree_size += right.tree_size;
+			this->join_threads(largest, smallest);
+			this->root = this->detach(this->join(this->root, right.root));
+			right.root = nullptr;
+			right.tree_size = 0;
+		}
+
+		/**
+		 * Add every key of other to this tree. When a key is in both, the
+		 * value from other wins, as it would with insert. The trees are
+		 * combined by splitting other around each of our nodes and
+		 * joining the results, for O(m log(n / m + 1)) work. The two
+		 * halves of large subtrees are combined on separate threads.
+		 * @param other consumed; pass std::move(tree) to avoid a copy
+		 */
+		void union_with(avl_tree other)
+		{
+			set_state state;
+			node *theirs = this->take_nodes(other);
+			this->root = this->detach(this->union_nodes(this->root, theirs, state, fork_depth()));
+
+			for (node *dropped = state.theirs.first; dropped != nullptr;)
+			{
+				node *next = dropped->parent;
+				this->assign_value(dropped->left, std::move(dropped->element));
+				this->destroy_node(dropped);
+				dropped = next;
+			}
+			this->absorb_index(other);
+			this->tree_size += other.tree_size - state.matches;
+			other.tree_size = 0;
+			this->thread_all();
+		}
+
+		/**
+		 * Keep only the keys that are also in other, with the values they
+		 * have here. Costs O(m log(n / m + 1)) work, split over threads
+		 * like union_with.
+		 * @param other consumed; pass std::move(tree) to avoid a copy
+		 */
+		void intersect_with(avl_tree other)
+		{
+			set_state state;
+			node *theirs = this->take_nodes(other);
+			this->root = this->detach(this->intersect_nodes(this->root, theirs, state, fork_depth()));
+
+			this->discard(state.ours, true);
+			this->discard(state.theirs, false);
+			this->tree_size = state.matches;
+			other.tree_size = 0;
+			this->thread_all();
+		}
+
+		/**
+		 * Remove every key that is in other. Costs O(m log(n / m + 1))
+		 * work, split over threads like union_with.
+		 * @param other consumed; pass std::move(tree) to avoid a copy
+		 */
+		void difference_with(avl_tree other)
+		{
+			set_state state;
+			node *theirs = this->take_nodes(other);
+			this->root = this->detach(this->difference_nodes(this->root, theirs, state, fork_depth()));
+
+			this->discard(state.ours, true);
+			this->discard(state.theirs, false);
+			this->tree_size -= state.matches;
+			other.tree_size = 0;
+			this->thread_all();
+		}
+
+		/**
+		 * @return the object that orders the keys.
+		 */
+		const Compare &key_comp() const
+		{
+			return this->compare;
+		}
+
+		/**
+		 * Write every key and value to out in order, as chunks of records
+		 * that a reader can take in as they arrive. Integer keys are
+		 * written as varint differences from the key before by default.
+		 * @param out
+		 * @param keys encodes each key, see codec
+		 * @param values encodes each value, see codec
+		 */
+		template<typename KeyCodec = default_key_codec<K>, typename ValueCodec = codec<T>>
+		void serialize(std::ostream &out, KeyCodec keys = KeyCodec(), ValueCodec values = ValueCodec()) const
+		{
+			tree_stream_writer writer(out);
+			for (node *current = this->find_min(this->root); current != nullptr; current = next_node(current))
+			{
+				keys.encode(writer.record_buffer(), current->key);
+				values.encode(writer.record_buffer(), current->element);
+				writer.end_record();
+			}
+			writer.finish();
+		}
+
+		/**
+		 * Replace the contents of the tree with a stream written by
+		 * serialize, using the same codecs. The records arrive in order,
+		 * so the new tree is built with bulk_load in linear time and only
+		 * then swapped in. The tree is left alone if the stream is damaged,
+		 * its keys are out of order or the build fails.
+		 * @param in
+		 * @param keys decodes each key, see codec
+		 * @param values decodes each value, see codec
+		 * @throws std::runtime_error if the stream is damaged or its keys
+		 * are not strictly increasing.
+		 */
+		template<typename KeyCodec = default_key_codec<K>, typename ValueCodec = codec<T>>
+		void deserialize(std::istream &in, KeyCodec keys = KeyCodec(), ValueCodec values = ValueCodec())
+		{
+			tree_stream_reader reader(in);
+			std::vector<std::pair<K, T>> pairs;
+			std::uint64_t records = 0;
+			for (byte_reader chunk = reader.next_chunk(records); records != 0; chunk = reader.next_chunk(records))
+			{
+				for (; records != 0; records--)
+				{
+					K key = keys.decode(chunk);
+					if (!pairs.empty() && !this->compare(pairs.back().first, key))
+					{
+						throw std::runtime_error("tree stream keys are out of order");
+					} // else, still in order, do_nothing();
+					pairs.emplace_back(std::move(key), values.decode(chunk));
+				}
+				if (!chunk.at_end())
+				{
+					throw std::runtime_error("tree stream chunk is damaged");
+				} // else, do_nothing();
+			}
+			avl_tree loaded(this->compare);
+			loaded.bulk_load(std::make_move_iterator(pairs.begin()), std::make_move_iterator(pairs.end()));
+			*this = std::move(loaded);
+		}
+
+#pragma region const_iterator
+		class const_iterator
+		{
+		public:
+
+			/**
+			 * Construct the const_iterator iterator with a null pointer.
+			 * @return const_iterator
+			 */
+			const_iterator() : current{ nullptr } {}
+
+			/**
+			 * Overload the pointer operator.
+			 * @return const_iterator
+			 */
+			const T &operator*() const
+			{
+				return this->retrieve();
+			}
+
+			/**
+			 * prefix ++ operator
+			 * @return const_iterator
+			 */
+			const_iterator &operator++()
+			{
+				this->current = avl_tree::next_node(this->current);
 				return *this;
 			}
 
@@ -211,18 +1171,7 @@ namespace nwacc
 			 */
 			const_iterator &operator--()
 			{
-				if (this->current->left != nullptr)
-				{
-					this->current = this->find_max(this->current->left);
-				}
-				else
-				{
-					while (this->current->parent != nullptr && this->current == this->current->parent->left)
-					{
-						this->current->left = this->current->parent;
-					}
-					this->current = this->current->parent;
-				}
+				this->current = avl_tree::previous_node(this->current);
 				return *this;
 			}
 
@@ -264,17 +1213,14 @@ namespace nwacc
 			*/
 			node *find_first(node *current)
 			{
-				if (current == nullptr)
-				{
-					return nullptr;
-				} // else, current is not null, do_nothing();
-
-				if (current->left == nullptr)
+				if (current != nullptr)
 				{
-					return current;
-				} // else, we still have more children do_nothing();
-
-				return this->find_first(current->left);
+					while (current->left != nullptr)
+					{
+						current = current->left;
+					}
+				} // else, do_nothing();
+				return current;
 			}
 
 			/**
@@ -284,17 +1230,14 @@ namespace nwacc
 			 */
 			node *find_last(node *current)
 			{
-				if (current == nullptr)
-				{
-					return nullptr;
-				} // else, current is not null, do_nothing();
-
-				if (current->right == nullptr)
+				if (current != nullptr)
 				{
-					return current;
-				} // else, we still have children do_nothing();
-
-				return this->find_last(current->right);
+					while (current->right != nullptr)
+					{
+						current = current->right;
+					}
+				} // else, do_nothing();
+				return current;
 			}
 
 			/**
@@ -338,7 +1281,7 @@ namespace nwacc
 			 */
 			const_iterator(node *current) : current{ current } {}
 
-			friend class avl_tree<T, K>;
+			friend class avl_tree;
 		};
 #pragma endregion
 #pragma region iterator
@@ -355,7 +1298,7 @@ namespace nwacc
 			 * Overload the pointer operator.
 			 * @return iterator
 			 */
-			T &operator*()
+			element_reference operator*()
 			{
 				return this->retrieve();
 			}
@@ -366,18 +1309,7 @@ namespace nwacc
 			 */
 			iterator &operator++()
 			{
-				if (this->current->right != nullptr)
-				{
-					this->current = this->find_first(this->current->right);
-				}
-				else
-				{
-					while (this->current->parent != nullptr && this->current == this->current->parent->right)
-					{
-						this->current->right = this->current->parent;
-					}
-					this->current = this->current->parent;
-				}
+				this->current = avl_tree::next_node(this->current);
 				return *this;
 			}
 
@@ -398,18 +1330,7 @@ namespace nwacc
 			 */
 			iterator &operator--()
 			{
-				if (this->current->left != nullptr)
-				{
-					this->current = this->find_last(this->current->left);
-				}
-				else
-				{
-					while (this->current->parent != nullptr && this->current == this->current->parent->left)
-					{
-						this->current->left = this->current->parent;
-					}
-					this->current = this->current->parent;
-				}
+				this->current = avl_tree::previous_node(this->current);
 				return *this;
 			}
 
@@ -450,17 +1371,14 @@ namespace nwacc
 			*/
 			node *find_first(node *current)
 			{
-				if (current == nullptr)
-				{
-					return nullptr;
-				} // else, current is not null, do_nothing();
-
-				if (current->left == nullptr)
+				if (current != nullptr)
 				{
-					return current;
-				} // else, we still have more children do_nothing();
-
-				return this->find_first(current->left);
+					while (current->left != nullptr)
+					{
+						current = current->left;
+					}
+				} // else, do_nothing();
+				return current;
 			}
 
 			/**
@@ -470,17 +1388,14 @@ namespace nwacc
 			 */
 			node *find_last(node *current)
 			{
-				if (current == nullptr)
-				{
-					return nullptr;
-				} // else, current is not null, do_nothing();
-
-				if (current->right == nullptr)
+				if (current != nullptr)
 				{
-					return current;
-				} // else, we still have children do_nothing();
-
-				return this->find_last(current->right);
+					while (current->right != nullptr)
+					{
+						current = current->right;
+					}
+				} // else, do_nothing();
+				return current;
 			}
 
 			/**
@@ -506,26 +1421,6 @@ namespace nwacc
 				}
 			}
 
-			/**
-			* Insert a value at the root.
-			* @param value
-			* @param key
-			*/
-			iterator insert(const T &value, const K &key)
-			{
-				return this->insert(value, nullptr, key, this->root);
-			}
-
-			/**
-			 * Insert a value at the root with move semantics.
-			 * @param value
-			 * @param key
-			 */
-			iterator insert(T &&value, const K &&key)
-			{
-				return this->insert(std::move(value), nullptr, std::move(key), this->root);
-			}
-
 			/**
 			* Return the current key.
 			* @param key
@@ -543,7 +1438,7 @@ namespace nwacc
 			 * Retrieve the data stored within the current node.
 			 * @return iterator
 			 */
-			T &retrieve()
+			element_reference retrieve()
 			{
 				return this->current->element;
 			}
@@ -554,10 +1449,59 @@ namespace nwacc
 			 */
 			iterator(node *current) : current{ current } {}
 
-			friend class avl_tree<T, K>;
+			friend class avl_tree;
 			friend class const_iterator;
 		};
 #pragma endregion
+#pragma region value_reference
+		/**
+		 * What operator[] returns when the value index is on. It reads
+		 * like a const T and sends every assignment through the tree so
+		 * the index follows the new value.
+		 */
+		class value_reference
+		{
+		public:
+			/**
+			 * Replace the value and move its key to the new value in the
+			 * index.
+			 * @param value
+			 * @return this reference
+			 */
+			template<typename V>
+			value_reference &operator=(V &&value)
+			{
+				this->tree->assign_value(this->current, std::forward<V>(value));
+				return *this;
+			}
+
+			/**
+			 * Read the value.
+			 * @return the value
+			 */
+			operator const T &() const
+			{
+				return this->current->element;
+			}
+
+			/**
+			 * Read the value.
+			 * @return the value
+			 */
+			const T &get() const
+			{
+				return this->current->element;
+			}
+
+		private:
+			avl_tree *tree;
+			node *current;
+
+			value_reference(avl_tree *tree, node *current) : tree{ tree }, current{ current } {}
+
+			friend class avl_tree;
+		};
+#pragma endregion
 
 	private:
 		/** 
@@ -567,17 +1511,14 @@ namespace nwacc
 		*/
 		node *find_min(node *current) const // last
 		{
-			if (current == nullptr)
-			{
-				return nullptr;
-			} // else, we are at the end, do_nothing();
-
-			if (current->left == nullptr)
+			if (current != nullptr)
 			{
-				return current;
-			} // else, we have found the smallest, do_nothing();
-
-			return this->find_min(current->left);
+				while (current->left != nullptr)
+				{
+					current = current->left;
+				}
+			} // else, do_nothing();
+			return current;
 		}
 
 		/**
@@ -619,336 +1560,2385 @@ namespace nwacc
 		}
 
 		/**
-		* Insert a value at the root.
-		* @param value
-		* @param key
-		*/
-		iterator insert(const T &value, const K &key)
+		* Insert a value at the root.
+		* @param value
+		* @param key
+		*/
+		iterator insert(const T &value, const K &key)
+		{
+			return iterator(this->insert_node(value, key));
+		}
+
+		/**
+		 * Insert a value at the root with move semantics.
+		 * @param value
+		 * @param key
+		 */
+		iterator insert(T &&value, K &&key)
+		{
+			return iterator(this->insert_node(std::move(value), std::move(key)));
+		}
+
+		/**
+		 * Build a value from args at key unless the key is already in the
+		 * tree. Nothing is allocated or constructed when it is.
+		 * @param key
+		 * @param args forwarded to the constructor of T
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename... Args>
+		std::pair<iterator, bool> try_emplace(const K &key, Args &&... args)
+		{
+			return this->try_emplace_node(key, std::forward<Args>(args)...);
+		}
+
+		/**
+		 * Build a value from args at key unless the key is already in the
+		 * tree. The key is moved into the node only when it is inserted.
+		 * @param key
+		 * @param args forwarded to the constructor of T
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename... Args>
+		std::pair<iterator, bool> try_emplace(K &&key, Args &&... args)
+		{
+			return this->try_emplace_node(std::move(key), std::forward<Args>(args)...);
+		}
+
+		/**
+		 * Build a key from key and a value from args inside a new node,
+		 * unless the key is already in the tree. When key is already a K
+		 * this is try_emplace. Otherwise the node has to be built to learn
+		 * its key and is thrown away if that key is taken.
+		 * @param key forwarded to the constructor of K
+		 * @param args forwarded to the constructor of T
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename Key, typename... Args>
+		std::pair<iterator, bool> emplace(Key &&key, Args &&... args)
+		{
+			if constexpr (std::is_same<typename std::decay<Key>::type, K>::value)
+			{
+				return this->try_emplace_node(std::forward<Key>(key), std::forward<Args>(args)...);
+			}
+			else
+			{
+				node *fresh = this->create_node(std::in_place, nullptr, std::forward<Key>(key),
+												std::forward<Args>(args)...);
+				insert_point point;
+				node *found = this->descend(fresh->key, point);
+				if (found != nullptr)
+				{
+					this->destroy_node(fresh);
+					return { iterator(found), false };
+				} // else, the key is new, do_nothing();
+
+				this->link_node(point, fresh);
+				return { iterator(fresh), true };
+			}
+		}
+
+		/**
+		 * Assign value to the key, inserting the key if it is not in the
+		 * tree yet.
+		 * @param key
+		 * @param value
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename V>
+		std::pair<iterator, bool> insert_or_assign(const K &key, V &&value)
+		{
+			return this->insert_or_assign_node(key, std::forward<V>(value));
+		}
+
+		/**
+		 * Assign value to the key, inserting the key if it is not in the
+		 * tree yet. The key is moved into the node only when it is
+		 * inserted.
+		 * @param key
+		 * @param value
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename V>
+		std::pair<iterator, bool> insert_or_assign(K &&key, V &&value)
+		{
+			return this->insert_or_assign_node(std::move(key), std::forward<V>(value));
+		}
+
+		/**
+		 * Find the key in the tree.
+		 * @param key
+		 * @return an iterator to the key or end() if it is not there.
+		 */
+		iterator find(const K &key) const
+		{
+			return iterator(this->find_node(key));
+		}
+
+		/**
+		 * Find a key equivalent to key. Only available when Compare is
+		 * transparent.
+		 * @param key
+		 * @return an iterator to the key or end() if it is not there.
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		iterator find(const Key &key) const
+		{
+			return iterator(this->find_node(key));
+		}
+
+		/**
+		 * Find the first key that is not less than key.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		iterator lower_bound(const K &key) const
+		{
+			return iterator(this->lower_bound_node(key));
+		}
+
+		/**
+		 * Find the first key that is not less than key. Only available
+		 * when Compare is transparent.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		iterator lower_bound(const Key &key) const
+		{
+			return iterator(this->lower_bound_node(key));
+		}
+
+		/**
+		 * Find the first key that is greater than key.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		iterator upper_bound(const K &key) const
+		{
+			return iterator(this->upper_bound_node(key));
+		}
+
+		/**
+		 * Find the first key that is greater than key. Only available
+		 * when Compare is transparent.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		iterator upper_bound(const Key &key) const
+		{
+			return iterator(this->upper_bound_node(key));
+		}
+
+		/**
+		 * Find the range of keys equivalent to key, which holds at most
+		 * one key.
+		 * @param key
+		 * @return lower_bound(key) and upper_bound(key).
+		 */
+		std::pair<iterator, iterator> equal_range(const K &key) const
+		{
+			return this->equal_range_nodes(key);
+		}
+
+		/**
+		 * Find the range of keys equivalent to key. Only available when
+		 * Compare is transparent.
+		 * @param key
+		 * @return lower_bound(key) and upper_bound(key).
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		std::pair<iterator, iterator> equal_range(const Key &key) const
+		{
+			return this->equal_range_nodes(key);
+		}
+
+		/**
+		 * Call visit(key, value) for every key k with low <= k < high, in
+		 * order. One descent finds low and the rest is an in order walk,
+		 * so this costs O(log n + k) for k keys visited.
+		 * @param low
+		 * @param high
+		 * @param visit
+		 */
+		template<typename Visitor>
+		void for_each_in_range(const K &low, const K &high, Visitor visit) const
+		{
+			this->for_each_in_range_nodes(low, high, visit);
+		}
+
+		/**
+		 * Call visit(key, value) for every key k with low <= k < high, in
+		 * order. Only available when Compare is transparent.
+		 * @param low
+		 * @param high
+		 * @param visit
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent, typename Visitor>
+		void for_each_in_range(const Key &low, const Key &high, Visitor visit) const
+		{
+			this->for_each_in_range_nodes(low, high, visit);
+		}
+
+		/**
+		 * Call visit(key, value) for every key. The two subtrees of each
+		 * large node are walked on separate threads, down to one subtree
+		 * per hardware thread, so keys are visited in no particular order
+		 * and visit must be safe to call from several threads at once.
+		 * @param visit
+		 */
+		template<typename Visitor>
+		void parallel_for_each(Visitor visit) const
+		{
+			auto each = [&visit](const node *current)
+			{
+				visit(static_cast<const K &>(current->key), static_cast<const T &>(current->element));
+			};
+			this->visit_parallel(this->root, each, fork_depth());
+		}
+
+		/**
+		 * Map every key and value to a result and combine the results,
+		 * splitting the work over threads like parallel_for_each. Results
+		 * are always combined in key order, left subtree, node, right
+		 * subtree, so combine must be associative but need not be
+		 * commutative: string concatenation gives the keys in order.
+		 * @param identity the result of an empty tree, combined with
+		 * anything it leaves that thing as it is
+		 * @param map called with the key and the value, from any thread
+		 * @param combine called with two results, the earlier keys first
+		 * @return the combined result.
+		 */
+		template<typename R, typename Map, typename Combine>
+		R parallel_reduce(R identity, Map map, Combine combine) const
+		{
+			return this->reduce_parallel(this->root, identity, map, combine, fork_depth());
+		}
+
+		/**
+		 * Replace every value with transform(key, value), splitting the
+		 * work over threads like parallel_for_each. With the value index
+		 * on, the index is rebuilt afterwards on this thread, also when
+		 * transform throws and leaves some values old and some new.
+		 * @param transform called with the key and the old value, from
+		 * any thread
+		 */
+		template<typename Transform>
+		void parallel_transform_values(Transform transform)
+		{
+			auto each = [&transform](node *current)
+			{
+				current->element = transform(static_cast<const K &>(current->key),
+											 static_cast<const T &>(current->element));
+			};
+			if constexpr (Options::value_index)
+			{
+				this->keys_by_value = value_index_type();
+				try
+				{
+					this->visit_parallel(this->root, each, fork_depth());
+				}
+				catch (...)
+				{
+					this->index_subtree(this->root);
+					throw;
+				}
+				this->index_subtree(this->root);
+			}
+			else
+			{
+				this->visit_parallel(this->root, each, fork_depth());
+			}
+		}
+
+		/**
+		 * Count the keys that are less than key, which is also the index
+		 * key has or would have in order. Needs order_statistics.
+		 * @param key
+		 * @return the number of smaller keys.
+		 */
+		std::size_t rank(const K &key) const
+		{
+			static_assert(Options::order_statistics, "rank needs avl_tree_options::order_statistics");
+			return this->rank_of(key);
+		}
+
+		/**
+		 * rank for any key type the comparator can order against K.
+		 * @param key
+		 * @return the number of smaller keys.
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		std::size_t rank(const Key &key) const
+		{
+			static_assert(Options::order_statistics, "rank needs avl_tree_options::order_statistics");
+			return this->rank_of(key);
+		}
+
+		/**
+		 * Find the key at index in order, counting from 0. Needs
+		 * order_statistics.
+		 * @param index
+		 * @return an iterator to that key or end() if index >= size().
+		 */
+		iterator select(std::size_t index) const
+		{
+			static_assert(Options::order_statistics, "select needs avl_tree_options::order_statistics");
+			node *current = this->root;
+			while (current != nullptr)
+			{
+				const std::size_t left = count(current->left);
+				if (index < left)
+				{
+					current = current->left;
+				}
+				else if (index > left)
+				{
+					index -= left + 1;
+					current = current->right;
+				}
+				else
+				{
+					break;
+				}
+			}
+			return iterator(current);
+		}
+
+		/**
+		 * Count the keys k with low <= k < high. Needs order_statistics.
+		 * @param low
+		 * @param high
+		 * @return the number of keys in the range.
+		 */
+		std::size_t count_in_range(const K &low, const K &high) const
+		{
+			static_assert(Options::order_statistics, "count_in_range needs avl_tree_options::order_statistics");
+			const std::size_t below_high = this->rank_of(high);
+			const std::size_t below_low = this->rank_of(low);
+			return below_high > below_low ? below_high - below_low : 0;
+		}
+
+		/**
+		 * count_in_range for any key type the comparator can order against K.
+		 * @param low
+		 * @param high
+		 * @return the number of keys in the range.
+		 */
+		template<typename Key, typename C = Compare, typename = typename C::is_transparent>
+		std::size_t count_in_range(const Key &low, const Key &high) const
+		{
+			static_assert(Options::order_statistics, "count_in_range needs avl_tree_options::order_statistics");
+			const std::size_t below_high = this->rank_of(high);
+			const std::size_t below_low = this->rank_of(low);
+			return below_high > below_low ? below_high - below_low : 0;
+		}
+
+		/**
+		 * Get the value at the key, inserting a default value if the key
+		 * is not in the tree yet. With the value index on this is a
+		 * value_reference so assignments reach the index.
+		 * @param key
+		 * @return the value at the key.
+		 */
+		decltype(auto) operator[](const K &key)
+		{
+			return this->element_at(this->try_emplace_node(key).first.current);
+		}
+
+		/**
+		 * Get the value at the key, moving the key into a new node with a
+		 * default value if it is not in the tree yet. With the value index
+		 * on this is a value_reference.
+		 * @param key
+		 * @return the value at the key.
+		 */
+		decltype(auto) operator[](K &&key)
+		{
+			return this->element_at(this->try_emplace_node(std::move(key)).first.current);
+		}
+
+		/**
+		 * Determine if any key holds value. This is a lookup in the value
+		 * index when it is on and a walk over every node otherwise.
+		 * @param value
+		 * @return true if some key holds value.
+		 */
+		bool contains_value(const T &value) const
+		{
+			if constexpr (Options::value_index)
+			{
+				return this->keys_by_value.find(value) != this->keys_by_value.end();
+			}
+			else
+			{
+				for (node *current = find_min(this->root); current != nullptr; current = next_node(current))
+				{
+					if (current->element == value)
+					{
+						return true;
+					} // else, keep looking, do_nothing();
+				}
+				return false;
+			}
+		}
+
+		/**
+		 * Find every key that holds value, in key order. This costs
+		 * O(log n + k) for k keys when the value index is on and a walk
+		 * over every node otherwise.
+		 * @param value
+		 * @return the keys holding value.
+		 */
+		std::vector<K> keys_for_value(const T &value) const
+		{
+			std::vector<K> keys;
+			if constexpr (Options::value_index)
+			{
+				auto found = this->keys_by_value.find(value);
+				if (found != this->keys_by_value.end())
+				{
+					keys.assign(found->second.begin(), found->second.end());
+				} // else, no key holds value, do_nothing();
+			}
+			else
+			{
+				for (node *current = find_min(this->root); current != nullptr; current = next_node(current))
+				{
+					if (current->element == value)
+					{
+						keys.push_back(current->key);
+					} // else, do_nothing();
+				}
+			}
+			return keys;
+		}
+
+		/**
+		 * Take a snapshot of the counters, along with a histogram of node
+		 * depths from a walk over the tree, O(n).
+		 * @return the stats.
+		 */
+		avl_tree_stats stats() const
+		{
+			static_assert(Options::stats, "stats needs avl_tree_options::stats");
+			avl_tree_stats snapshot;
+			snapshot.searches = stats_counters::read(this->counters.searches);
+			snapshot.comparisons = stats_counters::read(this->counters.comparisons);
+			snapshot.single_rotations = stats_counters::read(this->counters.single_rotations);
+			snapshot.double_rotations = stats_counters::read(this->counters.double_rotations);
+			snapshot.allocations = stats_counters::read(this->counters.allocations);
+			snapshot.deallocations = stats_counters::read(this->counters.deallocations);
+			for (std::size_t length = 0; length < avl_tree_stats::histogram_buckets; length++)
+			{
+				snapshot.search_path_lengths[length] = stats_counters::read(this->counters.search_path_lengths[length]);
+			}
+
+			std::vector<std::pair<const node *, std::size_t>> pending;
+			if (this->root != nullptr)
+			{
+				pending.emplace_back(this->root, 0);
+			} // else, do_nothing();
+			while (!pending.empty())
+			{
+				const auto next = pending.back();
+				pending.pop_back();
+				snapshot.node_depths[std::min(next.second, avl_tree_stats::histogram_buckets - 1)] += 1;
+				if (next.first->left != nullptr)
+				{
+					pending.emplace_back(next.first->left, next.second + 1);
+				} // else, do_nothing();
+				if (next.first->right != nullptr)
+				{
+					pending.emplace_back(next.first->right, next.second + 1);
+				} // else, do_nothing();
+			}
+			return snapshot;
+		}
+
+		/**
+		 * Set every counter back to zero.
+		 */
+		void reset_stats()
+		{
+			static_assert(Options::stats, "reset_stats needs avl_tree_options::stats");
+			this->counters.searches = 0;
+			this->counters.comparisons = 0;
+			this->counters.single_rotations = 0;
+			this->counters.double_rotations = 0;
+			this->counters.allocations = 0;
+			this->counters.deallocations = 0;
+			for (auto &searches : this->counters.search_path_lengths)
+			{
+				searches = 0;
+			}
+		}
+
+		/**
+		 * Overload the ostream operator to print the keys of the tree,
+		 * one per line, forwards and then backwards.
+		 * @param out the value to be printed to the console.
+		 * @param rhs the right hand side
+		 */
+		friend std::ostream &operator<<(std::ostream &out, const avl_tree &rhs)
+		{
+			for (iterator item = rhs.first_element(); item != rhs.end(); item++)
+			{
+				out << item.get_key() << '\n';
+			}
+
+			for (iterator item = rhs.last_element(); item != rhs.begin(); item--)
+			{
+				out << item.get_key() << '\n';
+			}
+			return out;
+		}
+
+		void diplay_tree()
+		{
+			this->postorder(this->root);
+		}
+
+	private:
+
+		void postorder(node* p, int indent=0)
+		{
+			if (p != nullptr) {
+				if (p->right) {
+					postorder(p->right, indent + 4);
+				}
+				if (indent) {
+					std::cout << std::setw(indent) << ' ';
+				}
+				if (p->right) std::cout << " /\n" << std::setw(indent) << ' ';
+				if (p->parent != nullptr) {
+					std::cout << p->key << "--" << p->parent->key << "\n ";
+				}else
+				{
+					std::cout << p->key << "--" << "null parent" << "\n ";
+				}
+				if (p->left) {
+					std::cout << std::setw(indent) << ' ' << " \\\n";
+					postorder(p->left, indent + 4);
+				}
+			}
+		}
+
+		/**
+		 * Build a node in storage taken from the allocator.
+		 * @param args forwarded to the node constructor
+		 * @return the new node
+		 */
+		template<typename... Args>
+		node *create_node(Args &&... args)
+		{
+			node *storage = this->allocator.allocate(1);
+			node *created;
+			try
+			{
+				created = ::new (static_cast<void *>(storage)) node{ std::forward<Args>(args)... };
+			}
+			catch (...)
+			{
+				this->allocator.deallocate(storage, 1);
+				throw;
+			}
+			if constexpr (Options::stats)
+			{
+				stats_counters::add(this->counters.allocations, 1);
+			} // else, do_nothing();
+			return created;
+		}
+
+		/**
+		 * Destroy a node and give its storage back to the allocator.
+		 * @param current
+		 */
+		void destroy_node(node *current)
+		{
+			current->~node();
+			this->allocator.deallocate(current, 1);
+			if constexpr (Options::stats)
+			{
+				stats_counters::add(this->counters.deallocations, 1);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Check to see if the current key contains a nullptr.
+		 * The tree is unrolled with right rotations while it is freed so
+		 * no recursion or extra memory is needed, whatever its shape.
+		 * @param current
+		 */
+		void empty(node *&current)
+		{
+			while (current != nullptr)
+			{
+				if (current->left != nullptr)
+				{
+					node *temp = current->left;
+					current->left = temp->right;
+					temp->right = current;
+					current = temp;
+				}
+				else
+				{
+					node *old_node = current;
+					current = current->right;
+					this->destroy_node(old_node);
+				}
+			}
+		}
+
+		/**
+		 * Run the destructor of every node below current without
+		 * returning the storage to the allocator.
+		 * @param current
+		 */
+		void destruct(node *current)
+		{
+			while (current != nullptr)
+			{
+				if (current->left != nullptr)
+				{
+					node *temp = current->left;
+					current->left = temp->right;
+					temp->right = current;
+					current = temp;
+				}
+				else
+				{
+					node *old_node = current;
+					current = current->right;
+					old_node->~node();
+				}
+			}
+		}
+
+		/**
+		 * Cone the current node and all of its necessary components.
+		 * The copy is walked with parent links instead of recursion. It is
+		 * hung on target as it grows so a failed allocation can still
+		 * free the part already built.
+		 * @param current
+		 * @param target where the copy is stored
+		 */
+		void clone(node *current, node *&target)
+		{
+			target = nullptr;
+			if (current == nullptr)
+			{
+				return;
+			} // else, there is a node to copy, do_nothing();
+
+			target = this->create_node(current->element, current->key, nullptr,
+									   nullptr, nullptr, current->height);
+			this->copy_count(target, current);
+			node *from = current;
+			node *to = target;
+			for (;;)
+			{
+				if (from->left != nullptr && to->left == nullptr)
+				{
+					from = from->left;
+					to->left = this->create_node(from->element, from->key, to,
+												 nullptr, nullptr, from->height);
+					to = to->left;
+					this->copy_count(to, from);
+				}
+				else if (from->right != nullptr && to->right == nullptr)
+				{
+					from = from->right;
+					to->right = this->create_node(from->element, from->key, to,
+												  nullptr, nullptr, from->height);
+					to = to->right;
+					this->copy_count(to, from);
+				}
+				else if (from == current)
+				{
+					return;
+				}
+				else
+				{
+					from = from->parent;
+					to = to->parent;
+				}
+			}
+		}
+
+		/**
+		 * The deepest path insert and remove may need to record. An AVL
+		 * tree of n nodes is at most 1.44 log2(n) deep, which stays below
+		 * this for any n that fits in memory.
+		 */
+		static constexpr int max_depth = 96;
+
+		/**
+		 * Where a missing key would be linked into the tree, along with
+		 * every link passed on the way down so the tree can be rebalanced
+		 * bottom up without recursion.
+		 */
+		struct insert_point
+		{
+			node **path[max_depth];
+			int depth = 0;
+			node **link = nullptr;
+			node *parent = nullptr;
+		};
+
+		/**
+		 * Descend towards key, recording the path.
+		 * @param key
+		 * @param point filled in with the insertion point when the key is
+		 * not found
+		 * @return the node holding the key or a null pointer.
+		 */
+		template<typename Key>
+		node *descend(const Key &key, insert_point &point)
+		{
+			search_tally search;
+			key_probe<K, Compare, Key> probe(key, this->compare);
+			point.link = &this->root;
+			while (*point.link != nullptr)
+			{
+				point.parent = *point.link;
+				point.path[point.depth++] = point.link;
+				const int order = probe.order(point.parent->key);
+				this->count_step(search, probe.comparisons(order));
+				if (order < 0)
+				{
+					point.link = &point.parent->left;
+				}
+				else if (order > 0)
+				{
+					point.link = &point.parent->right;
+				}
+				else
+				{
+					this->count_search(search);
+					return point.parent;
+				}
+			}
+			this->count_search(search);
+			return nullptr;
+		}
+
+		/**
+		 * Add the key of current under its value in the value index.
+		 * @param current
+		 */
+		void index_value(const node *current)
+		{
+			if constexpr (Options::value_index)
+			{
+				this->keys_by_value.try_emplace(current->element, this->compare).first->second.insert(current->key);
+			} // else, there is no index, do_nothing();
+		}
+
+		/**
+		 * Take the key of current out of the value index, dropping the
+		 * value once no key holds it.
+		 * @param current
+		 */
+		void unindex_value(const node *current)
+		{
+			if constexpr (Options::value_index)
+			{
+				auto found = this->keys_by_value.find(current->element);
+				if (found != this->keys_by_value.end())
+				{
+					found->second.erase(current->key);
+					if (found->second.empty())
+					{
+						this->keys_by_value.erase(found);
+					} // else, other keys still hold the value, do_nothing();
+				} // else, do_nothing();
+			} // else, there is no index, do_nothing();
+		}
+
+		/**
+		 * Replace the value of current, keeping the value index in step.
+		 * @param current
+		 * @param value
+		 */
+		template<typename V>
+		void assign_value(node *current, V &&value)
+		{
+			this->unindex_value(current);
+			current->element = std::forward<V>(value);
+			this->index_value(current);
+		}
+
+		/**
+		 * What operator[] hands out for current.
+		 * @param current
+		 * @return a value_reference with the value index on, else the value.
+		 */
+		decltype(auto) element_at(node *current)
+		{
+			if constexpr (Options::value_index)
+			{
+				return value_reference(this, current);
+			}
+			else
+			{
+				return (current->element);
+			}
+		}
+
+		/**
+		 * Hang a new node at the insertion point and rebalance.
+		 * @param point
+		 * @param fresh
+		 */
+		void link_node(insert_point &point, node *fresh)
+		{
+			fresh->parent = point.parent;
+			if constexpr (Options::threaded)
+			{
+				if (point.parent != nullptr && point.link == &point.parent->left)
+				{
+					this->join_threads(point.parent->previous, fresh);
+					this->join_threads(fresh, point.parent);
+				}
+				else if (point.parent != nullptr)
+				{
+					this->join_threads(fresh, point.parent->next);
+					this->join_threads(point.parent, fresh);
+				} // else, the first node has no neighbours, do_nothing();
+			} // else, do_nothing();
+			*point.link = fresh;
+			this->index_value(fresh);
+			this->tree_size += 1;
+			this->rebalance(point.path, point.depth);
+		}
+
+		/**
+		 * Insert a key and value, or replace the value if the key is
+		 * already in the tree.
+		 * @param value
+		 * @param key
+		 * @return the node holding the key.
+		 */
+		template<typename V, typename Key>
+		node *insert_node(V &&value, Key &&key)
+		{
+			return this->insert_or_assign_node(std::forward<Key>(key), std::forward<V>(value)).first.current;
+		}
+
+		/**
+		 * One descent for try_emplace: the node is only built when the
+		 * key is missing.
+		 * @param key
+		 * @param args
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename Key, typename... Args>
+		std::pair<iterator, bool> try_emplace_node(Key &&key, Args &&... args)
+		{
+			insert_point point;
+			node *found = this->descend(key, point);
+			if (found != nullptr)
+			{
+				return { iterator(found), false };
+			} // else, the key is new, do_nothing();
+
+			node *fresh = this->create_node(std::in_place, point.parent, std::forward<Key>(key),
+											std::forward<Args>(args)...);
+			this->link_node(point, fresh);
+			return { iterator(fresh), true };
+		}
+
+		/**
+		 * One descent for insert_or_assign.
+		 * @param key
+		 * @param value
+		 * @return the node holding the key and true if it was inserted.
+		 */
+		template<typename Key, typename V>
+		std::pair<iterator, bool> insert_or_assign_node(Key &&key, V &&value)
+		{
+			insert_point point;
+			node *found = this->descend(key, point);
+			if (found != nullptr)
+			{
+				this->assign_value(found, std::forward<V>(value));
+				return { iterator(found), false };
+			} // else, the key is new, do_nothing();
+
+			node *fresh = this->create_node(std::in_place, point.parent, std::forward<Key>(key),
+											std::forward<V>(value));
+			this->link_node(point, fresh);
+			return { iterator(fresh), true };
+		}
+
+		/**
+		 * Remove the value referenced by the key.
+		 * A node with two children is replaced by its successor node, so
+		 * no key or value is copied.
+		 * @param key the current key
+		 * @return true if the key was found and removed.
+		 */
+		template<typename Key>
+		bool remove_node(const Key &key)
+		{
+			node **path[max_depth];
+			int depth = 0;
+			node **link = &this->root;
+			search_tally search;
+			key_probe<K, Compare, Key> probe(key, this->compare);
+
+			while (*link != nullptr)
+			{
+				const int order = probe.order((*link)->key);
+				this->count_step(search, probe.comparisons(order));
+				if (order < 0)
+				{
+					path[depth++] = link;
+					link = &(*link)->left;
+				}
+				else if (order > 0)
+				{
+					path[depth++] = link;
+					link = &(*link)->right;
+				}
+				else
+				{
+					break;
+				}
+			}
+			this->count_search(search);
+
+			node *old_node = *link;
+			if (old_node == nullptr)
+			{
+				// we did not find the item to remove.
+				return false;
+			} // else, we found the item do_nothing();
+
+			if (old_node->left != nullptr && old_node->right != nullptr)
+			{
+				// here we have two children, the successor takes our place
+				path[depth++] = link;
+				const int successor_depth = depth;
+				node **successor_link = &old_node->right;
+				while ((*successor_link)->left != nullptr)
+				{
+					path[depth++] = successor_link;
+					successor_link = &(*successor_link)->left;
+				}
+
+				node *successor = *successor_link;
+				*successor_link = successor->right;
+				if (successor->right != nullptr)
+				{
+					successor->right->parent = successor->parent;
+				} // else, do_nothing();
+
+				successor->left = old_node->left;
+				successor->right = old_node->right;
+				successor->parent = old_node->parent;
+				successor->height = old_node->height;
+				this->copy_count(successor, old_node);
+				successor->left->parent = successor;
+				if (successor->right != nullptr)
+				{
+					successor->right->parent = successor;
+				} // else, the successor was the only right node, do_nothing();
+				*link = successor;
+
+				if (depth > successor_depth)
+				{
+					// this entry pointed into the node we are removing
+					path[successor_depth] = &successor->right;
+				} // else, do_nothing();
+			}
+			else
+			{
+				// here we have no children :( or one child.
+				*link = (old_node->left != nullptr) ? old_node->left : old_node->right;
+				if (*link != nullptr)
+				{
+					(*link)->parent = old_node->parent;
+				} // else, old_node was a leaf, do_nothing();
+			}
+
+			this->unthread(old_node);
+			this->unindex_value(old_node);
+			this->destroy_node(old_node);
+			this->tree_size -= 1;
+			this->rebalance(path, depth);
+			return true;
+		}
+
+		/**
+		 * Build a perfectly balanced subtree from the next count sorted
+		 * pairs. The left half is built first so the pairs are consumed
+		 * in order. The recursion is only log2(count) deep.
+		 * @param first advanced past every pair that is used
+		 * @param count
+		 * @return the root of the new subtree.
+		 */
+		template<typename Iterator>
+		node *build(Iterator &first, std::size_t count)
+		{
+			if (count == 0)
+			{
+				return nullptr;
+			} // else, there is a node to make, do_nothing();
+
+			node *left = this->build(first, count / 2);
+			node *current = nullptr;
+			try
+			{
+				auto &&pair = *first;
+				current = this->create_node(std::forward<decltype(pair)>(pair).second,
+											std::forward<decltype(pair)>(pair).first, nullptr, left, nullptr);
+				++first;
+				current->right = this->build(first, count - count / 2 - 1);
+			}
+			catch (...)
+			{
+				if (current == nullptr)
+				{
+					this->empty(left);
+				}
+				else
+				{
+					this->empty(current);
+				}
+				throw;
+			}
+
+			if (current->left != nullptr)
+			{
+				current->left->parent = current;
+			} // else, do_nothing();
+			if (current->right != nullptr)
+			{
+				current->right->parent = current;
+			} // else, do_nothing();
+			this->update(current);
+			return current;
+		}
+
+		/**
+		 * Link already built nodes, sorted by key, into a perfectly
+		 * balanced subtree.
+		 * @param first
+		 * @param count
+		 * @return the root of the new subtree.
+		 */
+		node *link_balanced(node **first, std::size_t count)
+		{
+			if (count == 0)
+			{
+				return nullptr;
+			} // else, there is a node to link, do_nothing();
+
+			const std::size_t middle = count / 2;
+			return this->attach(this->link_balanced(first, middle), first[middle],
+								this->link_balanced(first + middle + 1, count - middle - 1));
+		}
+
+		/**
+		 * Merge sorted, unique new nodes into the subtree at current.
+		 * A new node whose key is already present hands its value to the
+		 * existing node and is destroyed.
+		 * @param current
+		 * @param first
+		 * @param last
+		 * @return the root of the merged subtree.
+		 */
+		node *merge_nodes(node *current, node **first, node **last)
+		{
+			if (first == last)
+			{
+				return current;
+			} // else, there is something to merge, do_nothing();
+
+			if (current == nullptr)
+			{
+				return this->link_balanced(first, static_cast<std::size_t>(last - first));
+			} // else, split the batch around current, do_nothing();
+
+			node **middle = std::lower_bound(first, last, current->key,
+				[this](const node *item, const K &key) { return this->compare(item->key, key); });
+			node **right_first = middle;
+			if (middle != last && !this->compare(current->key, (*middle)->key))
+			{
+				this->unindex_value(*middle);
+				this->assign_value(current, std::move((*middle)->element));
+				this->destroy_node(*middle);
+				this->tree_size -= 1;
+				right_first += 1;
+			} // else, current's key is not in the batch, do_nothing();
+
+			node *left = this->merge_nodes(current->left, first, middle);
+			node *right = this->merge_nodes(current->right, right_first, last);
+			return this->join(left, current, right);
+		}
+
+		/**
+		 * Remove every key of a sorted, unique batch from the subtree at
+		 * current.
+		 * @param current
+		 * @param first
+		 * @param last
+		 * @return the root of what is left of the subtree.
+		 */
+		node *erase_keys(node *current, const K *first, const K *last)
+		{
+			if (current == nullptr || first == last)
+			{
+				return current;
+			} // else, there may be something to remove, do_nothing();
+
+			const K *middle = std::lower_bound(first, last, current->key, this->compare);
+			const bool found = middle != last && !this->compare(current->key, *middle);
+
+			node *left = this->erase_keys(current->left, first, middle);
+			node *right = this->erase_keys(current->right, found ? middle + 1 : middle, last);
+			if (!found)
+			{
+				return this->join(left, current, right);
+			} // else, current goes away, do_nothing();
+
+			this->unthread(current);
+			this->unindex_value(current);
+			this->destroy_node(current);
+			this->tree_size -= 1;
+			return this->join(left, right);
+		}
+
+		/**
+		 * Subtrees with fewer nodes than this are built or combined on the
+		 * calling thread; below it a new thread costs more than it saves.
+		 */
+		static constexpr std::size_t parallel_grain = 16384;
+
+		/**
+		 * The height of a subtree of about parallel_grain nodes, for the
+		 * set operations, which know heights but not sizes.
+		 */
+		static constexpr int parallel_height = 14;
+
+		/**
+		 * How many levels of a recursion may fork, enough to give every
+		 * hardware thread some work.
+		 * @return 0 on a single core machine.
+		 */
+		static int fork_depth()
+		{
+			const unsigned threads = std::thread::hardware_concurrency();
+			int depth = 0;
+			while (depth < 16 && (1u << depth) < threads)
+			{
+				depth += 1;
+			}
+			return depth;
+		}
+
+		/**
+		 * Whether both halves of a set operation step have enough work to
+		 * be worth a thread. A side with nothing from the other tree
+		 * finishes at once.
+		 * @param mine
+		 * @param theirs_left
+		 * @param theirs_right
+		 * @return true if the halves should run in parallel.
+		 */
+		static bool worth_forking(const node *mine, const node *theirs_left, const node *theirs_right)
+		{
+			return mine->height >= parallel_height && theirs_left != nullptr && theirs_right != nullptr;
+		}
+
+		/**
+		 * Run left and right, left on a new thread when forks is positive.
+		 * If no thread can be started both run here. When right throws we
+		 * still wait for left before the exception leaves, since both
+		 * refer to the caller's locals.
+		 * @param forks
+		 * @param left
+		 * @param right
+		 */
+		template<typename Left, typename Right>
+		static void fork_join(int forks, Left &left, Right &right)
+		{
+			std::future<void> task;
+			if (forks > 0)
+			{
+				try
+				{
+					task = std::async(std::launch::async, [&left]() { left(); });
+				}
+				catch (const std::system_error &)
+				{
+					// no thread to spare, do_nothing();
+				}
+			} // else, do_nothing();
+
+			if (!task.valid())
+			{
+				left();
+				right();
+				return;
+			} // else, left is running elsewhere, do_nothing();
+
+			try
+			{
+				right();
+			}
+			catch (...)
+			{
+				task.wait();
+				throw;
+			}
+			task.get();
+		}
+
+		/**
+		 * Call visit on every node of a subtree, walking the two subtrees
+		 * of large nodes on separate threads while forks remain.
+		 * @param current
+		 * @param visit
+		 * @param forks
+		 */
+		template<typename Visitor>
+		static void visit_parallel(node *current, Visitor &visit, int forks)
+		{
+			if (current == nullptr)
+			{
+				return;
+			} // else, do_nothing();
+
+			if (forks > 0 && current->height >= parallel_height)
+			{
+				auto left = [&]() { visit_parallel(current->left, visit, forks - 1); };
+				auto right = [&]() { visit_parallel(current->right, visit, forks - 1); };
+				fork_join(forks, left, right);
+			}
+			else
+			{
+				visit_parallel(current->left, visit, 0);
+				visit_parallel(current->right, visit, 0);
+			}
+			visit(current);
+		}
+
+		/**
+		 * Reduce a subtree in key order, the two subtrees of large nodes
+		 * on separate threads while forks remain.
+		 * @param current
+		 * @param identity
+		 * @param map
+		 * @param combine
+		 * @param forks
+		 * @return the combined result of the subtree.
+		 */
+		template<typename R, typename Map, typename Combine>
+		static R reduce_parallel(const node *current, const R &identity, Map &map, Combine &combine, int forks)
+		{
+			if (current == nullptr)
+			{
+				return identity;
+			} // else, do_nothing();
+
+			R left_result = identity;
+			R right_result = identity;
+			if (forks > 0 && current->height >= parallel_height)
+			{
+				auto left = [&]() { left_result = reduce_parallel(current->left, identity, map, combine, forks - 1); };
+				auto right = [&]() { right_result = reduce_parallel(current->right, identity, map, combine, forks - 1); };
+				fork_join(forks, left, right);
+			}
+			else
+			{
+				left_result = reduce_parallel(current->left, identity, map, combine, 0);
+				right_result = reduce_parallel(current->right, identity, map, combine, 0);
+			}
+			R middle = map(static_cast<const K &>(current->key), static_cast<const T &>(current->element));
+			return combine(combine(std::move(left_result), std::move(middle)), std::move(right_result));
+		}
+
+		/**
+		 * Build a perfectly balanced subtree from the next count sorted
+		 * pairs into storage that is already allocated, one slot per pair.
+		 * Large halves are built on separate threads. Only constructors
+		 * run here, so the allocator is never touched from two threads.
+		 * @param first random access iterator to the first pair
+		 * @param storage
+		 * @param count
+		 * @param forks
+		 * @return the root of the new subtree.
+		 */
+		template<typename Iterator>
+		node *build_parallel(Iterator first, node **storage, std::size_t count, int forks)
+		{
+			if (count == 0)
+			{
+				return nullptr;
+			} // else, there is a node to make, do_nothing();
+
+			const std::size_t middle = count / 2;
+			auto &&pair = first[middle];
+			node *current = ::new (static_cast<void *>(storage[middle])) node{ std::forward<decltype(pair)>(pair).second,
+				std::forward<decltype(pair)>(pair).first, nullptr, nullptr, nullptr };
+			node *left = nullptr;
+			node *right = nullptr;
+			auto build_left = [&]() { left = this->build_parallel(first, storage, middle, forks - 1); };
+			auto build_right = [&]()
+			{
+				right = this->build_parallel(first + (middle + 1), storage + middle + 1, count - middle - 1, forks - 1);
+			};
+			try
+			{
+				fork_join(count >= parallel_grain ? forks : 0, build_left, build_right);
+			}
+			catch (...)
+			{
+				this->destruct(left);
+				this->destruct(right);
+				current->~node();
+				throw;
+			}
+			return this->attach(left, current, right);
+		}
+
+		/**
+		 * bulk_load for random access input large enough to share out.
+		 * Storage for every node is taken from the allocator up front and
+		 * the nodes are then built in parallel.
+		 * @param first
+		 * @param count
+		 * @return the root of the new tree.
+		 */
+		template<typename Iterator>
+		node *build_all_parallel(Iterator first, std::size_t count)
+		{
+			std::vector<node *> storage;
+			storage.reserve(count);
+			try
+			{
+				while (storage.size() < count)
+				{
+					storage.push_back(this->allocator.allocate(1));
+				}
+				if constexpr (Options::stats)
+				{
+					stats_counters::add(this->counters.allocations, count);
+				} // else, do_nothing();
+				return this->build_parallel(first, storage.data(), count, fork_depth());
+			}
+			catch (...)
+			{
+				for (node *unused : storage)
+				{
+					this->allocator.deallocate(unused, 1);
+				}
+				throw;
+			}
+		}
+
+		/**
+		 * Nodes dropped by a set operation, chained through their parent
+		 * links, which no longer mean anything. An entry with children
+		 * stands for its whole subtree.
+		 */
+		struct discard_list
+		{
+			node *first = nullptr;
+			node *last = nullptr;
+
+			void push(node *current)
+			{
+				current->parent = nullptr;
+				if (this->last == nullptr)
+				{
+					this->first = current;
+				}
+				else
+				{
+					this->last->parent = current;
+				}
+				this->last = current;
+			}
+
+			void splice(discard_list &rhs)
+			{
+				if (rhs.first == nullptr)
+				{
+					return;
+				} // else, do_nothing();
+
+				if (this->last == nullptr)
+				{
+					this->first = rhs.first;
+				}
+				else
+				{
+					this->last->parent = rhs.first;
+				}
+				this->last = rhs.last;
+			}
+		};
+
+		/**
+		 * What one branch of a set operation leaves behind: our dropped
+		 * nodes, the other tree's dropped nodes, and how many keys were
+		 * found in both trees. Each thread fills its own and the results
+		 * are spliced when the branches join.
+		 */
+		struct set_state
+		{
+			discard_list ours;
+			discard_list theirs;
+			std::size_t matches = 0;
+
+			void absorb(set_state &rhs)
+			{
+				this->ours.splice(rhs.ours);
+				this->theirs.splice(rhs.theirs);
+				this->matches += rhs.matches;
+			}
+		};
+
+		/**
+		 * Clear the parent link of a new root.
+		 * @param current
+		 * @return current
+		 */
+		static node *detach(node *current)
+		{
+			if (current != nullptr)
+			{
+				current->parent = nullptr;
+			} // else, do_nothing();
+			return current;
+		}
+
+		/**
+		 * Count the nodes of moved, one of two subtrees whose roots have
+		 * no parent and which hold total nodes together. Without order
+		 * statistics both are walked in step until the smaller one runs
+		 * out, so this costs the size of the smaller one.
+		 * @param kept
+		 * @param moved
+		 * @param total
+		 * @return the number of nodes of moved.
+		 */
+		std::size_t split_size(node *kept, node *moved, std::size_t total) const
+		{
+			if constexpr (Options::order_statistics)
+			{
+				return count(moved);
+			}
+			else
+			{
+				std::size_t steps = 0;
+				for (node *first = find_min(kept), *second = find_min(moved); second != nullptr;
+					 first = climb_to_next(first), second = climb_to_next(second))
+				{
+					if (first == nullptr)
+					{
+						return total - steps;
+					} // else, both still have nodes, do_nothing();
+					steps += 1;
+				}
+				return steps;
+			}
+		}
+
+		/**
+		 * Add every node of a subtree whose root has no parent to the
+		 * value index.
+		 * @param current
+		 */
+		void index_subtree(node *current)
+		{
+			if constexpr (Options::value_index)
+			{
+				for (current = find_min(current); current != nullptr; current = climb_to_next(current))
+				{
+					this->index_value(current);
+				}
+			} // else, there is no index, do_nothing();
+		}
+
+		/**
+		 * Take every node of a subtree whose root has no parent out of the
+		 * value index.
+		 * @param current
+		 */
+		void unindex_subtree(node *current)
+		{
+			if constexpr (Options::value_index)
+			{
+				for (current = find_min(current); current != nullptr; current = climb_to_next(current))
+				{
+					this->unindex_value(current);
+				}
+			} // else, there is no index, do_nothing();
+		}
+
+		/**
+		 * Add the value index of other to ours.
+		 * @param other
+		 */
+		void absorb_index(const avl_tree &other)
+		{
+			if constexpr (Options::value_index)
+			{
+				for (const auto &entry : other.keys_by_value)
+				{
+					this->keys_by_value.try_emplace(entry.first, this->compare).first->second.insert(
+						entry.second.begin(), entry.second.end());
+				}
+			} // else, there is no index, do_nothing();
+		}
+
+		/**
+		 * Make the nodes of other ours to free. A node_pool takes over the
+		 * slabs of the other pool; allocators whose instances are all
+		 * equal need nothing.
+		 * @param other
+		 */
+		void adopt_nodes(avl_tree &other)
+		{
+			if constexpr (adopts_storage<node_allocator>::value)
+			{
+				this->allocator.adopt(other.allocator);
+			}
+			else
+			{
+				static_assert(std::allocator_traits<node_allocator>::is_always_equal::value,
+							  "moving nodes between trees needs node_pool or an allocator whose instances are equal");
+			}
+		}
+
+		/**
+		 * Adopt the nodes of other and take its root. other is left
+		 * without nodes but keeps its size and value index for the caller.
+		 * @param other
+		 * @return the root of other.
+		 */
+		node *take_nodes(avl_tree &other)
+		{
+			this->adopt_nodes(other);
+			node *theirs = other.root;
+			other.root = nullptr;
+			return theirs;
+		}
+
+		/**
+		 * Free every subtree on a discard list.
+		 * @param list
+		 * @param indexed true if the nodes are in our value index
+		 */
+		void discard(discard_list &list, bool indexed)
+		{
+			for (node *current = list.first; current != nullptr;)
+			{
+				node *next = current->parent;
+				current->parent = nullptr;
+				if (indexed)
+				{
+					this->unindex_subtree(current);
+				} // else, do_nothing();
+				this->empty(current);
+				current = next;
+			}
+			list = discard_list();
+		}
+
+		/**
+		 * Cut a subtree along the path to key. Every node passed on the
+		 * way is joined to the pieces on its side, so the cost is
+		 * O(log n) in all.
+		 * @param current
+		 * @param key
+		 * @param left set to the keys less than key
+		 * @param right set to the keys greater than key
+		 * @return the node holding key, with stale links, or a null pointer.
+		 */
+		template<typename Key>
+		node *split_node(node *current, const Key &key, node *&left, node *&right)
+		{
+			if (current == nullptr)
+			{
+				left = nullptr;
+				right = nullptr;
+				return nullptr;
+			} // else, do_nothing();
+
+			if (this->compare(key, current->key))
+			{
+				node *below = nullptr;
+				node *match = this->split_node(current->left, key, left, below);
+				right = this->join(below, current, current->right);
+				return match;
+			}
+			else if (this->compare(current->key, key))
+			{
+				node *below = nullptr;
+				node *match = this->split_node(current->right, key, below, right);
+				left = this->join(current->left, current, below);
+				return match;
+			}
+			else
+			{
+				left = current->left;
+				right = current->right;
+				return current;
+			}
+		}
+
+		/**
+		 * Union of two subtrees. theirs is split around our root, the two
+		 * sides are combined, in parallel when they are large, and our
+		 * root joins them back together. A node of theirs whose key we
+		 * already hold is put on the discard list with its left link
+		 * pointing at our node, so its value can be moved over later.
+		 * @param mine
+		 * @param theirs
+		 * @param state
+		 * @param forks
+		 * @return the root of the union.
+		 */
+		node *union_nodes(node *mine, node *theirs, set_state &state, int forks)
+		{
+			if (theirs == nullptr)
+			{
+				return mine;
+			} // else, do_nothing();
+			if (mine == nullptr)
+			{
+				return theirs;
+			} // else, both have keys, do_nothing();
+
+			node *theirs_left = nullptr;
+			node *theirs_right = nullptr;
+			node *match = this->split_node(theirs, mine->key, theirs_left, theirs_right);
+			if (match != nullptr)
+			{
+				match->left = mine;
+				match->right = nullptr;
+				state.theirs.push(match);
+				state.matches += 1;
+			} // else, do_nothing();
+
+			node *mine_left = mine->left;
+			node *mine_right = mine->right;
+			set_state right_state;
+			auto combine_left = [&]() { mine_left = this->union_nodes(mine_left, theirs_left, state, forks - 1); };
+			auto combine_right = [&]() { mine_right = this->union_nodes(mine_right, theirs_right, right_state, forks - 1); };
+			fork_join(worth_forking(mine, theirs_left, theirs_right) ? forks : 0, combine_left, combine_right);
+			state.absorb(right_state);
+			return this->join(mine_left, mine, mine_right);
+		}
+
+		/**
+		 * Intersection of two subtrees, shaped like union_nodes. Our root
+		 * stays only if theirs holds its key; every node of theirs and
+		 * every one of ours that is not kept goes on the discard lists.
+		 * @param mine
+		 * @param theirs
+		 * @param state
+		 * @param forks
+		 * @return the root of the intersection.
+		 */
+		node *intersect_nodes(node *mine, node *theirs, set_state &state, int forks)
+		{
+			if (mine == nullptr)
+			{
+				if (theirs != nullptr)
+				{
+					state.theirs.push(theirs);
+				} // else, do_nothing();
+				return nullptr;
+			} // else, do_nothing();
+			if (theirs == nullptr)
+			{
+				state.ours.push(mine);
+				return nullptr;
+			} // else, both have keys, do_nothing();
+
+			node *theirs_left = nullptr;
+			node *theirs_right = nullptr;
+			node *match = this->split_node(theirs, mine->key, theirs_left, theirs_right);
+
+			node *mine_left = mine->left;
+			node *mine_right = mine->right;
+			set_state right_state;
+			auto combine_left = [&]() { mine_left = this->intersect_nodes(mine_left, theirs_left, state, forks - 1); };
+			auto combine_right = [&]() { mine_right = this->intersect_nodes(mine_right, theirs_right, right_state, forks - 1); };
+			fork_join(worth_forking(mine, theirs_left, theirs_right) ? forks : 0, combine_left, combine_right);
+			state.absorb(right_state);
+
+			if (match != nullptr)
+			{
+				match->left = nullptr;
+				match->right = nullptr;
+				state.theirs.push(match);
+				state.matches += 1;
+				return this->join(mine_left, mine, mine_right);
+			} // else, our root goes away, do_nothing();
+
+			mine->left = nullptr;
+			mine->right = nullptr;
+			state.ours.push(mine);
+			return this->join(mine_left, mine_right);
+		}
+
+		/**
+		 * Difference of two subtrees, shaped like union_nodes. Our root
+		 * goes away if theirs holds its key; the rest of theirs is only
+		 * discarded.
+		 * @param mine
+		 * @param theirs
+		 * @param state
+		 * @param forks
+		 * @return the root of what is left of mine.
+		 */
+		node *difference_nodes(node *mine, node *theirs, set_state &state, int forks)
+		{
+			if (mine == nullptr || theirs == nullptr)
+			{
+				if (theirs != nullptr)
+				{
+					state.theirs.push(theirs);
+				} // else, do_nothing();
+				return mine;
+			} // else, both have keys, do_nothing();
+
+			node *theirs_left = nullptr;
+			node *theirs_right = nullptr;
+			node *match = this->split_node(theirs, mine->key, theirs_left, theirs_right);
+
+			node *mine_left = mine->left;
+			node *mine_right = mine->right;
+			set_state right_state;
+			auto combine_left = [&]() { mine_left = this->difference_nodes(mine_left, theirs_left, state, forks - 1); };
+			auto combine_right = [&]() { mine_right = this->difference_nodes(mine_right, theirs_right, right_state, forks - 1); };
+			fork_join(worth_forking(mine, theirs_left, theirs_right) ? forks : 0, combine_left, combine_right);
+			state.absorb(right_state);
+
+			if (match == nullptr)
+			{
+				return this->join(mine_left, mine, mine_right);
+			} // else, our root goes away, do_nothing();
+
+			match->left = nullptr;
+			match->right = nullptr;
+			state.theirs.push(match);
+			mine->left = nullptr;
+			mine->right = nullptr;
+			state.ours.push(mine);
+			state.matches += 1;
+			return this->join(mine_left, mine_right);
+		}
+
+		/**
+		 * Make left and right the children of middle.
+		 * @param left
+		 * @param middle
+		 * @param right
+		 * @return middle
+		 */
+		node *attach(node *left, node *middle, node *right)
+		{
+			middle->left = left;
+			middle->right = right;
+			if (left != nullptr)
+			{
+				left->parent = middle;
+			} // else, do_nothing();
+			if (right != nullptr)
+			{
+				right->parent = middle;
+			} // else, do_nothing();
+			this->update(middle);
+			return middle;
+		}
+
+		/**
+		 * Join two AVL subtrees and a middle node whose key lies between
+		 * them into one AVL subtree. The middle node is hung on the spine
+		 * of the taller side at the height of the shorter side and the
+		 * path above it is rebalanced, so the cost is proportional to the
+		 * difference in height.
+		 * @param left every key smaller than middle's key
+		 * @param middle
+		 * @param right every key larger than middle's key
+		 * @return the root of the joined subtree. Its parent is not set.
+		 */
+		node *join(node *left, node *middle, node *right)
+		{
+			if (this->height(left) > this->height(right) + 1)
+			{
+				return this->join_right(left, middle, right);
+			} // else, do_nothing();
+
+			if (this->height(right) > this->height(left) + 1)
+			{
+				return this->join_left(left, middle, right);
+			} // else, the heights are within 1, do_nothing();
+
+			return this->attach(left, middle, right);
+		}
+
+		/**
+		 * Join two AVL subtrees without a middle node by taking the
+		 * smallest node of right as the middle.
+		 * @param left
+		 * @param right
+		 * @return the root of the joined subtree. Its parent is not set.
+		 */
+		node *join(node *left, node *right)
+		{
+			if (right == nullptr)
+			{
+				return left;
+			} // else, do_nothing();
+
+			node *minimum = nullptr;
+			right = this->remove_min(right, minimum);
+			return this->join(left, minimum, right);
+		}
+
+		/**
+		 * Join when left is the taller side: walk down its right spine.
+		 * @param left
+		 * @param middle
+		 * @param right
+		 * @return the root of the joined subtree.
+		 */
+		node *join_right(node *left, node *middle, node *right)
+		{
+			node *spine = left->right;
+			if (this->height(spine) <= this->height(right) + 1)
+			{
+				spine = this->attach(spine, middle, right);
+				if (this->height(spine) > this->height(left->left) + 1)
+				{
+					this->rotate_with_left_child(spine);
+				} // else, do_nothing();
+			}
+			else
+			{
+				spine = this->join_right(spine, middle, right);
+			}
+
+			this->attach(left->left, left, spine);
+			if (this->height(spine) > this->height(left->left) + 1)
+			{
+				this->rotate_with_right_child(left);
+			} // else, do_nothing();
+			return left;
+		}
+
+		/**
+		 * Join when right is the taller side: walk down its left spine.
+		 * @param left
+		 * @param middle
+		 * @param right
+		 * @return the root of the joined subtree.
+		 */
+		node *join_left(node *left, node *middle, node *right)
+		{
+			node *spine = right->left;
+			if (this->height(spine) <= this->height(left) + 1)
+			{
+				spine = this->attach(left, middle, spine);
+				if (this->height(spine) > this->height(right->right) + 1)
+				{
+					this->rotate_with_right_child(spine);
+				} // else, do_nothing();
+			}
+			else
+			{
+				spine = this->join_left(left, middle, spine);
+			}
+
+			this->attach(spine, right, right->right);
+			if (this->height(spine) > this->height(right->right) + 1)
+			{
+				this->rotate_with_left_child(right);
+			} // else, do_nothing();
+			return right;
+		}
+
+		/**
+		 * Unlink the smallest node of a subtree and rebalance its left
+		 * spine.
+		 * @param current
+		 * @param minimum set to the node that was unlinked
+		 * @return the root of the remaining subtree.
+		 */
+		node *remove_min(node *current, node *&minimum)
 		{
-			return this->insert(value, key, nullptr, this->root);
+			if (current->left == nullptr)
+			{
+				minimum = current;
+				if (current->right != nullptr)
+				{
+					current->right->parent = current->parent;
+				} // else, do_nothing();
+				return current->right;
+			} // else, keep going left, do_nothing();
+
+			current->left = this->remove_min(current->left, minimum);
+			if (current->left != nullptr)
+			{
+				current->left->parent = current;
+			} // else, do_nothing();
+			this->balance(current);
+			return current;
 		}
 
 		/**
-		 * Insert a value at the root with move semantics.
-		 * @param value
-		 * @param key
+		 * Balance every node on a recorded path, deepest first. Once a
+		 * subtree keeps its old height nothing above it can change.
+		 * @param path links from the root down
+		 * @param depth number of links on the path
 		 */
-		void insert(T &&value, const K &&key)
+		void rebalance(node **path[], int depth)
 		{
-			this->insert(std::move(value), std::move(key), nullptr, this->root);
+			while (depth-- > 0)
+			{
+				node *&current = *path[depth];
+				const int old_height = current->height;
+				this->balance(current);
+				if (current->height == old_height)
+				{
+					break;
+				} // else, the height changed, keep going up do_nothing();
+			}
+
+			if constexpr (Options::order_statistics)
+			{
+				// every ancestor still gained or lost a node below it
+				while (depth-- > 0)
+				{
+					this->update(*path[depth]);
+				}
+			} // else, nothing above can change, do_nothing();
 		}
 
-		T &operator[](K key)
+		/**
+		 * Find the node holding key.
+		 * @param key anything Compare can order against K
+		 * @return the node or a null pointer.
+		 */
+		template<typename Key>
+		node *find_node(const Key &key) const
 		{
-			return this->operator[](key, this->root);
+			search_tally search;
+			key_probe<K, Compare, Key> probe(key, this->compare);
+			node *current = this->root;
+			while (current != nullptr)
+			{
+				const int order = probe.order(current->key);
+				this->count_step(search, probe.comparisons(order));
+				if (order < 0)
+				{
+					current = current->left;
+				}
+				else if (order > 0)
+				{
+					current = current->right;
+				}
+				else
+				{
+					break;
+				}
+			}
+			this->count_search(search);
+			return current;
 		}
 
 		/**
-		 * Overload the ostream operator to print the tree
-		 * forwards and backwards.
-		 * @param out the value to be printed to the console.
-		 * @param rhs the right hand side
+		 * How many descents get_many and contains_many keep in flight,
+		 * enough to cover a miss to memory with the steps of the others.
 		 */
-		friend std::ostream &operator<<(std::ostream &out, const avl_tree &rhs)
+		static constexpr std::size_t lookup_lanes = 16;
+
+		/**
+		 * Find every key of a batch, stepping up to lookup_lanes descents
+		 * in turn and prefetching each child as it is reached. A lane that
+		 * finishes starts on the next key.
+		 * @param first random access iterator to the keys
+		 * @param last
+		 * @param report called with the index of each key and its node,
+		 * or a null pointer, in no particular order
+		 */
+		template<typename KeyIterator, typename Report>
+		void find_many(KeyIterator first, KeyIterator last, Report report) const
 		{
-			for (iterator item = rhs.first_element(); item != rhs.end(); item++)
+			static_assert(std::is_base_of<std::random_access_iterator_tag,
+							  typename std::iterator_traits<KeyIterator>::iterator_category>::value,
+						  "get_many and contains_many need random access keys");
+
+			struct lane
+			{
+				const node *current;
+				std::size_t index;
+				search_tally search;
+			};
+
+			const std::size_t count = static_cast<std::size_t>(last - first);
+			lane lanes[lookup_lanes];
+			std::size_t active = 0;
+			std::size_t next = 0;
+			while (active < lookup_lanes && next < count)
 			{
-				out << item.get_key() << std::endl; // TODO: make print key
+				lanes[active++] = lane{ this->root, next++, search_tally() };
 			}
+			if (this->root != nullptr)
+			{
+				prefetch(this->root);
+			} // else, do_nothing();
 
-			for (iterator item = rhs.last_element(); item != rhs.begin(); item--)
+			while (active > 0)
 			{
-				out << item.get_key() << std::endl; // TODO: make print key
+				for (std::size_t at = 0; at < active;)
+				{
+					lane &step = lanes[at];
+					const node *match = nullptr;
+					if (step.current != nullptr)
+					{
+						const node *current = step.current;
+						const auto &key = first[step.index];
+						if (this->compare(key, current->key))
+						{
+							this->count_step(step.search, 1);
+							step.current = current->left;
+						}
+						else if (this->compare(current->key, key))
+						{
+							this->count_step(step.search, 2);
+							step.current = current->right;
+						}
+						else
+						{
+							this->count_step(step.search, 2);
+							match = current;
+							step.current = nullptr;
+						}
+
+						if (step.current != nullptr)
+						{
+							prefetch(step.current);
+							at += 1;
+							continue;
+						} // else, the descent is over, do_nothing();
+					} // else, the tree is empty, do_nothing();
+
+					this->count_search(step.search);
+					report(step.index, match);
+					if (next < count)
+					{
+						step = lane{ this->root, next++, search_tally() };
+						at += 1;
+					}
+					else
+					{
+						// the last lane takes this slot and is stepped next
+						step = lanes[--active];
+					}
+				}
 			}
-			return out;
 		}
 
-		void diplay_tree()
+		/**
+		 * Count one node visited by a search, when stats are on.
+		 * @param search
+		 * @param comparisons made at the node
+		 */
+		void count_step(search_tally &search, int comparisons) const
 		{
-			this->postorder(this->root);
+			if constexpr (Options::stats)
+			{
+				search.nodes += 1;
+				search.comparisons += comparisons;
+			} // else, do_nothing();
 		}
 
-	private:
-
-		void postorder(node* p, int indent=0)
+		/**
+		 * Add a finished search to the counters, when stats are on.
+		 * @param search
+		 */
+		void count_search(const search_tally &search) const
 		{
-			if (p != nullptr) {
-				if (p->right) {
-					postorder(p->right, indent + 4);
-				}
-				if (indent) {
-					std::cout << std::setw(indent) << ' ';
-				}
-				if (p->right) std::cout << " /\n" << std::setw(indent) << ' ';
-				if (p->parent != nullptr) {
-					std::cout << p->key << "--" << p->parent->key << "\n ";
-				}else
-				{
-					std::cout << p->key << "--" << "null parent" << "\n ";
-				}
-				if (p->left) {
-					std::cout << std::setw(indent) << ' ' << " \\\n";
-					postorder(p->left, indent + 4);
-				}
-			}
+			if constexpr (Options::stats)
+			{
+				stats_counters::add(this->counters.searches, 1);
+				stats_counters::add(this->counters.comparisons, search.comparisons);
+				stats_counters::add(this->counters.search_path_lengths[static_cast<std::size_t>(
+					std::min<std::uint64_t>(search.nodes, avl_tree_stats::histogram_buckets - 1))], 1);
+			} // else, do_nothing();
 		}
 
 		/**
-		 * Check to see if the current key contains a nullptr.
-		 * @param current
+		 * Count a rotation made by balance, when stats are on.
+		 * @param twice true for a double rotation
 		 */
-		void empty(node *&current)
+		void count_rotation(bool twice)
 		{
-			if (current != nullptr)
+			if constexpr (Options::stats)
 			{
-				this->empty(current->left);
-				this->empty(current->right);
-				delete current;
-			} // else, current is null, do_nothing();
-
-			current = nullptr;
+				stats_counters::add(twice ? this->counters.double_rotations : this->counters.single_rotations, 1);
+			} // else, do_nothing();
 		}
 
 		/**
-		 * Cone the current node and all of its necessary components.
-		 * @param current
-		 * @return a copy of the current node.
+		 * Find the node holding key.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key anything Compare can order against K
+		 * @return the node.
 		 */
-		node *clone(node *current) const
+		template<typename Key>
+		node *get_node(const Key &key) const
 		{
-			if (current == nullptr)
-				return nullptr;
-			else
-				return new node{ current->element, clone->key, clone->parent,
-								 clone(current->left), clone(current->right), 
-								 current->height };
+			node *found = this->find_node(key);
+			if (found == nullptr)
+			{
+				throw std::length_error("Data not Found....");
+			} // else, we found the key, do_nothing();
+			return found;
 		}
 
 		/**
-		 * Insert a key, value, parent, left, right, and height
-		 * into the current node.
-		 * @param value
-		 * @param parent
-		 * @param key
-		 * @param current
-		 * @return iterator
+		 * Find the first node whose key is not less than key.
+		 * @param key anything Compare can order against K
+		 * @return the node or a null pointer.
 		 */
-		iterator insert(const T &value, const K &key, node *parent,  node *&current)
+		template<typename Key>
+		node *lower_bound_node(const Key &key) const
 		{
-			if (current == nullptr)
+			node *current = this->root;
+			node *bound = nullptr;
+			while (current != nullptr)
 			{
-				if (parent == nullptr)
+				if (this->compare(current->key, key))
 				{
-					current = new node{ value, key, nullptr, nullptr, nullptr };
-					tree_size += 1;
-					root = current;
-					return iterator(current);
+					current = current->right;
 				}
 				else
 				{
-					current = new node{ value, key, parent, nullptr, nullptr };
-					tree_size += 1;
-					return iterator(current);
+					bound = current;
+					current = current->left;
 				}
 			}
-			else if (key < current->key)
-			{
-				this->insert(value, key, parent, current->left);
-			}
-			else if (current->key < value)
-			{
-				this->insert(value, key, parent, current->right);
-			}
-			else
-			{
-				current->element = value;
-			}
-
-			tree_size += 1;
-			this->balance(current);
-			return iterator(current);
+			return bound;
 		}
 
 		/**
-		 * Insert a value, key, parent, left, right, and height
-		 * into the current node using move semantics.
-		 * @param value
-		 * @param key
-		 * @param parent
-		 * @param current
-		 * @return iterator
+		 * Find the first node whose key is greater than key.
+		 * @param key anything Compare can order against K
+		 * @return the node or a null pointer.
 		 */
-		void insert(const T &&value, const K &&key, node *parent, node *&current)
+		template<typename Key>
+		node *upper_bound_node(const Key &key) const
 		{
-			if (current == nullptr)
+			node *current = this->root;
+			node *bound = nullptr;
+			while (current != nullptr)
 			{
-				if (parent == nullptr)
+				if (this->compare(key, current->key))
 				{
-					current = new node{ std::move(value), std::move(key), nullptr, nullptr, nullptr };
-					tree_size += 1;
-					root = current;
-					//return iterator(current);
+					bound = current;
+					current = current->left;
 				}
 				else
 				{
-					current = new node{ std::move(value), std::move(key), parent, nullptr, nullptr };
-					tree_size += 1;
-					//return iterator(current);
+					current = current->right;
 				}
 			}
-			else if (key < current->key)
-			{
-				this->insert(std::move(value), std::move(key), current, current->left);
-			}
-			else if (current->key < key)
-			{
-				this->insert(std::move(value), std::move(key), current, current->right);
-			}
-			else
-			{
-				current->element = value;
-			}
-
-			this->balance(current);
-			//return iterator(current);
+			return bound;
 		}
 
 		/**
-		 * Remove the value referenced by the key.
-		 * This DOES NOT delete the KEY.
-		 * ONLY the VALUE inside the KEY.
-		 * @param key the current key
-		 * @param current the current value
+		 * Both bounds of key from a single lookup.
+		 * @param key anything Compare can order against K
+		 * @return lower_bound(key) and upper_bound(key).
 		 */
-		void remove(const T &key, node *&current)
+		template<typename Key>
+		std::pair<iterator, iterator> equal_range_nodes(const Key &key) const
 		{
-			if (current == nullptr)
+			node *lower = this->lower_bound_node(key);
+			if (lower == nullptr || this->compare(key, lower->key))
 			{
-				// we did not find the item to remove. 
-				return; 
-			} // else, we found the item do_nothing();
+				return { iterator(lower), iterator(lower) };
+			} // else, lower holds the key itself, do_nothing();
+			return { iterator(lower), iterator(next_node(lower)) };
+		}
 
-			if (key < current->key)
-			{
-				this->remove(key, current->key->left);
-			}
-			else if (current->key < key)
+		/**
+		 * Visit every node with low <= key < high, in order.
+		 * @param low
+		 * @param high
+		 * @param visit called with the key and the value
+		 */
+		template<typename Key, typename Visitor>
+		void for_each_in_range_nodes(const Key &low, const Key &high, Visitor &visit) const
+		{
+			for (node *current = this->lower_bound_node(low);
+				 current != nullptr && this->compare(current->key, high);
+				 current = next_node(current))
 			{
-				this->remove(key, current->key->right);
+				visit(static_cast<const K &>(current->key), static_cast<element_reference>(current->element));
 			}
-			else if (current->left != nullptr && current->right != nullptr)
+		}
+
+		/**
+		 * Finds the node with the next larger key.
+		 * @param current
+		 * @return the successor or a null pointer.
+		 */
+		static node *next_node(node *current)
+		{
+			if constexpr (Options::threaded)
 			{
-				// here we have two children
-				current->key = this->find_min(current->right)->key;
-				this->remove(current->key, current->right);
+				return current->next;
 			}
 			else
 			{
-				// here we have no children :( or one child. 
-				node *old_node = current;
-				current = (current->left != nullptr) ? current->left : current->right;
-				delete old_node;
+				return climb_to_next(current);
 			}
-
-			this->balance(current);
 		}
 
 		/**
-		 * Determine if the current key is not a null pointer.
-		 * @param key
+		 * Finds the node with the next smaller key.
 		 * @param current
-		 * @return true if the current key is not a null pointer.
+		 * @return the predecessor or a null pointer.
 		 */
-		bool contains_key(K key, node *current)
+		static node *previous_node(node *current)
 		{
-			if (current == nullptr)
+			if constexpr (Options::threaded)
 			{
-				return false;
-			}
-			else if (key < current->key)
-			{
-				return this->contains_key(key, current->left);
-			}
-			else if (current->key < key)
-			{
-				return this->contains_key(key, current->right);
+				return current->previous;
 			}
 			else
 			{
-				return true;
+				return climb_to_previous(current);
 			}
 		}
 
 		/**
-		 * Determine if the current value is not a null pointer.
-		 * @param value
+		 * Finds the node with the next larger key by going down the right
+		 * subtree or else up to the first ancestor we are left of. This
+		 * works on any subtree whose root has no parent, threaded or not.
 		 * @param current
-		 * @reutrn true if the current value is not a null pointer.
+		 * @return the successor or a null pointer.
 		 */
-		bool contains_value(T value, node *current)
+		static node *climb_to_next(node *current)
 		{
-			if (current == nullptr)
-			{
-				return false;
-			}
-			else if (value < current->element)
-			{
-				return this->contains_value (value, current->left);
-			}
-			else if (current->element < value)
+			if (current->right != nullptr)
 			{
-				return this->contains_value(value, current->right);
-			}
-			else
+				current = current->right;
+				while (current->left != nullptr)
+				{
+					current = current->left;
+				}
+				return current;
+			} // else, climb until we come up from a left child, do_nothing();
+
+			while (current->parent != nullptr && current == current->parent->right)
 			{
-				return true;
+				current = current->parent;
 			}
+			return current->parent;
 		}
 
 		/**
-		 * Get the value associated with a key.
-		 * If the key does not exist in the tree throw an exception.
-		 * @param key
+		 * Finds the node with the next smaller key by climbing, like
+		 * climb_to_next.
 		 * @param current
+		 * @return the predecessor or a null pointer.
 		 */
-		T &get(K key, node *&current)
+		static node *climb_to_previous(node *current)
 		{
-			if (current == nullptr)
+			if (current->left != nullptr)
 			{
-				throw std::length_error("Data not Found....");
-			}
-			else if (key < current->key)
+				current = current->left;
+				while (current->right != nullptr)
+				{
+					current = current->right;
+				}
+				return current;
+			} // else, climb until we come up from a right child, do_nothing();
+
+			while (current->parent != nullptr && current == current->parent->left)
 			{
-				return this->get(key, current->left);
+				current = current->parent;
 			}
-			else if (current->key < key)
+			return current->parent;
+		}
+
+		/**
+		 * Link before and after as neighbours in key order, when the tree
+		 * is threaded. Either may be a null pointer.
+		 * @param before
+		 * @param after
+		 */
+		static void join_threads(node *before, node *after)
+		{
+			if constexpr (Options::threaded)
 			{
-				return this->get(key, current->right);
-			}
-			return current->element;
+				if (before != nullptr)
+				{
+					before->next = after;
+				} // else, do_nothing();
+				if (after != nullptr)
+				{
+					after->previous = before;
+				} // else, do_nothing();
+			} // else, do_nothing();
 		}
 
 		/**
-		 * Private facing subscript operator overload
-		 * @param key
+		 * Break the links between two neighbours that now sit in
+		 * different trees, when the tree is threaded.
+		 * @param before
+		 * @param after
+		 */
+		static void cut_threads(node *before, node *after)
+		{
+			join_threads(before, nullptr);
+			join_threads(nullptr, after);
+		}
+
+		/**
+		 * Take a node that is leaving the tree out of the in order links,
+		 * when the tree is threaded.
 		 * @param current
-		 * @return the current node.
 		 */
-		T &subscript_overload(K key, node *&current)
+		static void unthread(node *current)
 		{
-			if (current == nullptr)
-			{
-				return{};
-			}
-			else if (key < current->key)
+			if constexpr (Options::threaded)
 			{
-				this->operator[](tree_size, current->left);
-			}
-			else if (current->key < key)
+				join_threads(current->previous, current->next);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Rebuild every in order link with one walk over the tree, when
+		 * the tree is threaded.
+		 */
+		void thread_all()
+		{
+			if constexpr (Options::threaded)
 			{
-				this->operator[](tree_size, current->right);
-			}
-			return current->element;
+				node *previous = nullptr;
+				for (node *current = find_min(this->root); current != nullptr; current = climb_to_next(current))
+				{
+					join_threads(previous, current);
+					previous = current;
+				}
+				join_threads(previous, nullptr);
+			} // else, do_nothing();
 		}
 
 		/**
@@ -983,8 +3973,8 @@ namespace nwacc
 				current->left->parent = current;
 			} // else, do_nothing();
 
-			current->height = std::max(this->height(current->left), this->height(current->right)) + 1;
-			temp->height = std::max(this->height(temp->left), current->height) + 1;
+			this->update(current);
+			this->update(temp);
 			
 			current = temp;
 		}
@@ -1012,8 +4002,8 @@ namespace nwacc
 				current->left->parent = current;
 			} // else, do_nothing();
 
-			current->height = std::max(this->height(current->left), this->height(current->right)) + 1;
-			temp->height = std::max(this->height(temp->right), current->height) + 1;
+			this->update(current);
+			this->update(temp);
 
 			current = temp;
 		}
@@ -1060,10 +4050,12 @@ namespace nwacc
 					this->height(current->left->right))
 				{
 					this->rotate_with_left_child(current);
+					this->count_rotation(false);
 				}
 				else
 				{
 					this->double_rotate_with_left_child(current);
+					this->count_rotation(true);
 				}
 			}
 			else if (this->height(current->right) - 
@@ -1074,16 +4066,79 @@ namespace nwacc
 					this->height(current->right->left))
 				{
 					this->rotate_with_right_child(current);
+					this->count_rotation(false);
 				}
 				else
 				{
 					this->double_rotate_with_right_child(current);
+					this->count_rotation(true);
 				}
 			} // else, the nodes are balanced within 1, do_nothing();
 
-			current->height = std::max(
-				this->height(current->left),
-				this->height(current->right)) + 1;
+			this->update(current);
+		}
+
+		/**
+		 * Number of nodes in the subtree at current.
+		 * @param current
+		 * @return the subtree size, 0 for a null pointer.
+		 */
+		static std::size_t count(const node *current)
+		{
+			return current == nullptr ? 0 : current->count;
+		}
+
+		/**
+		 * Recompute the height, and the subtree size when order
+		 * statistics are on, of current from its children.
+		 * @param current
+		 */
+		void update(node *current)
+		{
+			current->height = std::max(this->height(current->left), this->height(current->right)) + 1;
+			if constexpr (Options::order_statistics)
+			{
+				current->count = count(current->left) + count(current->right) + 1;
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Copy the subtree size of from into to when order statistics
+		 * are on.
+		 * @param to
+		 * @param from
+		 */
+		void copy_count(node *to, const node *from)
+		{
+			if constexpr (Options::order_statistics)
+			{
+				to->count = from->count;
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Count the keys that are less than key.
+		 * @param key anything Compare can order against K
+		 * @return the number of smaller keys.
+		 */
+		template<typename Key>
+		std::size_t rank_of(const Key &key) const
+		{
+			std::size_t smaller = 0;
+			node *current = this->root;
+			while (current != nullptr)
+			{
+				if (this->compare(current->key, key))
+				{
+					smaller += count(current->left) + 1;
+					current = current->right;
+				}
+				else
+				{
+					current = current->left;
+				}
+			}
+			return smaller;
 		}
 	};
 }
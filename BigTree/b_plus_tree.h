@@ -0,0 +1,1140 @@
+#ifndef B_PLUS_TREE_H_
+#define B_PLUS_TREE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace nwacc
+{
+	/**
+	 * The default number of keys per b_plus_tree node: as many as fit in
+	 * four 64 byte cache lines, kept even and between 16 and 64.
+	 * @param K the key type
+	 */
+	template<typename K>
+	struct b_plus_tree_fanout
+	{
+		static constexpr std::size_t fitted = (256 / sizeof(K)) / 2 * 2;
+		static constexpr std::size_t value = fitted < 16 ? 16 : (fitted > 64 ? 64 : fitted);
+	};
+
+	/**
+	 * A B+ tree engine with the same interface as avl_tree. Each node
+	 * holds up to Fanout keys side by side, so a lookup touches one node
+	 * per level of a tree that is log(Fanout) times shallower, and finds
+	 * its key inside the node with a search over contiguous memory
+	 * instead of one pointer chase per key. Values live only in the
+	 * leaves, which are linked in key order, so in order iteration walks
+	 * arrays.
+	 *
+	 * Keys and values sit in fixed arrays inside the nodes, so K and T
+	 * must be default constructible and move assignable. Iterators and
+	 * references are invalidated by any insert or remove, which may move
+	 * entries between nodes.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Compare orders the keys
+	 * @param Fanout keys per node, even and at least 4
+	 */
+	template<typename T, typename K, typename Compare = std::less<K>,
+			 std::size_t Fanout = b_plus_tree_fanout<K>::value>
+	class b_plus_tree
+	{
+		static_assert(Fanout >= 4 && Fanout % 2 == 0, "b_plus_tree needs an even Fanout of at least 4");
+
+	private:
+		static constexpr int max_keys = static_cast<int>(Fanout);
+		static constexpr int min_keys = max_keys / 2;
+
+		/**
+		 * The deepest path insert and remove may need to record. Every
+		 * node but the root has at least min_keys keys, so even at the
+		 * smallest fanout this is more levels than memory can fill.
+		 */
+		static constexpr int max_depth = 48;
+
+		/**
+		 * What every node starts with. Whether a node is a leaf follows
+		 * from its level, so it is not stored.
+		 */
+		struct node
+		{
+			int count = 0;
+		};
+
+		/**
+		 * A leaf holds count keys and their values in order. There is
+		 * room for one more than max_keys, so an insert can overflow the
+		 * leaf before it is split.
+		 */
+		struct leaf_node : node
+		{
+			K keys[Fanout + 1];
+			T values[Fanout + 1];
+			leaf_node *previous = nullptr;
+			leaf_node *next = nullptr;
+		};
+
+		/**
+		 * An inner node holds count separator keys and count + 1
+		 * children. Child i holds the keys below keys[i], and child i + 1
+		 * the keys from keys[i] up.
+		 */
+		struct inner_node : node
+		{
+			K keys[Fanout + 1];
+			node *children[Fanout + 2];
+		};
+
+		/**
+		 * One step of a descent: the inner node and the child taken.
+		 */
+		struct step
+		{
+			inner_node *parent;
+			int index;
+		};
+
+		/**
+		 * The root node, a leaf when levels is 1.
+		 */
+		node *root = nullptr;
+
+		/**
+		 * The number of levels, 0 for an empty tree.
+		 */
+		int levels = 0;
+
+		/**
+		 * The ends of the leaf chain.
+		 */
+		leaf_node *first_leaf = nullptr;
+		leaf_node *last_leaf = nullptr;
+
+		/**
+		 * Represents the number of items in the tree.
+		 */
+		std::size_t tree_size = 0;
+
+		/**
+		 * Orders the keys.
+		 */
+		Compare compare;
+
+	public:
+		/**
+		 * Create an empty tree.
+		 */
+		b_plus_tree() = default;
+
+		/**
+		 * Create an empty tree that orders its keys with compare.
+		 * @param compare
+		 */
+		explicit b_plus_tree(const Compare &compare) : compare{ compare } {}
+
+		/**
+		 * Copy every node of rhs, keeping its shape.
+		 * @param rhs
+		 */
+		b_plus_tree(const b_plus_tree &rhs) : levels{ rhs.levels }, tree_size{ rhs.tree_size }, compare{ rhs.compare }
+		{
+			if (rhs.root != nullptr)
+			{
+				leaf_node *previous = nullptr;
+				this->root = this->clone(rhs.root, 1, previous);
+				this->last_leaf = previous;
+			} // else, nothing to copy, do_nothing();
+		}
+
+		/**
+		 * Take the nodes of rhs.
+		 * @param rhs
+		 */
+		b_plus_tree(b_plus_tree &&rhs) noexcept
+		{
+			this->swap(rhs);
+		}
+
+		~b_plus_tree()
+		{
+			this->empty();
+		}
+
+		b_plus_tree &operator=(const b_plus_tree &rhs)
+		{
+			b_plus_tree copy = rhs;
+			this->swap(copy);
+			return *this;
+		}
+
+		b_plus_tree &operator=(b_plus_tree &&rhs) noexcept
+		{
+			this->swap(rhs);
+			return *this;
+		}
+
+		/**
+		 * Determine if the tree has no keys.
+		 * @return true if the tree is empty.
+		 */
+		bool is_empty() const
+		{
+			return this->root == nullptr;
+		}
+
+		/**
+		 * @return the number of keys in the tree.
+		 */
+		std::size_t size() const
+		{
+			return this->tree_size;
+		}
+
+		/**
+		 * Remove every key from the tree.
+		 */
+		void empty()
+		{
+			if (this->root != nullptr)
+			{
+				this->free_node(this->root, 1);
+			} // else, do_nothing();
+			this->root = nullptr;
+			this->levels = 0;
+			this->first_leaf = nullptr;
+			this->last_leaf = nullptr;
+			this->tree_size = 0;
+		}
+
+		/**
+		 * Determine if the key is in the tree.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		bool contains(const K &key) const
+		{
+			return this->find_entry(key).leaf != nullptr;
+		}
+
+		/**
+		 * Get the value associated with a key.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		T get(const K &key) const
+		{
+			const entry found = this->find_entry(key);
+			if (found.leaf == nullptr)
+			{
+				throw std::length_error("Data not Found....");
+			} // else, we found the key, do_nothing();
+			return found.leaf->values[found.index];
+		}
+
+		/**
+		 * Remove the key and its value from the tree.
+		 * @param key
+		 */
+		void remove(const K &key)
+		{
+			this->remove_entry(key);
+		}
+
+		/**
+		 * Remove the key and its value from the tree.
+		 * @param key
+		 * @return the number of keys removed, 0 or 1.
+		 */
+		std::size_t erase(const K &key)
+		{
+			return this->remove_entry(key) ? 1 : 0;
+		}
+
+	private:
+		/**
+		 * A position in a leaf. A null leaf is the end of the tree.
+		 */
+		struct entry
+		{
+			leaf_node *leaf;
+			int index;
+		};
+
+	public:
+#pragma region const_iterator
+		class const_iterator
+		{
+		public:
+			/**
+			 * Construct the const_iterator at the end of the tree.
+			 */
+			const_iterator() : tree{ nullptr }, current{ nullptr, 0 } {}
+
+			/**
+			 * Overload the pointer operator.
+			 * @return the value at the current entry.
+			 */
+			const T &operator*() const
+			{
+				return this->current.leaf->values[this->current.index];
+			}
+
+			/**
+			 * Return the current key.
+			 * @return current key.
+			 */
+			const K &get_key() const
+			{
+				return this->current.leaf->keys[this->current.index];
+			}
+
+			/**
+			 * Move to the next larger key, following the leaf chain.
+			 * @return const_iterator
+			 */
+			const_iterator &operator++()
+			{
+				this->current.index += 1;
+				if (this->current.index == this->current.leaf->count)
+				{
+					this->current.leaf = this->current.leaf->next;
+					this->current.index = 0;
+				} // else, still inside the leaf, do_nothing();
+				return *this;
+			}
+
+			/**
+			 * This is the postfix operator.
+			 * @return const_iterator
+			 */
+			const_iterator operator++(int)
+			{
+				auto old = *this;
+				++(*this);
+				return old;
+			}
+
+			/**
+			 * Move to the next smaller key. From the end this is the
+			 * largest key.
+			 * @return const_iterator
+			 */
+			const_iterator &operator--()
+			{
+				if (this->current.leaf == nullptr)
+				{
+					this->current.leaf = this->tree->last_leaf;
+					this->current.index = this->current.leaf != nullptr ? this->current.leaf->count - 1 : 0;
+				}
+				else if (this->current.index > 0)
+				{
+					this->current.index -= 1;
+				}
+				else
+				{
+					this->current.leaf = this->current.leaf->previous;
+					this->current.index = this->current.leaf != nullptr ? this->current.leaf->count - 1 : 0;
+				}
+				return *this;
+			}
+
+			/**
+			 * This is the postfix operator.
+			 * @return const_iterator
+			 */
+			const_iterator operator--(int)
+			{
+				auto old = *this;
+				--(*this);
+				return old;
+			}
+
+			bool operator== (const const_iterator &rhs) const
+			{
+				return this->current.leaf == rhs.current.leaf && this->current.index == rhs.current.index;
+			}
+
+			bool operator!= (const const_iterator &rhs) const
+			{
+				return !(*this == rhs);
+			}
+
+		protected:
+			const b_plus_tree *tree;
+			entry current;
+
+			const_iterator(const b_plus_tree *tree, entry current) : tree{ tree }, current{ current } {}
+
+			friend class b_plus_tree;
+		};
+#pragma endregion
+#pragma region iterator
+		class iterator : public const_iterator
+		{
+		public:
+			/**
+			 * Construct the iterator at the end of the tree.
+			 */
+			iterator() = default;
+
+			/**
+			 * Overload the pointer operator.
+			 * @return the value at the current entry.
+			 */
+			T &operator*()
+			{
+				return this->current.leaf->values[this->current.index];
+			}
+
+			iterator &operator++()
+			{
+				const_iterator::operator++();
+				return *this;
+			}
+
+			iterator operator++(int)
+			{
+				auto old = *this;
+				++(*this);
+				return old;
+			}
+
+			iterator &operator--()
+			{
+				const_iterator::operator--();
+				return *this;
+			}
+
+			iterator operator--(int)
+			{
+				auto old = *this;
+				--(*this);
+				return old;
+			}
+
+		private:
+			iterator(const b_plus_tree *tree, entry current) : const_iterator{ tree, current } {}
+
+			friend class b_plus_tree;
+		};
+#pragma endregion
+
+		iterator first_element() const
+		{
+			return iterator(this, { this->first_leaf, 0 });
+		}
+
+		iterator last_element() const
+		{
+			return iterator(this, { this->last_leaf, this->last_leaf != nullptr ? this->last_leaf->count - 1 : 0 });
+		}
+
+		iterator begin() const
+		{
+			return iterator(this, { nullptr, 0 });
+		}
+
+		iterator end() const
+		{
+			return iterator(this, { nullptr, 0 });
+		}
+
+		/**
+		 * Insert a value at the key, replacing the value already there.
+		 * @param value
+		 * @param key
+		 * @return an iterator to the key.
+		 */
+		iterator insert(const T &value, const K &key)
+		{
+			return iterator(this, this->insert_entry(value, key));
+		}
+
+		/**
+		 * Insert a value at the key with move semantics.
+		 * @param value
+		 * @param key
+		 * @return an iterator to the key.
+		 */
+		iterator insert(T &&value, K &&key)
+		{
+			return iterator(this, this->insert_entry(std::move(value), std::move(key)));
+		}
+
+		/**
+		 * Get the value at the key, inserting a default value if the key
+		 * is not in the tree yet.
+		 * @param key
+		 * @return the value at the key.
+		 */
+		T &operator[](const K &key)
+		{
+			entry found = this->find_entry(key);
+			if (found.leaf == nullptr)
+			{
+				found = this->insert_entry(T{}, key);
+			} // else, the key is already there, do_nothing();
+			return found.leaf->values[found.index];
+		}
+
+		/**
+		 * Find the key in the tree.
+		 * @param key
+		 * @return an iterator to the key or end() if it is not there.
+		 */
+		iterator find(const K &key) const
+		{
+			return iterator(this, this->find_entry(key));
+		}
+
+		/**
+		 * Find the first key that is not less than key.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		iterator lower_bound(const K &key) const
+		{
+			return iterator(this, this->bound_entry(key, false));
+		}
+
+		/**
+		 * Find the first key that is greater than key.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		iterator upper_bound(const K &key) const
+		{
+			return iterator(this, this->bound_entry(key, true));
+		}
+
+		/**
+		 * Call visit(key, value) for every key k with low <= k < high, in
+		 * order. One descent finds low and the rest walks the leaves.
+		 * @param low
+		 * @param high
+		 * @param visit
+		 */
+		template<typename Visitor>
+		void for_each_in_range(const K &low, const K &high, Visitor visit) const
+		{
+			entry current = this->bound_entry(low, false);
+			while (current.leaf != nullptr)
+			{
+				leaf_node *leaf = current.leaf;
+				for (int index = current.index; index < leaf->count; index++)
+				{
+					if (!this->compare(leaf->keys[index], high))
+					{
+						return;
+					} // else, still inside the range, do_nothing();
+					visit(static_cast<const K &>(leaf->keys[index]), leaf->values[index]);
+				}
+				current = { leaf->next, 0 };
+			}
+		}
+
+		/**
+		 * Overload the ostream operator to print the tree
+		 * forwards and backwards.
+		 * @param out the value to be printed to the console.
+		 * @param rhs the right hand side
+		 */
+		friend std::ostream &operator<<(std::ostream &out, const b_plus_tree &rhs)
+		{
+			for (iterator item = rhs.first_element(); item != rhs.end(); item++)
+			{
+				out << item.get_key() << '\n';
+			}
+
+			for (iterator item = rhs.last_element(); item != rhs.begin(); item--)
+			{
+				out << item.get_key() << '\n';
+			}
+			return out;
+		}
+
+	private:
+		void swap(b_plus_tree &rhs) noexcept
+		{
+			using std::swap;
+			swap(this->root, rhs.root);
+			swap(this->levels, rhs.levels);
+			swap(this->first_leaf, rhs.first_leaf);
+			swap(this->last_leaf, rhs.last_leaf);
+			swap(this->tree_size, rhs.tree_size);
+			swap(this->compare, rhs.compare);
+		}
+
+		/**
+		 * Pick the child of an inner node that may hold key.
+		 * @param inner
+		 * @param key
+		 * @return the child index.
+		 */
+		int child_index(const inner_node *inner, const K &key) const
+		{
+			return static_cast<int>(std::upper_bound(inner->keys, inner->keys + inner->count, key, this->compare) -
+									inner->keys);
+		}
+
+		/**
+		 * Walk from the root to the leaf that may hold key.
+		 * @param key
+		 * @param path filled with one step per inner node when not null
+		 * @return the leaf.
+		 */
+		leaf_node *descend(const K &key, step *path) const
+		{
+			node *current = this->root;
+			for (int level = 1; level < this->levels; level++)
+			{
+				inner_node *inner = static_cast<inner_node *>(current);
+				const int index = this->child_index(inner, key);
+				if (path != nullptr)
+				{
+					path[level - 1] = { inner, index };
+				} // else, do_nothing();
+				current = inner->children[index];
+			}
+			return static_cast<leaf_node *>(current);
+		}
+
+		/**
+		 * Find the first slot of a leaf whose key is not less than key.
+		 * @param leaf
+		 * @param key
+		 * @return the slot, count if every key is less.
+		 */
+		int leaf_index(const leaf_node *leaf, const K &key) const
+		{
+			return static_cast<int>(std::lower_bound(leaf->keys, leaf->keys + leaf->count, key, this->compare) -
+									leaf->keys);
+		}
+
+		/**
+		 * Find the entry holding key.
+		 * @param key
+		 * @return the entry, or the end when the key is missing.
+		 */
+		entry find_entry(const K &key) const
+		{
+			if (this->root == nullptr)
+			{
+				return { nullptr, 0 };
+			} // else, do_nothing();
+
+			leaf_node *leaf = this->descend(key, nullptr);
+			const int index = this->leaf_index(leaf, key);
+			if (index == leaf->count || this->compare(key, leaf->keys[index]))
+			{
+				return { nullptr, 0 };
+			} // else, we found the key, do_nothing();
+			return { leaf, index };
+		}
+
+		/**
+		 * Find the first entry whose key is not less than key, or greater
+		 * than key when upper is set.
+		 * @param key
+		 * @param upper
+		 * @return the entry or the end.
+		 */
+		entry bound_entry(const K &key, bool upper) const
+		{
+			if (this->root == nullptr)
+			{
+				return { nullptr, 0 };
+			} // else, do_nothing();
+
+			leaf_node *leaf = this->descend(key, nullptr);
+			const int index = upper
+				? static_cast<int>(std::upper_bound(leaf->keys, leaf->keys + leaf->count, key, this->compare) - leaf->keys)
+				: this->leaf_index(leaf, key);
+			if (index == leaf->count)
+			{
+				// every key here is smaller, so the bound starts the next leaf
+				return { leaf->next, 0 };
+			} // else, do_nothing();
+			return { leaf, index };
+		}
+
+		/**
+		 * Insert a key and value, or replace the value if the key is
+		 * already in the tree. A leaf that overflows is split in two and
+		 * the first key of the new right half goes up to the parent,
+		 * which may split in turn.
+		 * @param value
+		 * @param key
+		 * @return the entry holding the key.
+		 */
+		template<typename V, typename Key>
+		entry insert_entry(V &&value, Key &&key)
+		{
+			if (this->root == nullptr)
+			{
+				leaf_node *leaf = new leaf_node;
+				this->root = leaf;
+				this->levels = 1;
+				this->first_leaf = leaf;
+				this->last_leaf = leaf;
+			} // else, do_nothing();
+
+			step path[max_depth];
+			leaf_node *leaf = this->descend(key, path);
+			const int index = this->leaf_index(leaf, key);
+			if (index < leaf->count && !this->compare(key, leaf->keys[index]))
+			{
+				leaf->values[index] = std::forward<V>(value);
+				return { leaf, index };
+			} // else, the key is new, do_nothing();
+
+			for (int slot = leaf->count; slot > index; slot--)
+			{
+				leaf->keys[slot] = std::move(leaf->keys[slot - 1]);
+				leaf->values[slot] = std::move(leaf->values[slot - 1]);
+			}
+			leaf->keys[index] = std::forward<Key>(key);
+			leaf->values[index] = std::forward<V>(value);
+			leaf->count += 1;
+			this->tree_size += 1;
+			if (leaf->count <= max_keys)
+			{
+				return { leaf, index };
+			} // else, the leaf overflowed, do_nothing();
+
+			leaf_node *right = new leaf_node;
+			const int keep = leaf->count - min_keys;
+			for (int slot = keep; slot < leaf->count; slot++)
+			{
+				right->keys[slot - keep] = std::move(leaf->keys[slot]);
+				right->values[slot - keep] = std::move(leaf->values[slot]);
+			}
+			right->count = leaf->count - keep;
+			leaf->count = keep;
+
+			right->previous = leaf;
+			right->next = leaf->next;
+			if (leaf->next != nullptr)
+			{
+				leaf->next->previous = right;
+			}
+			else
+			{
+				this->last_leaf = right;
+			}
+			leaf->next = right;
+
+			this->insert_into_parent(path, this->levels - 1, leaf, right->keys[0], right);
+			if (index < keep)
+			{
+				return { leaf, index };
+			} // else, the key moved to the new leaf, do_nothing();
+			return { right, index - keep };
+		}
+
+		/**
+		 * Hang right next to left in their parent, splitting inner nodes
+		 * up the path while they overflow. A split at the root grows the
+		 * tree by one level.
+		 * @param path
+		 * @param depth number of steps above left
+		 * @param left
+		 * @param key the smallest key under right
+		 * @param right
+		 */
+		void insert_into_parent(step path[], int depth, node *left, K key, node *right)
+		{
+			while (depth > 0)
+			{
+				inner_node *parent = path[depth - 1].parent;
+				const int index = path[depth - 1].index;
+				for (int slot = parent->count; slot > index; slot--)
+				{
+					parent->keys[slot] = std::move(parent->keys[slot - 1]);
+					parent->children[slot + 1] = parent->children[slot];
+				}
+				parent->keys[index] = std::move(key);
+				parent->children[index + 1] = right;
+				parent->count += 1;
+				if (parent->count <= max_keys)
+				{
+					return;
+				} // else, the parent overflowed, do_nothing();
+
+				// the middle key moves up and the keys after it move right
+				inner_node *sibling = new inner_node;
+				const int middle = min_keys;
+				for (int slot = middle + 1; slot < parent->count; slot++)
+				{
+					sibling->keys[slot - middle - 1] = std::move(parent->keys[slot]);
+				}
+				for (int slot = middle + 1; slot <= parent->count; slot++)
+				{
+					sibling->children[slot - middle - 1] = parent->children[slot];
+				}
+				sibling->count = parent->count - middle - 1;
+				parent->count = middle;
+
+				key = std::move(parent->keys[middle]);
+				left = parent;
+				right = sibling;
+				depth -= 1;
+			}
+
+			inner_node *grown = new inner_node;
+			grown->keys[0] = std::move(key);
+			grown->children[0] = left;
+			grown->children[1] = right;
+			grown->count = 1;
+			this->root = grown;
+			this->levels += 1;
+		}
+
+		/**
+		 * Remove the key and its value. A leaf left with fewer than
+		 * min_keys keys borrows one from a sibling or is merged into it,
+		 * and a merge may leave the parent short in turn.
+		 * @param key
+		 * @return true if the key was found and removed.
+		 */
+		bool remove_entry(const K &key)
+		{
+			if (this->root == nullptr)
+			{
+				return false;
+			} // else, do_nothing();
+
+			step path[max_depth];
+			leaf_node *leaf = this->descend(key, path);
+			const int index = this->leaf_index(leaf, key);
+			if (index == leaf->count || this->compare(key, leaf->keys[index]))
+			{
+				// we did not find the item to remove.
+				return false;
+			} // else, we found the item do_nothing();
+
+			for (int slot = index + 1; slot < leaf->count; slot++)
+			{
+				leaf->keys[slot - 1] = std::move(leaf->keys[slot]);
+				leaf->values[slot - 1] = std::move(leaf->values[slot]);
+			}
+			leaf->count -= 1;
+			this->tree_size -= 1;
+
+			if (this->levels == 1)
+			{
+				if (leaf->count == 0)
+				{
+					this->empty();
+				} // else, a root leaf may hold any number of keys, do_nothing();
+				return true;
+			} // else, do_nothing();
+
+			if (leaf->count >= min_keys || !this->rebalance_leaf(leaf, path[this->levels - 2]))
+			{
+				return true;
+			} // else, two leaves merged and the parent lost a key, do_nothing();
+
+			for (int depth = this->levels - 2; depth >= 0; depth--)
+			{
+				inner_node *current = path[depth].parent;
+				if (depth == 0)
+				{
+					if (current->count == 0)
+					{
+						// the root has one child left, which takes its place
+						this->root = current->children[0];
+						this->levels -= 1;
+						delete current;
+					} // else, the root may hold any number of keys, do_nothing();
+					return true;
+				} // else, do_nothing();
+
+				if (current->count >= min_keys || !this->rebalance_inner(current, path[depth - 1]))
+				{
+					return true;
+				} // else, the merge moves up a level, do_nothing();
+			}
+			return true;
+		}
+
+		/**
+		 * Take the key at index and the child to its right out of an
+		 * inner node.
+		 * @param inner
+		 * @param index
+		 */
+		static void remove_separator(inner_node *inner, int index)
+		{
+			for (int slot = index + 1; slot < inner->count; slot++)
+			{
+				inner->keys[slot - 1] = std::move(inner->keys[slot]);
+			}
+			for (int slot = index + 2; slot <= inner->count; slot++)
+			{
+				inner->children[slot - 1] = inner->children[slot];
+			}
+			inner->count -= 1;
+		}
+
+		/**
+		 * Move every entry of right onto the end of left and drop right
+		 * from the leaf chain.
+		 * @param left
+		 * @param right
+		 */
+		void merge_leaves(leaf_node *left, leaf_node *right)
+		{
+			for (int slot = 0; slot < right->count; slot++)
+			{
+				left->keys[left->count + slot] = std::move(right->keys[slot]);
+				left->values[left->count + slot] = std::move(right->values[slot]);
+			}
+			left->count += right->count;
+			left->next = right->next;
+			if (right->next != nullptr)
+			{
+				right->next->previous = left;
+			}
+			else
+			{
+				this->last_leaf = left;
+			}
+			delete right;
+		}
+
+		/**
+		 * Refill a leaf that fell below min_keys from a sibling under the
+		 * same parent, or merge it with one.
+		 * @param leaf
+		 * @param above the parent and the index of leaf in it
+		 * @return true if two leaves merged, so the parent lost a key.
+		 */
+		bool rebalance_leaf(leaf_node *leaf, step above)
+		{
+			inner_node *parent = above.parent;
+			const int index = above.index;
+			leaf_node *left = index > 0 ? static_cast<leaf_node *>(parent->children[index - 1]) : nullptr;
+			leaf_node *right = index < parent->count ? static_cast<leaf_node *>(parent->children[index + 1]) : nullptr;
+
+			if (left != nullptr && left->count > min_keys)
+			{
+				for (int slot = leaf->count; slot > 0; slot--)
+				{
+					leaf->keys[slot] = std::move(leaf->keys[slot - 1]);
+					leaf->values[slot] = std::move(leaf->values[slot - 1]);
+				}
+				leaf->keys[0] = std::move(left->keys[left->count - 1]);
+				leaf->values[0] = std::move(left->values[left->count - 1]);
+				left->count -= 1;
+				leaf->count += 1;
+				parent->keys[index - 1] = leaf->keys[0];
+				return false;
+			} // else, do_nothing();
+
+			if (right != nullptr && right->count > min_keys)
+			{
+				leaf->keys[leaf->count] = std::move(right->keys[0]);
+				leaf->values[leaf->count] = std::move(right->values[0]);
+				leaf->count += 1;
+				for (int slot = 1; slot < right->count; slot++)
+				{
+					right->keys[slot - 1] = std::move(right->keys[slot]);
+					right->values[slot - 1] = std::move(right->values[slot]);
+				}
+				right->count -= 1;
+				parent->keys[index] = right->keys[0];
+				return false;
+			} // else, neither sibling can spare a key, do_nothing();
+
+			if (left != nullptr)
+			{
+				this->merge_leaves(left, leaf);
+				remove_separator(parent, index - 1);
+			}
+			else
+			{
+				this->merge_leaves(leaf, right);
+				remove_separator(parent, index);
+			}
+			return true;
+		}
+
+		/**
+		 * Refill an inner node that fell below min_keys by rotating a key
+		 * through the parent, or merge it with a sibling and the
+		 * separator between them.
+		 * @param current
+		 * @param above the parent and the index of current in it
+		 * @return true if two nodes merged, so the parent lost a key.
+		 */
+		bool rebalance_inner(inner_node *current, step above)
+		{
+			inner_node *parent = above.parent;
+			const int index = above.index;
+			inner_node *left = index > 0 ? static_cast<inner_node *>(parent->children[index - 1]) : nullptr;
+			inner_node *right = index < parent->count ? static_cast<inner_node *>(parent->children[index + 1]) : nullptr;
+
+			if (left != nullptr && left->count > min_keys)
+			{
+				for (int slot = current->count; slot > 0; slot--)
+				{
+					current->keys[slot] = std::move(current->keys[slot - 1]);
+				}
+				for (int slot = current->count + 1; slot > 0; slot--)
+				{
+					current->children[slot] = current->children[slot - 1];
+				}
+				current->keys[0] = std::move(parent->keys[index - 1]);
+				current->children[0] = left->children[left->count];
+				parent->keys[index - 1] = std::move(left->keys[left->count - 1]);
+				left->count -= 1;
+				current->count += 1;
+				return false;
+			} // else, do_nothing();
+
+			if (right != nullptr && right->count > min_keys)
+			{
+				current->keys[current->count] = std::move(parent->keys[index]);
+				current->children[current->count + 1] = right->children[0];
+				current->count += 1;
+				parent->keys[index] = std::move(right->keys[0]);
+				for (int slot = 1; slot < right->count; slot++)
+				{
+					right->keys[slot - 1] = std::move(right->keys[slot]);
+				}
+				for (int slot = 1; slot <= right->count; slot++)
+				{
+					right->children[slot - 1] = right->children[slot];
+				}
+				right->count -= 1;
+				return false;
+			} // else, neither sibling can spare a key, do_nothing();
+
+			if (left != nullptr)
+			{
+				this->merge_inner(left, current, parent, index - 1);
+			}
+			else
+			{
+				this->merge_inner(current, right, parent, index);
+			}
+			return true;
+		}
+
+		/**
+		 * Move the separator at index and everything in right onto the
+		 * end of left, then drop right.
+		 * @param left
+		 * @param right
+		 * @param parent
+		 * @param index the separator between left and right
+		 */
+		static void merge_inner(inner_node *left, inner_node *right, inner_node *parent, int index)
+		{
+			left->keys[left->count] = std::move(parent->keys[index]);
+			for (int slot = 0; slot < right->count; slot++)
+			{
+				left->keys[left->count + 1 + slot] = std::move(right->keys[slot]);
+			}
+			for (int slot = 0; slot <= right->count; slot++)
+			{
+				left->children[left->count + 1 + slot] = right->children[slot];
+			}
+			left->count += right->count + 1;
+			remove_separator(parent, index);
+			delete right;
+		}
+
+		/**
+		 * Copy the subtree at from, which sits at level, linking the
+		 * copied leaves in order after previous. A failed copy frees what
+		 * it built before it throws.
+		 * @param from
+		 * @param level 1 for the root
+		 * @param previous the last leaf copied so far
+		 * @return the copy.
+		 */
+		node *clone(const node *from, int level, leaf_node *&previous)
+		{
+			if (level == this->levels)
+			{
+				const leaf_node *leaf = static_cast<const leaf_node *>(from);
+				leaf_node *copy = new leaf_node;
+				try
+				{
+					std::copy(leaf->keys, leaf->keys + leaf->count, copy->keys);
+					std::copy(leaf->values, leaf->values + leaf->count, copy->values);
+				}
+				catch (...)
+				{
+					delete copy;
+					throw;
+				}
+				copy->count = leaf->count;
+				copy->previous = previous;
+				if (previous != nullptr)
+				{
+					previous->next = copy;
+				}
+				else
+				{
+					this->first_leaf = copy;
+				}
+				previous = copy;
+				return copy;
+			} // else, an inner node, do_nothing();
+
+			const inner_node *inner = static_cast<const inner_node *>(from);
+			inner_node *copy = new inner_node;
+			int built = 0;
+			try
+			{
+				std::copy(inner->keys, inner->keys + inner->count, copy->keys);
+				for (; built <= inner->count; built++)
+				{
+					copy->children[built] = this->clone(inner->children[built], level + 1, previous);
+				}
+			}
+			catch (...)
+			{
+				for (int slot = 0; slot < built; slot++)
+				{
+					this->free_node(copy->children[slot], level + 1);
+				}
+				delete copy;
+				throw;
+			}
+			copy->count = inner->count;
+			return copy;
+		}
+
+		/**
+		 * Free the subtree at current, which sits at level.
+		 * @param current
+		 * @param level 1 for the root
+		 */
+		void free_node(node *current, int level)
+		{
+			if (level == this->levels)
+			{
+				delete static_cast<leaf_node *>(current);
+				return;
+			} // else, an inner node, do_nothing();
+
+			inner_node *inner = static_cast<inner_node *>(current);
+			for (int slot = 0; slot <= inner->count; slot++)
+			{
+				this->free_node(inner->children[slot], level + 1);
+			}
+			delete inner;
+		}
+	};
+}
+
+#endif // B_PLUS_TREE_H_
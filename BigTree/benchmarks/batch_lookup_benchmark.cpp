@@ -0,0 +1,73 @@
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure lookups one get at a time against get_many and contains_many
+ * over batches of 256 keys, for every key count given on the command
+ * line. The gain shows once the tree is larger than the caches.
+ * usage: batch_lookup_benchmark [keys...]
+ * e.g. batch_lookup_benchmark 100000 4000000
+ */
+void run(std::size_t count)
+{
+	constexpr std::size_t batch = 256;
+	const std::string size = " n=" + std::to_string(count);
+	const auto keys = nwacc::bench::shuffled_keys(count);
+	nwacc::avl_tree<int, int> tree;
+	for (int key : keys)
+	{
+		tree.insert(key, key);
+	}
+	const auto order = nwacc::bench::shuffled_keys(count, 7);
+
+	long long sum = 0;
+	nwacc::bench::stopwatch timer;
+	for (int key : order)
+	{
+		sum += tree.get(key);
+	}
+	nwacc::bench::report("get" + size, count, timer.seconds());
+
+	std::vector<const int *> values(batch);
+	timer.restart();
+	for (std::size_t start = 0; start < count; start += batch)
+	{
+		const std::size_t end = std::min(count, start + batch);
+		tree.get_many(order.begin() + start, order.begin() + end, values.begin());
+		for (std::size_t index = 0; index < end - start; index++)
+		{
+			sum += *values[index];
+		}
+	}
+	nwacc::bench::report("get_many" + size, count, timer.seconds());
+
+	bool found[batch];
+	timer.restart();
+	for (std::size_t start = 0; start < count; start += batch)
+	{
+		const std::size_t end = std::min(count, start + batch);
+		tree.contains_many(order.begin() + start, order.begin() + end, found);
+		sum += found[0];
+	}
+	nwacc::bench::report("contains_many" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		run(100000);
+		run(4000000);
+	}
+	else
+	{
+		for (int index = 1; index < argc; index++)
+		{
+			run(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+	return 0;
+}
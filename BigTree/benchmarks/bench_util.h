@@ -0,0 +1,288 @@
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+namespace nwacc
+{
+	namespace bench
+	{
+		/**
+		 * Measures wall clock time between construction or the last restart.
+		 */
+		class stopwatch
+		{
+		public:
+			stopwatch() : start{ std::chrono::steady_clock::now() } {}
+
+			/**
+			 * Start timing again from now.
+			 */
+			void restart()
+			{
+				this->start = std::chrono::steady_clock::now();
+			}
+
+			/**
+			 * @return the seconds elapsed since the stopwatch was started.
+			 */
+			double seconds() const
+			{
+				return std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - this->start).count();
+			}
+
+		private:
+			std::chrono::steady_clock::time_point start;
+		};
+
+		/**
+		 * Read a count from the command line, falling back to a default.
+		 * @param argc
+		 * @param argv
+		 * @param index position of the argument
+		 * @param fallback
+		 * @return the parsed count.
+		 */
+		inline std::size_t count_arg(int argc, char **argv, int index, std::size_t fallback)
+		{
+			return argc > index ? static_cast<std::size_t>(std::stoull(argv[index])) : fallback;
+		}
+
+		/**
+		 * Build the keys 0 .. count - 1 in a shuffled order.
+		 * @param count
+		 * @param seed
+		 * @return the shuffled keys.
+		 */
+		inline std::vector<int> shuffled_keys(std::size_t count, std::uint32_t seed = 42)
+		{
+			std::vector<int> keys(count);
+			std::iota(keys.begin(), keys.end(), 0);
+			std::shuffle(keys.begin(), keys.end(), std::mt19937{ seed });
+			return keys;
+		}
+
+		/**
+		 * Print one result line as: name, operations, seconds, ops/sec.
+		 * @param name
+		 * @param operations
+		 * @param seconds
+		 */
+		inline void report(const std::string &name, std::size_t operations, double seconds)
+		{
+			std::cout << std::left << std::setw(40) << name
+				<< std::right << std::setw(12) << operations
+				<< std::setw(12) << std::fixed << std::setprecision(4) << seconds << " s"
+				<< std::setw(16) << std::setprecision(0) << operations / seconds << " ops/s\n";
+		}
+
+		/**
+		 * Keep the optimizer from throwing away a computed value. On GCC
+		 * and Clang an empty asm statement claims to read it, so it must
+		 * be computed and stored first; elsewhere it is copied into a
+		 * volatile.
+		 * @param value
+		 */
+		template<typename V>
+		inline void keep(const V &value)
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			asm volatile("" : : "g"(&value) : "memory");
+#else
+			volatile V sink = value;
+			(void)sink;
+#endif
+		}
+
+		/**
+		 * Turn integer keys into fixed width strings such as
+		 * "user000000000042", which sort in the same order as the numbers.
+		 * @param keys
+		 * @return the string keys.
+		 */
+		inline std::vector<std::string> string_keys(const std::vector<int> &keys)
+		{
+			std::vector<std::string> strings;
+			strings.reserve(keys.size());
+			char text[32];
+			for (int key : keys)
+			{
+				std::snprintf(text, sizeof(text), "user%012d", key);
+				strings.emplace_back(text);
+			}
+			return strings;
+		}
+
+		/**
+		 * Draws ranks 0 .. count - 1 with a Zipfian distribution, where
+		 * rank 0 is the most popular, as the YCSB generator does (Gray et
+		 * al., "Quickly Generating Billion-Record Synthetic Databases").
+		 * Setting up costs one pass over count to sum the weights.
+		 */
+		class zipf_generator
+		{
+		public:
+			/**
+			 * @param count the number of ranks
+			 * @param theta the skew, 0.99 in YCSB
+			 * @param seed
+			 */
+			zipf_generator(std::size_t count, double theta = 0.99, std::uint32_t seed = 42)
+				: count{ count }, theta{ theta }, random{ seed }
+			{
+				this->zeta_n = zeta(count, theta);
+				const double zeta_2 = zeta(2, theta);
+				this->alpha = 1.0 / (1.0 - theta);
+				this->eta = (1.0 - std::pow(2.0 / count, 1.0 - theta)) / (1.0 - zeta_2 / this->zeta_n);
+			}
+
+			/**
+			 * @return the next rank.
+			 */
+			std::size_t next()
+			{
+				const double u = this->uniform(this->random);
+				const double uz = u * this->zeta_n;
+				if (uz < 1.0)
+				{
+					return 0;
+				} // else, do_nothing();
+				if (uz < 1.0 + std::pow(0.5, this->theta))
+				{
+					return 1;
+				} // else, do_nothing();
+				const auto rank = static_cast<std::size_t>(this->count * std::pow(this->eta * u - this->eta + 1.0, this->alpha));
+				return std::min(rank, this->count - 1);
+			}
+
+		private:
+			std::size_t count;
+			double theta;
+			double zeta_n;
+			double alpha;
+			double eta;
+			std::mt19937_64 random;
+			std::uniform_real_distribution<double> uniform;
+
+			static double zeta(std::size_t count, double theta)
+			{
+				double sum = 0;
+				for (std::size_t index = 1; index <= count; index++)
+				{
+					sum += 1.0 / std::pow(static_cast<double>(index), theta);
+				}
+				return sum;
+			}
+		};
+
+		/**
+		 * Keeps the latency of every stride-th operation, so percentiles
+		 * cost a clock read on a small share of the operations however
+		 * many there are.
+		 */
+		class latency_sampler
+		{
+		public:
+			/**
+			 * @param operations how many operations will run
+			 * @param samples about how many of them to time
+			 */
+			explicit latency_sampler(std::size_t operations, std::size_t samples = 100000)
+				: stride{ std::max<std::size_t>(1, operations / samples) }
+			{
+				this->nanoseconds.reserve(operations / this->stride + 1);
+			}
+
+			/**
+			 * Run operation, timing it if its index falls on the stride.
+			 * @param index
+			 * @param operation
+			 */
+			template<typename Operation>
+			void run(std::size_t index, Operation &&operation)
+			{
+				if (index % this->stride != 0)
+				{
+					operation();
+					return;
+				} // else, this one is timed, do_nothing();
+
+				const auto start = std::chrono::steady_clock::now();
+				operation();
+				this->nanoseconds.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count()));
+			}
+
+			/**
+			 * @param fraction 0.5 for the median, 0.99 for p99
+			 * @return the latency in nanoseconds at that fraction.
+			 */
+			double percentile(double fraction)
+			{
+				if (this->nanoseconds.empty())
+				{
+					return 0;
+				} // else, do_nothing();
+				const auto at = this->nanoseconds.begin() +
+					static_cast<std::ptrdiff_t>(fraction * static_cast<double>(this->nanoseconds.size() - 1));
+				std::nth_element(this->nanoseconds.begin(), at, this->nanoseconds.end());
+				return *at;
+			}
+
+		private:
+			std::size_t stride;
+			std::vector<double> nanoseconds;
+		};
+
+		/**
+		 * @return the most memory the process has had resident so far, in
+		 * bytes.
+		 */
+		inline std::size_t peak_rss_bytes()
+		{
+#if defined(_WIN32)
+			PROCESS_MEMORY_COUNTERS counters;
+			if (::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+			{
+				return static_cast<std::size_t>(counters.PeakWorkingSetSize);
+			} // else, do_nothing();
+			return 0;
+#else
+			struct rusage usage;
+			::getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+			return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+			return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+		}
+	}
+}
+
+#endif // BENCH_UTIL_H_
@@ -0,0 +1,302 @@
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * The standard workloads, run against nwacc::avl_tree and std::map with
+ * int and string keys for every entry count on the command line:
+ * sequential, random and Zipfian inserts, gets and removes, range scans
+ * of 100 keys, a full in order iteration and the teardown of a full
+ * tree. Each result is one JSON object per line on stdout with ops/sec,
+ * the p50 and p99 latency of a sample of the operations in nanoseconds,
+ * and the peak resident memory of the process so far. Peak memory only
+ * grows, so pass --structure and --key to give each one its own run.
+ * usage: benchmark_suite [--structure avl_tree|std::map] [--key int|string] [entries...]
+ * e.g. benchmark_suite --structure avl_tree --key int 1000 1000000 100000000
+ */
+
+/**
+ * Operations on nwacc::avl_tree, in the shape every workload uses.
+ */
+template<typename K>
+struct avl_tree_target
+{
+	using container = nwacc::avl_tree<int, K>;
+
+	static const char *name()
+	{
+		return "avl_tree";
+	}
+
+	static void insert(container &tree, const K &key, int value)
+	{
+		tree.insert(value, key);
+	}
+
+	static int get(const container &tree, const K &key)
+	{
+		return tree.get(key);
+	}
+
+	static void remove(container &tree, const K &key)
+	{
+		tree.erase(key);
+	}
+
+	static long long scan(const container &tree, const K &low, std::size_t length)
+	{
+		long long sum = 0;
+		auto item = tree.lower_bound(low);
+		for (std::size_t index = 0; index < length && item != tree.end(); index++, ++item)
+		{
+			sum += *item;
+		}
+		return sum;
+	}
+
+	static long long iterate(const container &tree)
+	{
+		long long sum = 0;
+		for (auto item = tree.first_element(); item != tree.end(); ++item)
+		{
+			sum += *item;
+		}
+		return sum;
+	}
+};
+
+/**
+ * The same operations on std::map.
+ */
+template<typename K>
+struct std_map_target
+{
+	using container = std::map<K, int>;
+
+	static const char *name()
+	{
+		return "std::map";
+	}
+
+	static void insert(container &tree, const K &key, int value)
+	{
+		tree.insert_or_assign(key, value);
+	}
+
+	static int get(const container &tree, const K &key)
+	{
+		return tree.at(key);
+	}
+
+	static void remove(container &tree, const K &key)
+	{
+		tree.erase(key);
+	}
+
+	static long long scan(const container &tree, const K &low, std::size_t length)
+	{
+		long long sum = 0;
+		auto item = tree.lower_bound(low);
+		for (std::size_t index = 0; index < length && item != tree.end(); index++, ++item)
+		{
+			sum += item->second;
+		}
+		return sum;
+	}
+
+	static long long iterate(const container &tree)
+	{
+		long long sum = 0;
+		for (const auto &item : tree)
+		{
+			sum += item.second;
+		}
+		return sum;
+	}
+};
+
+/**
+ * Print one result as a line of JSON.
+ */
+void emit(const char *structure, const char *key, std::size_t entries, const char *operation,
+		  const char *distribution, std::size_t operations, double seconds, nwacc::bench::latency_sampler *latency)
+{
+	std::cout << "{\"structure\":\"" << structure << "\",\"key\":\"" << key << "\",\"entries\":" << entries
+		<< ",\"operation\":\"" << operation << "\",\"distribution\":\"" << distribution
+		<< "\",\"ops\":" << operations << ",\"seconds\":" << std::fixed << std::setprecision(6) << seconds
+		<< ",\"ops_per_sec\":" << std::setprecision(0) << operations / seconds;
+	if (latency != nullptr)
+	{
+		std::cout << ",\"p50_ns\":" << latency->percentile(0.5) << ",\"p99_ns\":" << latency->percentile(0.99);
+	}
+	else
+	{
+		std::cout << ",\"p50_ns\":null,\"p99_ns\":null";
+	}
+	std::cout << ",\"peak_rss_bytes\":" << nwacc::bench::peak_rss_bytes() << "}\n";
+}
+
+/**
+ * Time operation(index) for every index below operations, sampling the
+ * latency, and print the result.
+ */
+template<typename Operation>
+void measure(const char *structure, const char *key, std::size_t entries, const char *operation,
+			 const char *distribution, std::size_t operations, Operation &&run)
+{
+	nwacc::bench::latency_sampler latency(operations);
+	nwacc::bench::stopwatch timer;
+	for (std::size_t index = 0; index < operations; index++)
+	{
+		latency.run(index, [&run, index]() { run(index); });
+	}
+	emit(structure, key, entries, operation, distribution, operations, timer.seconds(), &latency);
+}
+
+/**
+ * Run every workload on one structure with one kind of key.
+ * @param key_name
+ * @param sorted the keys in increasing order
+ * @param shuffled the same keys in random order
+ * @param zipf the indexes into shuffled of a Zipfian stream of keys
+ */
+template<typename Target, typename K>
+void run_workloads(const char *key_name, const std::vector<K> &sorted, const std::vector<K> &shuffled,
+				   const std::vector<std::size_t> &zipf)
+{
+	using container = typename Target::container;
+	const char *structure = Target::name();
+	const std::size_t entries = sorted.size();
+	long long sum = 0;
+
+	{
+		auto tree = std::make_unique<container>();
+		measure(structure, key_name, entries, "insert", "sequential", entries,
+			[&](std::size_t index) { Target::insert(*tree, sorted[index], static_cast<int>(index)); });
+		measure(structure, key_name, entries, "get", "sequential", entries,
+			[&](std::size_t index) { sum += Target::get(*tree, sorted[index]); });
+
+		nwacc::bench::stopwatch timer;
+		sum += Target::iterate(*tree);
+		emit(structure, key_name, entries, "iterate", "sequential", entries, timer.seconds(), nullptr);
+
+		timer.restart();
+		tree.reset();
+		emit(structure, key_name, entries, "teardown", "sequential", entries, timer.seconds(), nullptr);
+	}
+
+	{
+		container tree;
+		measure(structure, key_name, entries, "insert", "random", entries,
+			[&](std::size_t index) { Target::insert(tree, shuffled[index], static_cast<int>(index)); });
+		measure(structure, key_name, entries, "get", "random", entries,
+			[&](std::size_t index) { sum += Target::get(tree, shuffled[entries - 1 - index]); });
+		measure(structure, key_name, entries, "get", "zipfian", entries,
+			[&](std::size_t index) { sum += Target::get(tree, shuffled[zipf[index]]); });
+
+		const std::size_t scans = std::max<std::size_t>(1, entries / 100);
+		measure(structure, key_name, entries, "range_scan", "random", scans,
+			[&](std::size_t index) { sum += Target::scan(tree, shuffled[index], 100); });
+
+		measure(structure, key_name, entries, "insert", "zipfian", entries,
+			[&](std::size_t index) { Target::insert(tree, shuffled[zipf[index]], static_cast<int>(index)); });
+		measure(structure, key_name, entries, "remove", "zipfian", entries,
+			[&](std::size_t index) { Target::remove(tree, shuffled[zipf[index]]); });
+		measure(structure, key_name, entries, "remove", "random", entries,
+			[&](std::size_t index) { Target::remove(tree, shuffled[index]); });
+	}
+
+	{
+		container tree;
+		for (std::size_t index = 0; index < entries; index++)
+		{
+			Target::insert(tree, sorted[index], static_cast<int>(index));
+		}
+		measure(structure, key_name, entries, "remove", "sequential", entries,
+			[&](std::size_t index) { Target::remove(tree, sorted[index]); });
+	}
+	nwacc::bench::keep(sum);
+}
+
+/**
+ * Run the selected structures and key types with the given entry count.
+ */
+void run(std::size_t entries, const std::string &structure, const std::string &key)
+{
+	const auto shuffled = nwacc::bench::shuffled_keys(entries);
+	std::vector<int> sorted(entries);
+	std::iota(sorted.begin(), sorted.end(), 0);
+
+	std::vector<std::size_t> zipf(entries);
+	nwacc::bench::zipf_generator ranks(entries);
+	for (std::size_t &rank : zipf)
+	{
+		rank = ranks.next();
+	}
+
+	const bool avl = structure.empty() || structure == "avl_tree";
+	const bool map = structure.empty() || structure == "std::map";
+	if (key.empty() || key == "int")
+	{
+		if (avl)
+		{
+			run_workloads<avl_tree_target<int>>("int", sorted, shuffled, zipf);
+		} // else, do_nothing();
+		if (map)
+		{
+			run_workloads<std_map_target<int>>("int", sorted, shuffled, zipf);
+		} // else, do_nothing();
+	} // else, do_nothing();
+
+	if (key.empty() || key == "string")
+	{
+		const auto sorted_strings = nwacc::bench::string_keys(sorted);
+		const auto shuffled_strings = nwacc::bench::string_keys(shuffled);
+		if (avl)
+		{
+			run_workloads<avl_tree_target<std::string>>("string", sorted_strings, shuffled_strings, zipf);
+		} // else, do_nothing();
+		if (map)
+		{
+			run_workloads<std_map_target<std::string>>("string", sorted_strings, shuffled_strings, zipf);
+		} // else, do_nothing();
+	} // else, do_nothing();
+}
+
+int main(int argc, char **argv)
+{
+	std::string structure;
+	std::string key;
+	std::vector<std::size_t> sizes;
+	for (int index = 1; index < argc; index++)
+	{
+		if (std::strcmp(argv[index], "--structure") == 0 && index + 1 < argc)
+		{
+			structure = argv[++index];
+		}
+		else if (std::strcmp(argv[index], "--key") == 0 && index + 1 < argc)
+		{
+			key = argv[++index];
+		}
+		else
+		{
+			sizes.push_back(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+
+	if (sizes.empty())
+	{
+		sizes = { 1000, 10000, 100000, 1000000 };
+	} // else, do_nothing();
+
+	for (std::size_t entries : sizes)
+	{
+		run(entries, structure, key);
+	}
+	return 0;
+}
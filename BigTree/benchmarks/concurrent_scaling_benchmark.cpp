@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../avl_tree.h"
+#include "../concurrent_avl_tree.h"
+#include "../sharded_avl_map.h"
+#include "bench_util.h"
+
+/**
+ * Measure how throughput scales with threads for concurrent_avl_tree
+ * and sharded_avl_map against an avl_tree behind one reader/writer
+ * lock. Every thread runs the same mix of contains, insert and remove
+ * on random keys, for 1 to 64 threads and several read ratios. Half of
+ * the keys are loaded first. Then every thread overwrites random keys
+ * of a concurrent_avl_tree, which retires a value per write, and the
+ * most entries ever waiting to be freed and the peak resident memory
+ * show that retired values are freed while the writers run.
+ * usage: concurrent_scaling_benchmark [keys] [operations per thread]
+ * e.g. concurrent_scaling_benchmark 1000000 1000000
+ */
+
+/**
+ * avl_tree with every call under a single std::shared_mutex.
+ */
+class locked_avl_tree
+{
+public:
+	bool contains(int key) const
+	{
+		std::shared_lock<std::shared_mutex> guard(this->lock);
+		return this->tree.contains(key);
+	}
+
+	void insert(int value, int key)
+	{
+		std::unique_lock<std::shared_mutex> guard(this->lock);
+		this->tree.insert(value, key);
+	}
+
+	void remove(int key)
+	{
+		std::unique_lock<std::shared_mutex> guard(this->lock);
+		this->tree.remove(key);
+	}
+
+private:
+	mutable std::shared_mutex lock;
+	nwacc::avl_tree<int, int> tree;
+};
+
+/**
+ * A small per thread random number generator, so the threads do not
+ * share any state but the tree.
+ */
+class xorshift
+{
+public:
+	explicit xorshift(std::uint64_t seed) : state{ seed * 0x9E3779B97F4A7C15ull + 1 } {}
+
+	std::uint64_t next()
+	{
+		this->state ^= this->state << 13;
+		this->state ^= this->state >> 7;
+		this->state ^= this->state << 17;
+		return this->state;
+	}
+
+private:
+	std::uint64_t state;
+};
+
+template<typename Tree>
+double run_threads(Tree &tree, int threads, int read_percent, std::size_t keys, std::size_t operations)
+{
+	std::vector<std::thread> workers;
+	std::vector<std::size_t> found(threads, 0);
+	nwacc::bench::stopwatch timer;
+	for (int id = 0; id < threads; id++)
+	{
+		workers.emplace_back([&tree, &found, id, read_percent, keys, operations]()
+		{
+			xorshift random(id + 1);
+			std::size_t hits = 0;
+			for (std::size_t operation = 0; operation < operations; operation++)
+			{
+				const std::uint64_t roll = random.next();
+				const int key = static_cast<int>((roll >> 8) % keys);
+				const int choice = static_cast<int>(roll % 100);
+				if (choice < read_percent)
+				{
+					hits += tree.contains(key);
+				}
+				else if ((choice - read_percent) % 2 == 0)
+				{
+					tree.insert(key, key);
+				}
+				else
+				{
+					tree.remove(key);
+				}
+			}
+			found[id] = hits;
+		});
+	}
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+	const double seconds = timer.seconds();
+	nwacc::bench::keep(found);
+	return seconds;
+}
+
+template<typename Tree>
+void run(const std::string &name, int threads, int read_percent, std::size_t keys, std::size_t operations)
+{
+	Tree tree;
+	for (std::size_t key = 0; key < keys; key += 2)
+	{
+		tree.insert(static_cast<int>(key), static_cast<int>(key));
+	}
+
+	const double seconds = run_threads(tree, threads, read_percent, keys, operations);
+	nwacc::bench::report(name + " t=" + std::to_string(threads) + " read=" + std::to_string(read_percent) + "%",
+						 operations * threads, seconds);
+}
+
+/**
+ * Overwrite random keys from every thread while the main thread samples
+ * how many retired entries wait to be freed.
+ */
+void run_overwrites(int threads, std::size_t keys, std::size_t operations)
+{
+	nwacc::concurrent_avl_tree<int, int> tree;
+	for (std::size_t key = 0; key < keys; key++)
+	{
+		tree.insert(static_cast<int>(key), static_cast<int>(key));
+	}
+
+	std::atomic<int> running{ threads };
+	std::vector<std::thread> workers;
+	nwacc::bench::stopwatch timer;
+	for (int id = 0; id < threads; id++)
+	{
+		workers.emplace_back([&tree, &running, id, keys, operations]()
+		{
+			xorshift random(id + 1);
+			for (std::size_t operation = 0; operation < operations; operation++)
+			{
+				const int key = static_cast<int>((random.next() >> 8) % keys);
+				tree.insert(static_cast<int>(operation), key);
+			}
+			running -= 1;
+		});
+	}
+	std::size_t peak_retired = 0;
+	while (running != 0)
+	{
+		peak_retired = std::max(peak_retired, tree.retired());
+		std::this_thread::yield();
+	}
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+	const double seconds = timer.seconds();
+	nwacc::bench::report("overwrite t=" + std::to_string(threads), operations * threads, seconds);
+	std::cout << "    replaced " << operations * threads << ", peak retired " << peak_retired
+		<< ", retired at the end " << tree.retired() << ", peak rss " << nwacc::bench::peak_rss_bytes() << " bytes\n";
+}
+
+int main(int argc, char **argv)
+{
+	const std::size_t keys = nwacc::bench::count_arg(argc, argv, 1, 1000000);
+	const std::size_t operations = nwacc::bench::count_arg(argc, argv, 2, 1000000);
+	for (int read_percent : { 100, 90, 50 })
+	{
+		for (int threads = 1; threads <= 64; threads *= 2)
+		{
+			run<nwacc::concurrent_avl_tree<int, int>>("concurrent_avl_tree", threads, read_percent, keys, operations);
+			run<nwacc::sharded_avl_map<int, int, 64>>("sharded_avl_map<64>", threads, read_percent, keys, operations);
+			run<locked_avl_tree>("avl_tree + shared_mutex", threads, read_percent, keys, operations);
+		}
+	}
+	for (int threads = 1; threads <= 64; threads *= 2)
+	{
+		run_overwrites(threads, keys, operations);
+	}
+	return 0;
+}
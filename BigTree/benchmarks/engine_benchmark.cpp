@@ -0,0 +1,91 @@
+#include <string>
+
+#include "../tree_engine.h"
+#include "bench_util.h"
+
+/**
+ * Run the same workload on one engine: shuffled inserts, lookups that
+ * hit, lookups that miss, a full in order scan and removing half the
+ * keys. Even keys are inserted so the odd keys miss.
+ * @param name printed in front of each result
+ * @param count
+ */
+template<typename Engine>
+void run_engine(const std::string &name, std::size_t count)
+{
+	const auto keys = nwacc::bench::shuffled_keys(count);
+	const auto lookups = nwacc::bench::shuffled_keys(count, 7);
+	const std::string size = " n=" + std::to_string(count);
+	nwacc::bench::stopwatch timer;
+
+	nwacc::ordered_tree<int, int, Engine> tree;
+	timer.restart();
+	for (int key : keys)
+	{
+		tree.insert(key, key * 2);
+	}
+	nwacc::bench::report(name + " insert" + size, count, timer.seconds());
+
+	long long sum = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		sum += tree.get(key * 2);
+	}
+	nwacc::bench::report(name + " get" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+
+	std::size_t found = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		found += tree.contains(key * 2 + 1);
+	}
+	nwacc::bench::report(name + " contains (miss)" + size, count, timer.seconds());
+	nwacc::bench::keep(found);
+
+	sum = 0;
+	timer.restart();
+	for (auto item = tree.first_element(); item != tree.end(); ++item)
+	{
+		sum += *item;
+	}
+	nwacc::bench::report(name + " scan" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+
+	timer.restart();
+	for (std::size_t index = 0; index < count / 2; index++)
+	{
+		tree.remove(lookups[index] * 2);
+	}
+	nwacc::bench::report(name + " remove" + size, count / 2, timer.seconds());
+}
+
+/**
+ * Compare the avl_tree and b_plus_tree engines on the same workload for
+ * every key count given on the command line. The gap on get widens once
+ * the tree no longer fits in the last level cache.
+ * usage: engine_benchmark [keys...]
+ * e.g. engine_benchmark 100000 10000000
+ */
+void run(std::size_t count)
+{
+	run_engine<nwacc::avl_engine>("avl_tree", count);
+	run_engine<nwacc::b_plus_tree_engine>("b_plus_tree", count);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		run(1000000);
+	}
+	else
+	{
+		for (int index = 1; index < argc; index++)
+		{
+			run(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+	return 0;
+}
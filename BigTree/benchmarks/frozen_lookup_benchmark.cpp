@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <string>
+
+#include "../avl_tree.h"
+#include "../frozen_avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure lookups on an avl_tree against the frozen_avl_tree that
+ * avl_tree::freeze makes of it, for every key count given on the command
+ * line. Even keys are inserted so the odd keys can be used for lookups
+ * that miss. Then time saving the frozen tree, mapping it back and
+ * looking keys up in the mapped file. Build with -mavx2 (or /arch:AVX2)
+ * to time the AVX2 block search; without it x86 targets use SSE2.
+ * usage: frozen_lookup_benchmark [keys...]
+ * e.g. frozen_lookup_benchmark 1000000 10000000
+ */
+void run(std::size_t count)
+{
+	const auto keys = nwacc::bench::shuffled_keys(count);
+	const auto lookups = nwacc::bench::shuffled_keys(count, 7);
+	const std::string size = " n=" + std::to_string(count);
+	nwacc::bench::stopwatch timer;
+
+	nwacc::avl_tree<int, int> tree;
+	for (int key : keys)
+	{
+		tree.insert(key, key * 2);
+	}
+
+	timer.restart();
+	const auto frozen = nwacc::freeze(tree);
+	nwacc::bench::report("freeze" + size, count, timer.seconds());
+
+	long long sum = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		sum += tree.get(key * 2);
+	}
+	nwacc::bench::report("avl_tree get" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+
+	sum = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		sum += frozen.get(key * 2);
+	}
+	nwacc::bench::report("frozen_avl_tree get" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+
+	std::size_t found = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		found += tree.contains(key * 2 + 1);
+	}
+	nwacc::bench::report("avl_tree contains (miss)" + size, count, timer.seconds());
+	nwacc::bench::keep(found);
+
+	found = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		found += frozen.contains(key * 2 + 1);
+	}
+	nwacc::bench::report("frozen_avl_tree contains (miss)" + size, count, timer.seconds());
+	nwacc::bench::keep(found);
+
+	sum = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		auto bound = tree.lower_bound(key * 2 + 1);
+		sum += bound != tree.end() ? *bound : 0;
+	}
+	nwacc::bench::report("avl_tree lower_bound" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+
+	sum = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		auto bound = frozen.lower_bound(key * 2 + 1);
+		sum += bound != frozen.end() ? *bound : 0;
+	}
+	nwacc::bench::report("frozen_avl_tree lower_bound" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+
+	const std::string path = "frozen_lookup_benchmark.bin";
+	timer.restart();
+	frozen.save(path);
+	nwacc::bench::report("save" + size, count, timer.seconds());
+
+	timer.restart();
+	const auto mapped = nwacc::frozen_avl_tree<int, int>::open_mapped(path);
+	nwacc::bench::report("open_mapped" + size, 1, timer.seconds());
+
+	sum = 0;
+	timer.restart();
+	for (int key : lookups)
+	{
+		sum += mapped.get(key * 2);
+	}
+	nwacc::bench::report("open_mapped get" + size, count, timer.seconds());
+	nwacc::bench::keep(sum);
+	std::remove(path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		run(1000000);
+	}
+	else
+	{
+		for (int index = 1; index < argc; index++)
+		{
+			run(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include <map>
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure insert and lookup throughput of avl_tree against std::map for
+ * every key count given on the command line. Even keys are inserted so
+ * the odd keys can be used for lookups that miss.
+ * usage: lookup_insert_benchmark [keys...]
+ * e.g. lookup_insert_benchmark 1000000 100000000
+ */
+void run(std::size_t count)
+{
+	const auto keys = nwacc::bench::shuffled_keys(count);
+	const auto lookups = nwacc::bench::shuffled_keys(count, 7);
+	const std::string size = " n=" + std::to_string(count);
+	nwacc::bench::stopwatch timer;
+
+	{
+		nwacc::avl_tree<int, int> tree;
+		timer.restart();
+		for (int key : keys)
+		{
+			tree.insert(key, key * 2);
+		}
+		nwacc::bench::report("avl_tree insert" + size, count, timer.seconds());
+
+		long long sum = 0;
+		timer.restart();
+		for (int key : lookups)
+		{
+			sum += tree.get(key * 2);
+		}
+		nwacc::bench::report("avl_tree get" + size, count, timer.seconds());
+		nwacc::bench::keep(sum);
+
+		std::size_t found = 0;
+		timer.restart();
+		for (int key : lookups)
+		{
+			found += tree.contains(key * 2 + 1);
+		}
+		nwacc::bench::report("avl_tree contains (miss)" + size, count, timer.seconds());
+		nwacc::bench::keep(found);
+	}
+
+	{
+		std::map<int, int> tree;
+		timer.restart();
+		for (int key : keys)
+		{
+			tree[key * 2] = key;
+		}
+		nwacc::bench::report("std::map insert" + size, count, timer.seconds());
+
+		long long sum = 0;
+		timer.restart();
+		for (int key : lookups)
+		{
+			sum += tree.at(key * 2);
+		}
+		nwacc::bench::report("std::map get" + size, count, timer.seconds());
+		nwacc::bench::keep(sum);
+
+		std::size_t found = 0;
+		timer.restart();
+		for (int key : lookups)
+		{
+			found += tree.count(key * 2 + 1);
+		}
+		nwacc::bench::report("std::map contains (miss)" + size, count, timer.seconds());
+		nwacc::bench::keep(found);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		run(1000000);
+	}
+	else
+	{
+		for (int index = 1; index < argc; index++)
+		{
+			run(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure a sum over every value stepping from first_element() to end()
+ * against parallel_reduce, parallel_for_each and
+ * parallel_transform_values, for every key count given on the command
+ * line. The parallel passes use one subtree per hardware thread.
+ * usage: parallel_benchmark [keys...]
+ * e.g. parallel_benchmark 1000000 10000000
+ */
+void run(std::size_t count)
+{
+	const std::string size = " n=" + std::to_string(count);
+	nwacc::avl_tree<int, int> tree;
+	for (int key : nwacc::bench::shuffled_keys(count))
+	{
+		tree.insert(key, key);
+	}
+
+	nwacc::bench::stopwatch timer;
+	long long sum = 0;
+	for (auto item = tree.first_element(); item != tree.end(); ++item)
+	{
+		sum += *item;
+	}
+	nwacc::bench::report("sequential sum" + size, count, timer.seconds());
+
+	timer.restart();
+	const long long parallel_sum = tree.parallel_reduce(0LL,
+		[](const int &, const int &value) { return static_cast<long long>(value); },
+		[](long long lhs, long long rhs) { return lhs + rhs; });
+	nwacc::bench::report("parallel_reduce sum" + size, count, timer.seconds());
+	if (parallel_sum != sum)
+	{
+		std::cout << "  the sums differ: " << sum << " and " << parallel_sum << "\n";
+	} // else, do_nothing();
+
+	std::atomic<long long> total{ 0 };
+	timer.restart();
+	tree.parallel_for_each([&total](const int &, const int &value)
+	{
+		if (value % 1024 == 0)
+		{
+			total.fetch_add(value, std::memory_order_relaxed);
+		} // else, do_nothing();
+	});
+	nwacc::bench::report("parallel_for_each" + size, count, timer.seconds());
+
+	timer.restart();
+	tree.parallel_transform_values([](const int &key, const int &value) { return key ^ value ^ 1; });
+	nwacc::bench::report("parallel_transform_values" + size, count, timer.seconds());
+	nwacc::bench::keep(total.load());
+}
+
+int main(int argc, char **argv)
+{
+	std::cout << std::thread::hardware_concurrency() << " hardware threads\n";
+	if (argc < 2)
+	{
+		run(1000000);
+	}
+	else
+	{
+		for (int index = 1; index < argc; index++)
+		{
+			run(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+	return 0;
+}
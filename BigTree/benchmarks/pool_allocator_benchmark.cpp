@@ -0,0 +1,53 @@
+#include <memory>
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Compare insert, remove and teardown throughput of an avl_tree whose
+ * nodes come from the default node_pool against one that does a plain
+ * new/delete per node.
+ * usage: pool_allocator_benchmark [keys]
+ */
+template<template<typename> class Allocator>
+void run(const std::string &name, const std::vector<int> &keys)
+{
+	nwacc::bench::stopwatch timer;
+	auto *tree = new nwacc::avl_tree<int, int, std::less<int>, Allocator>();
+
+	timer.restart();
+	for (int key : keys)
+	{
+		tree->insert(key, key);
+	}
+	nwacc::bench::report(name + " insert", keys.size(), timer.seconds());
+
+	timer.restart();
+	for (std::size_t index = 0; index < keys.size(); index += 2)
+	{
+		tree->remove(keys[index]);
+	}
+	nwacc::bench::report(name + " remove half", keys.size() / 2, timer.seconds());
+
+	timer.restart();
+	for (std::size_t index = 0; index < keys.size(); index += 2)
+	{
+		tree->insert(keys[index], keys[index]);
+	}
+	nwacc::bench::report(name + " reinsert half", keys.size() / 2, timer.seconds());
+
+	timer.restart();
+	delete tree;
+	nwacc::bench::report(name + " teardown", keys.size(), timer.seconds());
+}
+
+int main(int argc, char **argv)
+{
+	const auto count = nwacc::bench::count_arg(argc, argv, 1, 1000000);
+	const auto keys = nwacc::bench::shuffled_keys(count);
+
+	run<std::allocator>("new/delete", keys);
+	run<nwacc::node_pool>("node_pool", keys);
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <sstream>
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure full forward and reverse scans, range scans of 100 keys and
+ * operator<< over a tree that climbs parent pointers to step and over
+ * one with threaded in order links, for every key count given on the
+ * command line. Keys are inserted in a shuffled order, so neighbours in
+ * key order are not neighbours in memory.
+ * usage: scan_benchmark [keys...]
+ * e.g. scan_benchmark 1000000 10000000
+ */
+template<typename Options>
+void run(const std::string &name, const std::vector<int> &keys)
+{
+	const std::string size = " n=" + std::to_string(keys.size());
+	nwacc::avl_tree<int, int, std::less<int>, nwacc::node_pool, Options> tree;
+	for (int key : keys)
+	{
+		tree.insert(key, key);
+	}
+
+	long long sum = 0;
+	nwacc::bench::stopwatch timer;
+	for (auto item = tree.first_element(); item != tree.end(); ++item)
+	{
+		sum += *item;
+	}
+	nwacc::bench::report("forward scan " + name + size, keys.size(), timer.seconds());
+
+	timer.restart();
+	for (auto item = tree.last_element(); item != tree.end(); --item)
+	{
+		sum += *item;
+	}
+	nwacc::bench::report("reverse scan " + name + size, keys.size(), timer.seconds());
+
+	const std::size_t scans = std::max<std::size_t>(1, keys.size() / 100);
+	timer.restart();
+	for (std::size_t index = 0; index < scans; index++)
+	{
+		tree.for_each_in_range(keys[index], keys[index] + 100, [&sum](const int &, int value) { sum += value; });
+	}
+	nwacc::bench::report("range scan " + name + size, scans * 100, timer.seconds());
+
+	std::ostringstream text;
+	timer.restart();
+	text << tree;
+	nwacc::bench::report("operator<< " + name + size, keys.size() * 2, timer.seconds());
+	nwacc::bench::keep(sum);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::size_t> counts;
+	for (int index = 1; index < argc; index++)
+	{
+		counts.push_back(nwacc::bench::count_arg(argc, argv, index, 0));
+	}
+	if (counts.empty())
+	{
+		counts.push_back(1000000);
+	} // else, do_nothing();
+
+	for (std::size_t count : counts)
+	{
+		const auto keys = nwacc::bench::shuffled_keys(count);
+		run<nwacc::avl_tree_options>("parent climbing", keys);
+		run<nwacc::threaded_options>("threaded", keys);
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include <sstream>
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure serialize and deserialize against printing the tree with
+ * operator<<, for every key count given on the command line, and report
+ * the bytes each record takes in the stream.
+ * usage: serialization_benchmark [keys...]
+ * e.g. serialization_benchmark 1000000 10000000
+ */
+void run(std::size_t count)
+{
+	const auto keys = nwacc::bench::shuffled_keys(count);
+	const std::string size = " n=" + std::to_string(count);
+	nwacc::bench::stopwatch timer;
+
+	nwacc::avl_tree<int, int> tree;
+	for (int key : keys)
+	{
+		tree.insert(key, key * 2);
+	}
+
+	std::stringstream text;
+	timer.restart();
+	text << tree;
+	nwacc::bench::report("operator<<" + size, count, timer.seconds());
+
+	std::stringstream stream;
+	timer.restart();
+	tree.serialize(stream);
+	nwacc::bench::report("serialize" + size, count, timer.seconds());
+	std::cout << "  " << static_cast<double>(stream.str().size()) / count << " bytes per record\n";
+
+	nwacc::avl_tree<int, int> loaded;
+	timer.restart();
+	loaded.deserialize(stream);
+	nwacc::bench::report("deserialize" + size, count, timer.seconds());
+	nwacc::bench::keep(loaded.size());
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		run(1000000);
+	}
+	else
+	{
+		for (int index = 1; index < argc; index++)
+		{
+			run(nwacc::bench::count_arg(argc, argv, index, 0));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure union_with, intersect_with and difference_with against the
+ * insert or remove loop they replace, for a tree of n keys and a delta of
+ * m keys, plus bulk_load of n sorted pairs. Half of the delta keys are
+ * already in the tree.
+ * usage: set_operations_benchmark [n] [m]
+ * e.g. set_operations_benchmark 10000000 100000
+ */
+using tree_type = nwacc::avl_tree<int, int>;
+
+/**
+ * Build a tree of count keys spaced stride apart. With odd set, every
+ * other key is moved up by one.
+ */
+tree_type make_tree(std::size_t count, int stride, bool odd)
+{
+	std::vector<std::pair<int, int>> pairs;
+	pairs.reserve(count);
+	for (std::size_t index = 0; index < count; index++)
+	{
+		const int key = static_cast<int>(index) * stride + (odd ? static_cast<int>(index % 2) : 0);
+		pairs.emplace_back(key, key);
+	}
+	return tree_type(pairs.begin(), pairs.end());
+}
+
+int main(int argc, char **argv)
+{
+	const std::size_t count = nwacc::bench::count_arg(argc, argv, 1, 10000000);
+	const std::size_t delta = nwacc::bench::count_arg(argc, argv, 2, 100000);
+	const int stride = 2 * static_cast<int>(count / delta > 0 ? count / delta : 1);
+	const std::string size = " n=" + std::to_string(count) + " m=" + std::to_string(delta);
+	nwacc::bench::stopwatch timer;
+
+	{
+		std::vector<std::pair<int, int>> pairs;
+		pairs.reserve(count);
+		for (std::size_t index = 0; index < count; index++)
+		{
+			pairs.emplace_back(static_cast<int>(index) * 2, static_cast<int>(index));
+		}
+		tree_type tree;
+		timer.restart();
+		tree.bulk_load(pairs.begin(), pairs.end());
+		nwacc::bench::report("bulk_load n=" + std::to_string(count), count, timer.seconds());
+	}
+
+	{
+		tree_type tree = make_tree(count, 2, false);
+		tree_type other = make_tree(delta, stride, true);
+		timer.restart();
+		for (auto item = other.first_element(); item != other.end(); ++item)
+		{
+			tree.insert(*item, item.get_key());
+		}
+		nwacc::bench::report("insert loop" + size, delta, timer.seconds());
+	}
+
+	{
+		tree_type tree = make_tree(count, 2, false);
+		tree_type other = make_tree(delta, stride, true);
+		timer.restart();
+		tree.union_with(std::move(other));
+		nwacc::bench::report("union_with" + size, delta, timer.seconds());
+	}
+
+	{
+		tree_type tree = make_tree(count, 2, false);
+		tree_type other = make_tree(delta, stride, true);
+		timer.restart();
+		tree.intersect_with(std::move(other));
+		nwacc::bench::report("intersect_with" + size, delta, timer.seconds());
+	}
+
+	{
+		tree_type tree = make_tree(count, 2, false);
+		tree_type other = make_tree(delta, stride, true);
+		timer.restart();
+		for (auto item = other.first_element(); item != other.end(); ++item)
+		{
+			tree.remove(item.get_key());
+		}
+		nwacc::bench::report("remove loop" + size, delta, timer.seconds());
+	}
+
+	{
+		tree_type tree = make_tree(count, 2, false);
+		tree_type other = make_tree(delta, stride, true);
+		timer.restart();
+		tree.difference_with(std::move(other));
+		nwacc::bench::report("difference_with" + size, delta, timer.seconds());
+	}
+	return 0;
+}
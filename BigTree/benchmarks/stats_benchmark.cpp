@@ -0,0 +1,69 @@
+#include <string>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure inserts, gets and removes with avl_tree_options::stats off and
+ * on, for every key count given on the command line, and print what the
+ * counters saw.
+ * usage: stats_benchmark [keys...]
+ * e.g. stats_benchmark 1000000 10000000
+ */
+template<typename Options>
+void run(const std::string &name, const std::vector<int> &keys)
+{
+	const std::string size = " n=" + std::to_string(keys.size());
+	nwacc::avl_tree<int, int, std::less<int>, nwacc::node_pool, Options> tree;
+	nwacc::bench::stopwatch timer;
+	for (int key : keys)
+	{
+		tree.insert(key, key);
+	}
+	nwacc::bench::report("insert " + name + size, keys.size(), timer.seconds());
+
+	long long sum = 0;
+	timer.restart();
+	for (int key : keys)
+	{
+		sum += tree.get(key);
+	}
+	nwacc::bench::report("get " + name + size, keys.size(), timer.seconds());
+	nwacc::bench::keep(sum);
+
+	timer.restart();
+	for (int key : keys)
+	{
+		tree.remove(key);
+	}
+	nwacc::bench::report("remove " + name + size, keys.size(), timer.seconds());
+
+	if constexpr (Options::stats)
+	{
+		const nwacc::avl_tree_stats stats = tree.stats();
+		std::cout << "  " << std::setprecision(2) << stats.comparisons_per_search() << " comparisons per search, "
+			<< stats.single_rotations << " single and " << stats.double_rotations << " double rotations, "
+			<< stats.allocations << " allocations\n";
+	} // else, do_nothing();
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::size_t> counts;
+	for (int index = 1; index < argc; index++)
+	{
+		counts.push_back(nwacc::bench::count_arg(argc, argv, index, 0));
+	}
+	if (counts.empty())
+	{
+		counts.push_back(1000000);
+	} // else, do_nothing();
+
+	for (std::size_t count : counts)
+	{
+		const auto keys = nwacc::bench::shuffled_keys(count);
+		run<nwacc::avl_tree_options>("stats off", keys);
+		run<nwacc::stats_options>("stats on", keys);
+	}
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "../avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Pass the key straight through when the tree can compare it in place,
+ * otherwise convert it to std::string as a caller has to today.
+ */
+template<typename Compare, typename Key>
+auto lookup_key(const Key &key)
+{
+	if constexpr (std::is_same<Compare, std::less<>>::value)
+	{
+		return key;
+	}
+	else
+	{
+		return std::string(key);
+	}
+}
+
+/**
+ * Orders strings as std::less<std::string> does, but is a type of its
+ * own, so the tree compares each key from the first byte.
+ */
+struct full_compare
+{
+	bool operator()(const std::string &lhs, const std::string &rhs) const
+	{
+		return lhs < rhs;
+	}
+};
+
+/**
+ * Look up std::string keys from std::string_view and const char * in a
+ * tree ordered by std::less<std::string>, which has to build a temporary
+ * std::string for every lookup, and in one ordered by the transparent
+ * std::less<>, which compares in place. Then insert and look up long
+ * keys that share most of their bytes, with std::less<std::string>,
+ * which skips the prefix a key is known to share with each node, and
+ * with full_compare, which does not.
+ * usage: string_key_benchmark [keys]
+ */
+template<typename Compare>
+void run(const std::string &name, const std::vector<std::string> &keys, const std::vector<int> &order)
+{
+	nwacc::avl_tree<int, std::string, Compare> tree;
+	for (std::size_t index = 0; index < keys.size(); index++)
+	{
+		tree.insert(static_cast<int>(index), keys[index]);
+	}
+
+	nwacc::bench::stopwatch timer;
+	long long sum = 0;
+	for (int index : order)
+	{
+		sum += tree.get(lookup_key<Compare>(std::string_view{ keys[index] }));
+	}
+	nwacc::bench::report(name + " get(string_view)", order.size(), timer.seconds());
+
+	timer.restart();
+	for (int index : order)
+	{
+		sum += tree.contains(lookup_key<Compare>(keys[index].c_str()));
+	}
+	nwacc::bench::report(name + " contains(const char *)", order.size(), timer.seconds());
+	nwacc::bench::keep(sum);
+}
+
+template<typename Compare>
+void run_shared_prefix(const std::string &name, const std::vector<std::string> &keys, const std::vector<int> &order)
+{
+	nwacc::avl_tree<int, std::string, Compare> tree;
+	nwacc::bench::stopwatch timer;
+	for (std::size_t index = 0; index < keys.size(); index++)
+	{
+		tree.insert(static_cast<int>(index), keys[index]);
+	}
+	nwacc::bench::report(name + " insert(path)", keys.size(), timer.seconds());
+
+	timer.restart();
+	long long sum = 0;
+	for (int index : order)
+	{
+		sum += tree.get(keys[index]);
+	}
+	nwacc::bench::report(name + " get(path)", order.size(), timer.seconds());
+	nwacc::bench::keep(sum);
+}
+
+int main(int argc, char **argv)
+{
+	const auto count = nwacc::bench::count_arg(argc, argv, 1, 1000000);
+	std::vector<std::string> keys;
+	keys.reserve(count);
+	for (int index : nwacc::bench::shuffled_keys(count))
+	{
+		keys.push_back("warehouse/region-" + std::to_string(index % 97) + "/sensor-" + std::to_string(index));
+	}
+	const auto order = nwacc::bench::shuffled_keys(count, 7);
+
+	run<std::less<std::string>>("std::less<std::string>", keys, order);
+	run<std::less<>>("std::less<>", keys, order);
+
+	std::vector<std::string> paths;
+	paths.reserve(count);
+	for (int index : nwacc::bench::shuffled_keys(count))
+	{
+		paths.push_back("/srv/warehouse/telemetry/region-" + std::to_string(index % 97) + "/building-" +
+						std::to_string(index % 1009) + "/sensor-" + std::to_string(index));
+	}
+	run_shared_prefix<std::less<std::string>>("std::less<std::string>", paths, order);
+	run_shared_prefix<full_compare>("full_compare", paths, order);
+	return 0;
+}
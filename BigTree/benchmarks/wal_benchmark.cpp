@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../durable_avl_tree.h"
+#include "bench_util.h"
+
+/**
+ * Measure durable_avl_tree inserts under each sync policy with 1 to 16
+ * writer threads. With sync_policy::every_commit the throughput grows
+ * with the writers, since each group commit shares one sync among all
+ * the writers waiting on it.
+ * usage: wal_benchmark [inserts per thread]
+ * e.g. wal_benchmark 2000
+ */
+void run(nwacc::sync_policy policy, const std::string &name, std::size_t threads, std::size_t count)
+{
+	const std::string path = "wal_benchmark";
+	nwacc::wal_options options;
+	options.sync = policy;
+	nwacc::bench::stopwatch timer;
+	{
+		nwacc::durable_avl_tree<int, int> tree(path, options);
+		std::vector<std::thread> writers;
+		timer.restart();
+		for (std::size_t thread = 0; thread < threads; thread++)
+		{
+			writers.emplace_back([&tree, thread, count]()
+			{
+				for (std::size_t index = 0; index < count; index++)
+				{
+					tree.insert(static_cast<int>(index), static_cast<int>(thread * count + index));
+				}
+			});
+		}
+		for (auto &writer : writers)
+		{
+			writer.join();
+		}
+		nwacc::bench::report(name + " threads=" + std::to_string(threads), threads * count, timer.seconds());
+	}
+	std::remove((path + ".wal").c_str());
+	std::remove((path + ".snapshot").c_str());
+}
+
+int main(int argc, char **argv)
+{
+	const std::size_t count = nwacc::bench::count_arg(argc, argv, 1, 2000);
+	for (std::size_t threads : { 1, 4, 16 })
+	{
+		run(nwacc::sync_policy::every_commit, "insert every_commit", threads, count);
+		run(nwacc::sync_policy::periodic, "insert periodic", threads, count);
+		run(nwacc::sync_policy::never, "insert never", threads, count);
+	}
+	return 0;
+}
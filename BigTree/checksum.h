@@ -0,0 +1,42 @@
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace nwacc
+{
+	/**
+	 * Where an FNV-1a checksum starts.
+	 */
+	constexpr std::uint64_t fnv1a_seed = 14695981039346656037ull;
+
+	/**
+	 * FNV-1a over eight bytes at a time, with the bytes that do not fill
+	 * a word folded in one by one. Used to catch damaged files, not to
+	 * resist tampering.
+	 * @param hash the checksum so far, fnv1a_seed to start
+	 * @param data
+	 * @param bytes
+	 * @return the checksum with data folded in.
+	 */
+	inline std::uint64_t fnv1a_checksum(std::uint64_t hash, const void *data, std::size_t bytes)
+	{
+		constexpr std::uint64_t prime = 1099511628211ull;
+		const unsigned char *current = static_cast<const unsigned char *>(data);
+		for (; bytes >= sizeof(std::uint64_t); bytes -= sizeof(std::uint64_t), current += sizeof(std::uint64_t))
+		{
+			std::uint64_t word;
+			std::memcpy(&word, current, sizeof(word));
+			hash = (hash ^ word) * prime;
+		}
+		for (; bytes > 0; bytes--, current++)
+		{
+			hash = (hash ^ *current) * prime;
+		}
+		return hash;
+	}
+}
+
+#endif // CHECKSUM_H_
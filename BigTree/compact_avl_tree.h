@@ -0,0 +1,878 @@
+#ifndef COMPACT_AVL_TREE_H_
+#define COMPACT_AVL_TREE_H_
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace nwacc
+{
+	/**
+	 * The compact storage mode of avl_tree. Every node lives in one
+	 * contiguous array and points at its parent and children with 32 bit
+	 * indices, and an 8 bit balance factor stands in for the int height.
+	 * For an <int, int> tree a node is 24 bytes instead of 40, so about
+	 * twice as many of them fit in cache.
+	 *
+	 * The public surface matches avl_tree. References returned by get or
+	 * operator[] stay valid until the next insert, which may grow the
+	 * array; call reserve up front to avoid that.
+	 * @param T the value type
+	 * @param K the key type
+	 */
+	template<typename T, typename K>
+	class compact_avl_tree
+	{
+	private:
+		using index_type = std::uint32_t;
+
+		/**
+		 * Marks a missing parent or child.
+		 */
+		static constexpr index_type npos = std::numeric_limits<index_type>::max();
+
+		/**
+		 * A node of the tree. balance is the height of the right subtree
+		 * minus the height of the left subtree and is always -1, 0 or 1
+		 * between operations. While a node is on the free list, left links
+		 * it to the next free node.
+		 */
+		struct node
+		{
+			K key;
+			T element;
+			index_type parent;
+			index_type left;
+			index_type right;
+			std::int8_t balance;
+		};
+
+		/**
+		 * Every node of the tree, live or free.
+		 */
+		std::vector<node> nodes;
+
+		/**
+		 * The index of the root node.
+		 */
+		index_type root = npos;
+
+		/**
+		 * The first node of the free list.
+		 */
+		index_type free_list = npos;
+
+		/**
+		 * Represents the number of items in the tree.
+		 */
+		std::size_t tree_size = 0;
+
+	public:
+		/**
+		 * Create an empty tree.
+		 */
+		compact_avl_tree() = default;
+
+		/**
+		 * Determine if the tree has no nodes.
+		 * @return true if the tree is empty.
+		 */
+		bool is_empty() const
+		{
+			return this->root == npos;
+		}
+
+		/**
+		 * @return the number of keys in the tree.
+		 */
+		std::size_t size() const
+		{
+			return this->tree_size;
+		}
+
+		/**
+		 * Remove every node from the tree. The array keeps its capacity.
+		 */
+		void empty()
+		{
+			this->nodes.clear();
+			this->root = npos;
+			this->free_list = npos;
+			this->tree_size = 0;
+		}
+
+		/**
+		 * Make room for count nodes so inserts do not move the array.
+		 * @param count
+		 */
+		void reserve(std::size_t count)
+		{
+			this->nodes.reserve(count);
+		}
+
+		/**
+		 * Determine if the key is in the tree.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		bool contains(const K &key) const
+		{
+			return this->find(key) != npos;
+		}
+
+		/**
+		 * Get the value associated with a key.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		T get(const K &key) const
+		{
+			const index_type found = this->find(key);
+			if (found == npos)
+			{
+				throw std::length_error("Data not Found....");
+			} // else, we found the key, do_nothing();
+			return this->nodes[found].element;
+		}
+
+#pragma region const_iterator
+		class const_iterator
+		{
+		public:
+			/**
+			 * Construct the const_iterator at the end of the tree.
+			 */
+			const_iterator() : tree{ nullptr }, current{ npos } {}
+
+			/**
+			 * Overload the pointer operator.
+			 * @return the value at the current node.
+			 */
+			const T &operator*() const
+			{
+				return this->tree->nodes[this->current].element;
+			}
+
+			/**
+			 * Return the current key.
+			 * @return current key.
+			 */
+			const K &get_key() const
+			{
+				return this->tree->nodes[this->current].key;
+			}
+
+			/**
+			 * Move to the next larger key.
+			 * @return const_iterator
+			 */
+			const_iterator &operator++()
+			{
+				this->current = this->tree->next(this->current);
+				return *this;
+			}
+
+			/**
+			 * This is the postfix operator.
+			 * @return const_iterator
+			 */
+			const_iterator operator++(int)
+			{
+				auto old = *this;
+				++(*this);
+				return old;
+			}
+
+			/**
+			 * Move to the next smaller key.
+			 * @return const_iterator
+			 */
+			const_iterator &operator--()
+			{
+				this->current = this->tree->previous(this->current);
+				return *this;
+			}
+
+			/**
+			 * This is the postfix operator.
+			 * @return const_iterator
+			 */
+			const_iterator operator--(int)
+			{
+				auto old = *this;
+				--(*this);
+				return old;
+			}
+
+			bool operator== (const const_iterator &rhs) const
+			{
+				return this->current == rhs.current;
+			}
+
+			bool operator!= (const const_iterator &rhs) const
+			{
+				return !(*this == rhs);
+			}
+
+		protected:
+			compact_avl_tree *tree;
+			index_type current;
+
+			const_iterator(const compact_avl_tree *tree, index_type current)
+				: tree{ const_cast<compact_avl_tree *>(tree) }, current{ current } {}
+
+			friend class compact_avl_tree;
+		};
+#pragma endregion
+#pragma region iterator
+		class iterator : public const_iterator
+		{
+		public:
+			/**
+			 * Construct the iterator at the end of the tree.
+			 */
+			iterator() = default;
+
+			/**
+			 * Overload the pointer operator.
+			 * @return the value at the current node.
+			 */
+			T &operator*()
+			{
+				return this->tree->nodes[this->current].element;
+			}
+
+			iterator &operator++()
+			{
+				const_iterator::operator++();
+				return *this;
+			}
+
+			iterator operator++(int)
+			{
+				auto old = *this;
+				++(*this);
+				return old;
+			}
+
+			iterator &operator--()
+			{
+				const_iterator::operator--();
+				return *this;
+			}
+
+			iterator operator--(int)
+			{
+				auto old = *this;
+				--(*this);
+				return old;
+			}
+
+		private:
+			iterator(const compact_avl_tree *tree, index_type current)
+				: const_iterator{ tree, current } {}
+
+			friend class compact_avl_tree;
+		};
+#pragma endregion
+
+		iterator first_element() const
+		{
+			return iterator(this, this->find_min(this->root));
+		}
+
+		iterator last_element() const
+		{
+			return iterator(this, this->find_max(this->root));
+		}
+
+		iterator begin() const
+		{
+			return iterator(this, npos);
+		}
+
+		iterator end() const
+		{
+			return iterator(this, npos);
+		}
+
+		/**
+		 * Insert a value at the key, replacing the value already there.
+		 * @param value
+		 * @param key
+		 * @return an iterator to the node holding the key.
+		 */
+		iterator insert(const T &value, const K &key)
+		{
+			return iterator(this, this->insert_node(value, key));
+		}
+
+		/**
+		 * Insert a value at the key with move semantics.
+		 * @param value
+		 * @param key
+		 * @return an iterator to the node holding the key.
+		 */
+		iterator insert(T &&value, K &&key)
+		{
+			return iterator(this, this->insert_node(std::move(value), std::move(key)));
+		}
+
+		/**
+		 * Get the value at the key, inserting a default value if the key
+		 * is not in the tree yet.
+		 * @param key
+		 * @return the value at the key.
+		 */
+		T &operator[](const K &key)
+		{
+			index_type current = npos;
+			const int side = this->descend(key, current);
+			if (side == 0)
+			{
+				return this->nodes[current].element;
+			} // else, the key is missing, do_nothing();
+			return this->nodes[this->attach(current, side, T{}, key)].element;
+		}
+
+		/**
+		 * Remove the key and its value from the tree.
+		 * @param key
+		 */
+		void remove(const K &key)
+		{
+			index_type current = this->find(key);
+			if (current == npos)
+			{
+				// we did not find the item to remove.
+				return;
+			} // else, we found the item do_nothing();
+
+			if (this->nodes[current].left != npos && this->nodes[current].right != npos)
+			{
+				// here we have two children, take the place of the successor
+				const index_type successor = this->find_min(this->nodes[current].right);
+				std::swap(this->nodes[current].key, this->nodes[successor].key);
+				std::swap(this->nodes[current].element, this->nodes[successor].element);
+				current = successor;
+			} // else, no children or one child, do_nothing();
+
+			node &old_node = this->nodes[current];
+			const index_type child = old_node.left != npos ? old_node.left : old_node.right;
+			const index_type parent = old_node.parent;
+			if (child != npos)
+			{
+				this->nodes[child].parent = parent;
+			} // else, old_node was a leaf, do_nothing();
+
+			if (parent == npos)
+			{
+				this->root = child;
+			}
+			else
+			{
+				const bool from_left = this->nodes[parent].left == current;
+				if (from_left)
+				{
+					this->nodes[parent].left = child;
+				}
+				else
+				{
+					this->nodes[parent].right = child;
+				}
+				this->retrace_remove(parent, from_left);
+			}
+
+			old_node.left = this->free_list;
+			this->free_list = current;
+			this->tree_size -= 1;
+		}
+
+		/**
+		 * Overload the ostream operator to print the tree
+		 * forwards and backwards.
+		 * @param out the value to be printed to the console.
+		 * @param rhs the right hand side
+		 */
+		friend std::ostream &operator<<(std::ostream &out, const compact_avl_tree &rhs)
+		{
+			for (iterator item = rhs.first_element(); item != rhs.end(); item++)
+			{
+				out << item.get_key() << '\n';
+			}
+
+			for (iterator item = rhs.last_element(); item != rhs.begin(); item--)
+			{
+				out << item.get_key() << '\n';
+			}
+			return out;
+		}
+
+	private:
+		/**
+		 * Find the node holding key.
+		 * @param key
+		 * @return the index of the node or npos.
+		 */
+		index_type find(const K &key) const
+		{
+			index_type current = this->root;
+			while (current != npos)
+			{
+				const node &candidate = this->nodes[current];
+				if (key < candidate.key)
+				{
+					current = candidate.left;
+				}
+				else if (candidate.key < key)
+				{
+					current = candidate.right;
+				}
+				else
+				{
+					return current;
+				}
+			}
+			return npos;
+		}
+
+		/**
+		 * Finds the lowest valued key below current.
+		 * @param current
+		 * @return the index of the smallest key or npos.
+		 */
+		index_type find_min(index_type current) const
+		{
+			if (current != npos)
+			{
+				while (this->nodes[current].left != npos)
+				{
+					current = this->nodes[current].left;
+				}
+			} // else, do_nothing();
+			return current;
+		}
+
+		/**
+		 * Finds the highest valued key below current.
+		 * @param current
+		 * @return the index of the largest key or npos.
+		 */
+		index_type find_max(index_type current) const
+		{
+			if (current != npos)
+			{
+				while (this->nodes[current].right != npos)
+				{
+					current = this->nodes[current].right;
+				}
+			} // else, do_nothing();
+			return current;
+		}
+
+		/**
+		 * Finds the node with the next larger key.
+		 * @param current
+		 * @return the index of the successor or npos.
+		 */
+		index_type next(index_type current) const
+		{
+			if (this->nodes[current].right != npos)
+			{
+				return this->find_min(this->nodes[current].right);
+			} // else, climb until we come up from a left child, do_nothing();
+
+			index_type parent = this->nodes[current].parent;
+			while (parent != npos && current == this->nodes[parent].right)
+			{
+				current = parent;
+				parent = this->nodes[parent].parent;
+			}
+			return parent;
+		}
+
+		/**
+		 * Finds the node with the next smaller key.
+		 * @param current
+		 * @return the index of the predecessor or npos.
+		 */
+		index_type previous(index_type current) const
+		{
+			if (this->nodes[current].left != npos)
+			{
+				return this->find_max(this->nodes[current].left);
+			} // else, climb until we come up from a right child, do_nothing();
+
+			index_type parent = this->nodes[current].parent;
+			while (parent != npos && current == this->nodes[parent].left)
+			{
+				current = parent;
+				parent = this->nodes[parent].parent;
+			}
+			return parent;
+		}
+
+		/**
+		 * Take a node from the free list or the end of the array.
+		 * @param value
+		 * @param key
+		 * @param parent
+		 * @return the index of the new node.
+		 */
+		template<typename V, typename Key>
+		index_type create_node(V &&value, Key &&key, index_type parent)
+		{
+			if (this->free_list != npos)
+			{
+				const index_type reused = this->free_list;
+				node &fresh = this->nodes[reused];
+				this->free_list = fresh.left;
+				fresh.key = std::forward<Key>(key);
+				fresh.element = std::forward<V>(value);
+				fresh.parent = parent;
+				fresh.left = npos;
+				fresh.right = npos;
+				fresh.balance = 0;
+				return reused;
+			} // else, nothing to reuse, do_nothing();
+
+			if (this->nodes.size() >= npos)
+			{
+				throw std::length_error("compact_avl_tree is full");
+			} // else, there is still an index to hand out, do_nothing();
+
+			this->nodes.push_back(node{ std::forward<Key>(key), std::forward<V>(value),
+										parent, npos, npos, 0 });
+			return static_cast<index_type>(this->nodes.size() - 1);
+		}
+
+		/**
+		 * Walk down to key.
+		 * @param key
+		 * @param current set to the node holding key, or to the node a new
+		 * node for key would hang from
+		 * @return 0 if current holds key, otherwise -1 or 1 for the side of
+		 * current the new node goes on.
+		 */
+		int descend(const K &key, index_type &current) const
+		{
+			if (this->root == npos)
+			{
+				current = npos;
+				return -1;
+			} // else, descend to the key, do_nothing();
+
+			current = this->root;
+			for (;;)
+			{
+				const node &candidate = this->nodes[current];
+				int side = 0;
+				if (key < candidate.key)
+				{
+					side = -1;
+				}
+				else if (candidate.key < key)
+				{
+					side = 1;
+				}
+				else
+				{
+					return 0;
+				}
+
+				const index_type child = side < 0 ? candidate.left : candidate.right;
+				if (child == npos)
+				{
+					return side;
+				} // else, keep going down, do_nothing();
+				current = child;
+			}
+		}
+
+		/**
+		 * Hang a new node on one side of parent, or make it the root when
+		 * parent is npos, and rebalance on the way up.
+		 * @param parent
+		 * @param side -1 for the left child, 1 for the right
+		 * @param value
+		 * @param key
+		 * @return the index of the new node.
+		 */
+		template<typename V, typename Key>
+		index_type attach(index_type parent, int side, V &&value, Key &&key)
+		{
+			const index_type fresh = this->create_node(std::forward<V>(value), std::forward<Key>(key), parent);
+			this->tree_size += 1;
+			if (parent == npos)
+			{
+				this->root = fresh;
+				return fresh;
+			} // else, do_nothing();
+
+			if (side < 0)
+			{
+				this->nodes[parent].left = fresh;
+			}
+			else
+			{
+				this->nodes[parent].right = fresh;
+			}
+			this->retrace_insert(fresh);
+			return fresh;
+		}
+
+		/**
+		 * Insert or replace the value at key and rebalance on the way up.
+		 * @param value
+		 * @param key
+		 * @return the index of the node holding the key.
+		 */
+		template<typename V, typename Key>
+		index_type insert_node(V &&value, Key &&key)
+		{
+			index_type current = npos;
+			const int side = this->descend(key, current);
+			if (side == 0)
+			{
+				this->nodes[current].element = std::forward<V>(value);
+				return current;
+			} // else, the key is new, do_nothing();
+			return this->attach(current, side, std::forward<V>(value), std::forward<Key>(key));
+		}
+
+		/**
+		 * Walk up from a new leaf fixing balance factors until a subtree
+		 * stops growing or one rotation restores its height.
+		 * @param child
+		 */
+		void retrace_insert(index_type child)
+		{
+			for (index_type parent = this->nodes[child].parent; parent != npos;
+				 child = parent, parent = this->nodes[child].parent)
+			{
+				node &current = this->nodes[parent];
+				current.balance += (current.left == child) ? -1 : 1;
+
+				if (current.balance == 0)
+				{
+					return;
+				} // else, the subtree grew, do_nothing();
+
+				if (current.balance == -2)
+				{
+					if (this->nodes[child].balance <= 0)
+					{
+						this->rotate_with_left_child(parent);
+					}
+					else
+					{
+						this->double_rotate_with_left_child(parent);
+					}
+					return;
+				} // else, do_nothing();
+
+				if (current.balance == 2)
+				{
+					if (this->nodes[child].balance >= 0)
+					{
+						this->rotate_with_right_child(parent);
+					}
+					else
+					{
+						this->double_rotate_with_right_child(parent);
+					}
+					return;
+				} // else, balance is -1 or 1, keep climbing do_nothing();
+			}
+		}
+
+		/**
+		 * Walk up after a child of parent was removed, fixing balance
+		 * factors and rotating until a subtree keeps its height.
+		 * @param parent
+		 * @param from_left true if the removed child was on the left
+		 */
+		void retrace_remove(index_type parent, bool from_left)
+		{
+			while (parent != npos)
+			{
+				node &current = this->nodes[parent];
+				current.balance += from_left ? 1 : -1;
+
+				if (current.balance == 1 || current.balance == -1)
+				{
+					return;
+				} // else, the height changed or the node is out of balance, do_nothing();
+
+				index_type top = parent;
+				if (current.balance == 2)
+				{
+					const int sibling = this->nodes[current.right].balance;
+					top = sibling < 0 ? this->double_rotate_with_right_child(parent)
+									  : this->rotate_with_right_child(parent);
+					if (sibling == 0)
+					{
+						return;
+					} // else, the subtree got shorter, do_nothing();
+				}
+				else if (current.balance == -2)
+				{
+					const int sibling = this->nodes[current.left].balance;
+					top = sibling > 0 ? this->double_rotate_with_left_child(parent)
+									  : this->rotate_with_left_child(parent);
+					if (sibling == 0)
+					{
+						return;
+					} // else, the subtree got shorter, do_nothing();
+				} // else, balance is 0 and the subtree got shorter, do_nothing();
+
+				parent = this->nodes[top].parent;
+				if (parent != npos)
+				{
+					from_left = this->nodes[parent].left == top;
+				} // else, we reached the root, do_nothing();
+			}
+		}
+
+		/**
+		 * Point whatever referenced old_child at new_child instead.
+		 * @param parent
+		 * @param old_child
+		 * @param new_child
+		 */
+		void replace_child(index_type parent, index_type old_child, index_type new_child)
+		{
+			if (parent == npos)
+			{
+				this->root = new_child;
+			}
+			else if (this->nodes[parent].left == old_child)
+			{
+				this->nodes[parent].left = new_child;
+			}
+			else
+			{
+				this->nodes[parent].right = new_child;
+			}
+		}
+
+		/**
+		 * Rotate binary tree node with left child. This is a
+		 * single rotation.
+		 * @param current
+		 * @return the index now at the top of the subtree.
+		 */
+		index_type rotate_with_left_child(index_type current)
+		{
+			node &top = this->nodes[current];
+			const index_type temp = top.left;
+			node &child = this->nodes[temp];
+
+			top.left = child.right;
+			if (child.right != npos)
+			{
+				this->nodes[child.right].parent = current;
+			} // else, do_nothing();
+
+			child.right = current;
+			child.parent = top.parent;
+			top.parent = temp;
+			this->replace_child(child.parent, current, temp);
+
+			if (child.balance == 0)
+			{
+				top.balance = -1;
+				child.balance = 1;
+			}
+			else
+			{
+				top.balance = 0;
+				child.balance = 0;
+			}
+			return temp;
+		}
+
+		/**
+		 * Rotate binary tree node with the right child. This is a
+		 * single rotation.
+		 * @param current
+		 * @return the index now at the top of the subtree.
+		 */
+		index_type rotate_with_right_child(index_type current)
+		{
+			node &top = this->nodes[current];
+			const index_type temp = top.right;
+			node &child = this->nodes[temp];
+
+			top.right = child.left;
+			if (child.left != npos)
+			{
+				this->nodes[child.left].parent = current;
+			} // else, do_nothing();
+
+			child.left = current;
+			child.parent = top.parent;
+			top.parent = temp;
+			this->replace_child(child.parent, current, temp);
+
+			if (child.balance == 0)
+			{
+				top.balance = 1;
+				child.balance = -1;
+			}
+			else
+			{
+				top.balance = 0;
+				child.balance = 0;
+			}
+			return temp;
+		}
+
+		/**
+		 * Double rotate binary tree node - first rotate the left child
+		 * with its right child; then with the new left child.
+		 * @param current
+		 * @return the index now at the top of the subtree.
+		 */
+		index_type double_rotate_with_left_child(index_type current)
+		{
+			const index_type child = this->nodes[current].left;
+			const index_type grandchild = this->nodes[child].right;
+			const int balance = this->nodes[grandchild].balance;
+
+			this->rotate_with_right_child(child);
+			this->rotate_with_left_child(current);
+
+			this->nodes[current].balance = balance < 0 ? 1 : 0;
+			this->nodes[child].balance = balance > 0 ? -1 : 0;
+			this->nodes[grandchild].balance = 0;
+			return grandchild;
+		}
+
+		/**
+		 * Double rotate binary tree node - first rotate with right child
+		 * with its left child; then with the new right child.
+		 * @param current
+		 * @return the index now at the top of the subtree.
+		 */
+		index_type double_rotate_with_right_child(index_type current)
+		{
+			const index_type child = this->nodes[current].right;
+			const index_type grandchild = this->nodes[child].left;
+			const int balance = this->nodes[grandchild].balance;
+
+			this->rotate_with_left_child(child);
+			this->rotate_with_right_child(current);
+
+			this->nodes[current].balance = balance > 0 ? -1 : 0;
+			this->nodes[child].balance = balance < 0 ? 1 : 0;
+			this->nodes[grandchild].balance = 0;
+			return grandchild;
+		}
+	};
+}
+
+#endif // COMPACT_AVL_TREE_H_
@@ -0,0 +1,1438 @@
+#ifndef CONCURRENT_AVL_TREE_H_
+#define CONCURRENT_AVL_TREE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace nwacc
+{
+	/**
+	 * An avl_tree that many threads can read and write at once, after the
+	 * concurrent AVL tree of Bronson, Casper, Chafi and Olukotun.
+	 *
+	 * get and contains take no lock. Every node carries a version that a
+	 * writer bumps whenever it rotates the node down, and a reader that
+	 * passes through a node checks the version again before trusting the
+	 * child it read; if it moved, the reader retries from the parent.
+	 * insert and remove lock only the nodes they change, and a rotation
+	 * locks only the parent, the node and the child or grandchild that
+	 * take part in it.
+	 *
+	 * Balance is relaxed: heights are repaired bottom up after each change
+	 * and may briefly be off while other threads work. A removed key whose
+	 * node has two children stays behind as a routing node with no value
+	 * until it has at most one child and can be unlinked.
+	 *
+	 * Readers may still be standing on a node after it is unlinked, so
+	 * unlinked nodes and replaced values are retired, not freed. Each
+	 * thread keeps its own retire list behind a spin lock that other
+	 * threads only ever try, and the entries are freed by epoch based
+	 * reclamation while every thread keeps working: each call announces
+	 * the global epoch it started in, the epoch moves on once every
+	 * thread inside a call has seen it, and an entry retired in epoch e
+	 * is freed once the epoch reaches e + 2, when no call that could
+	 * still see it is running. Every reclaim_batch retirements a thread
+	 * frees what it can from its own list and from the lists of threads
+	 * that are between calls, so what waits to be freed stays around
+	 * reclaim_batch per thread plus whatever was retired while the
+	 * slowest call in flight runs; see retired. With more threads than
+	 * cores a thread can be switched out in the middle of a call and
+	 * hold the epoch back for a whole time slice, so the backlog grows
+	 * with the oversubscription. The overwrite runs of
+	 * concurrent_scaling_benchmark measure it. reclaim and the
+	 * destructor free whatever is left.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Compare orders the keys
+	 */
+	template<typename T, typename K, typename Compare = std::less<K>>
+	class concurrent_avl_tree
+	{
+	private:
+		struct node;
+
+		/**
+		 * A one byte spin lock. Nodes are only locked for the few stores
+		 * of an insert, unlink or rotation, so spinning with a yield beats
+		 * the size of a std::mutex in every node.
+		 */
+		class node_lock
+		{
+		public:
+			void lock()
+			{
+				while (this->flag.test_and_set(std::memory_order_acquire))
+				{
+					std::this_thread::yield();
+				}
+			}
+
+			bool try_lock()
+			{
+				return !this->flag.test_and_set(std::memory_order_acquire);
+			}
+
+			void unlock()
+			{
+				this->flag.clear(std::memory_order_release);
+			}
+
+		private:
+			std::atomic_flag flag = ATOMIC_FLAG_INIT;
+		};
+
+		/**
+		 * Everything a node has apart from its key, so the holder above
+		 * the root can be one without a K to spare. A null value marks a
+		 * routing node. The height of a missing child is 0 and of a leaf 1.
+		 */
+		struct node_base
+		{
+			std::atomic<int> height{ 0 };
+			std::atomic<std::uint64_t> version{ 0 };
+			std::atomic<const T *> value{ nullptr };
+			std::atomic<node_base *> parent{ nullptr };
+			std::atomic<node *> left{ nullptr };
+			std::atomic<node *> right{ nullptr };
+			node_lock lock;
+
+			node *child(int direction) const
+			{
+				return direction < 0 ? this->left.load() : this->right.load();
+			}
+
+			void set_child(int direction, node *current)
+			{
+				if (direction < 0)
+				{
+					this->left.store(current);
+				}
+				else
+				{
+					this->right.store(current);
+				}
+			}
+		};
+
+		struct node : node_base
+		{
+			const K key;
+
+			node(const K &the_key, const T *the_value, node_base *the_parent) : key(the_key)
+			{
+				this->height.store(1);
+				this->value.store(the_value);
+				this->parent.store(the_parent);
+			}
+		};
+
+		/**
+		 * Version bits. A node that is being rotated down is shrinking,
+		 * and every finished rotation adds shrink_count, so a reader sees
+		 * a different version whenever keys may have left the subtree it
+		 * is in.
+		 */
+		static constexpr std::uint64_t unlinked = 1;
+		static constexpr std::uint64_t shrinking = 2;
+		static constexpr std::uint64_t shrink_count = 4;
+
+		/**
+		 * What node_condition reports besides a new height.
+		 */
+		static constexpr int unlink_required = -1;
+		static constexpr int rebalance_required = -2;
+		static constexpr int nothing_required = -3;
+
+		/**
+		 * How often a reader spins on a shrinking node before it waits on
+		 * the node's lock instead.
+		 */
+		static constexpr int spin_count = 100;
+
+		/**
+		 * How many parents fix_height_and_rebalance remembers to come back
+		 * to without allocating. Any more go on to a vector.
+		 */
+		static constexpr int max_pending = 16;
+
+		/**
+		 * How an optimistic attempt ended. retry means a node on the way
+		 * changed under us and the caller has to try again from higher up.
+		 */
+		enum class outcome { done, retry };
+
+		struct attempt
+		{
+			outcome status;
+			const T *value;
+		};
+
+		/**
+		 * Sits above the root, which is its right child. It is never
+		 * rotated or unlinked, so its version never changes.
+		 */
+		node_base holder;
+
+		/**
+		 * Orders the keys.
+		 */
+		Compare compare;
+
+		/**
+		 * How many entries a thread retires between looks at its list.
+		 */
+		static constexpr std::size_t reclaim_batch = 64;
+
+		/**
+		 * What one thread has retired and the epoch its current call
+		 * started in. Each thread that uses the tree gets one, kept until
+		 * the tree is destroyed; a later thread with the same id takes
+		 * it over. The owner adds to the lists under busy, and any thread
+		 * may free from them if it gets busy with try_lock.
+		 */
+		struct alignas(64) thread_record
+		{
+			/**
+			 * (epoch << 1) | 1 while the owner is inside a call, 0
+			 * between calls.
+			 */
+			std::atomic<std::uint64_t> announced{ 0 };
+
+			/**
+			 * The length of both lists, for retired.
+			 */
+			std::atomic<std::size_t> retired_count{ 0 };
+
+			/**
+			 * Guards the lists.
+			 */
+			node_lock busy;
+
+			/**
+			 * Look at the lists again once retired_count reaches this.
+			 */
+			std::size_t next_collect = reclaim_batch;
+
+			std::thread::id owner;
+			thread_record *next = nullptr;
+
+			/**
+			 * Entries with the epoch they were retired in, oldest first.
+			 */
+			std::vector<std::pair<node *, std::uint64_t>> retired_nodes;
+			std::vector<std::pair<const T *, std::uint64_t>> retired_values;
+		};
+
+		/**
+		 * Announces the epoch for one call and looks at the retire list
+		 * when the call is done, outside every lock.
+		 */
+		class epoch_guard
+		{
+		public:
+			explicit epoch_guard(const concurrent_avl_tree &tree) : tree{ tree }, record{ tree.local_record() }
+			{
+				this->record->announced.store((tree.epoch.load() << 1) | 1);
+			}
+
+			epoch_guard(const epoch_guard &) = delete;
+			epoch_guard &operator=(const epoch_guard &) = delete;
+
+			~epoch_guard()
+			{
+				this->record->announced.store(0);
+				if (this->record->retired_count.load(std::memory_order_relaxed) >= this->record->next_collect)
+				{
+					this->tree.collect(*this->record);
+				} // else, do_nothing();
+			}
+
+		private:
+			const concurrent_avl_tree &tree;
+			thread_record *record;
+		};
+
+		/**
+		 * Hands every tree its own id, so a thread's cached record can
+		 * never be mistaken for one of a later tree at the same address.
+		 */
+		static inline std::atomic<std::uint64_t> tree_ids{ 0 };
+		const std::uint64_t id = ++tree_ids;
+
+		/**
+		 * The global epoch.
+		 */
+		mutable std::atomic<std::uint64_t> epoch{ 1 };
+
+		/**
+		 * Every thread_record, newest first. Records are only added until
+		 * the tree is destroyed.
+		 */
+		mutable std::atomic<thread_record *> records{ nullptr };
+
+	public:
+		/**
+		 * Create an empty tree.
+		 */
+		concurrent_avl_tree() = default;
+
+		/**
+		 * Create an empty tree that orders its keys with compare.
+		 * @param compare
+		 */
+		explicit concurrent_avl_tree(const Compare &compare) : compare{ compare } {}
+
+		concurrent_avl_tree(const concurrent_avl_tree &) = delete;
+		concurrent_avl_tree &operator=(const concurrent_avl_tree &) = delete;
+
+		/**
+		 * Free every node and value, live or retired.
+		 */
+		~concurrent_avl_tree()
+		{
+			std::vector<node *> pending;
+			if (this->holder.right.load() != nullptr)
+			{
+				pending.push_back(this->holder.right.load());
+			} // else, do_nothing();
+			while (!pending.empty())
+			{
+				node *current = pending.back();
+				pending.pop_back();
+				if (current->left.load() != nullptr)
+				{
+					pending.push_back(current->left.load());
+				} // else, do_nothing();
+				if (current->right.load() != nullptr)
+				{
+					pending.push_back(current->right.load());
+				} // else, do_nothing();
+				delete current->value.load();
+				delete current;
+			}
+			this->reclaim();
+			for (thread_record *record = this->records.load(); record != nullptr;)
+			{
+				thread_record *next = record->next;
+				delete record;
+				record = next;
+			}
+		}
+
+		/**
+		 * Determine if the key is in the tree. Takes no lock.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		bool contains(const K &key) const
+		{
+			epoch_guard guard(*this);
+			return this->find_value(key) != nullptr;
+		}
+
+		/**
+		 * Get the value associated with a key. Takes no lock.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		T get(const K &key) const
+		{
+			epoch_guard guard(*this);
+			const T *found = this->find_value(key);
+			if (found == nullptr)
+			{
+				throw std::length_error("Data not Found....");
+			} // else, we found the key, do_nothing();
+			return *found;
+		}
+
+		/**
+		 * Copy the value associated with a key into value. Takes no lock.
+		 * @param key
+		 * @param value left alone when the key is missing
+		 * @return true if the key was found.
+		 */
+		bool try_get(const K &key, T &value) const
+		{
+			epoch_guard guard(*this);
+			const T *found = this->find_value(key);
+			if (found == nullptr)
+			{
+				return false;
+			} // else, we found the key, do_nothing();
+			value = *found;
+			return true;
+		}
+
+		/**
+		 * Insert the value at the key, or replace the value if the key is
+		 * already in the tree.
+		 * @param value
+		 * @param key
+		 * @return true if the key was not in the tree before.
+		 */
+		bool insert(const T &value, const K &key)
+		{
+			epoch_guard guard(*this);
+			const T *previous = this->update(key, new T(value));
+			if (previous == nullptr)
+			{
+				return true;
+			} // else, the old value was replaced, do_nothing();
+			this->retire(previous);
+			return false;
+		}
+
+		/**
+		 * Remove the value referenced by the key.
+		 * @param key
+		 * @return true if the key was found and removed.
+		 */
+		bool remove(const K &key)
+		{
+			epoch_guard guard(*this);
+			const T *previous = this->update(key, nullptr);
+			if (previous == nullptr)
+			{
+				return false;
+			} // else, the key was removed, do_nothing();
+			this->retire(previous);
+			return true;
+		}
+
+		/**
+		 * Free every retired node and value at once, including what
+		 * threads that stopped calling left behind. No other thread may be
+		 * using the tree while this runs; the others free their entries
+		 * as they go without it.
+		 */
+		void reclaim()
+		{
+			for (thread_record *record = this->records.load(); record != nullptr; record = record->next)
+			{
+				release(record->retired_nodes, std::numeric_limits<std::uint64_t>::max());
+				release(record->retired_values, std::numeric_limits<std::uint64_t>::max());
+				record->retired_count.store(0);
+				record->next_collect = reclaim_batch;
+			}
+		}
+
+		/**
+		 * How many unlinked nodes and replaced values wait to be freed.
+		 * Exact once the other threads are done, a snapshot while they
+		 * work.
+		 * @return the number of retired entries not yet freed.
+		 */
+		std::size_t retired() const
+		{
+			std::size_t count = 0;
+			for (const thread_record *record = this->records.load(); record != nullptr; record = record->next)
+			{
+				count += record->retired_count.load(std::memory_order_relaxed);
+			}
+			return count;
+		}
+
+	private:
+		/**
+		 * Order two keys.
+		 * @param lhs
+		 * @param rhs
+		 * @return -1, 0 or 1 as lhs is less than, equal to or greater than rhs.
+		 */
+		int order(const K &lhs, const K &rhs) const
+		{
+			return this->compare(lhs, rhs) ? -1 : (this->compare(rhs, lhs) ? 1 : 0);
+		}
+
+		/**
+		 * Finds the height of the current tree.
+		 * @param current
+		 * @return the height of the current tree, 0 for a null pointer.
+		 */
+		static int height(const node *current)
+		{
+			return current == nullptr ? 0 : current->height.load();
+		}
+
+		static bool is_changing(std::uint64_t version)
+		{
+			return (version & (shrinking | unlinked)) != 0;
+		}
+
+		/**
+		 * Wait for a rotation that is shrinking current to finish. A short
+		 * spin covers the usual case; after that we wait for the lock the
+		 * rotating thread is holding.
+		 * @param current
+		 */
+		static void wait_until_not_changing(node *current)
+		{
+			const std::uint64_t version = current->version.load();
+			if ((version & shrinking) == 0)
+			{
+				return;
+			} // else, a rotation is under way, do_nothing();
+
+			for (int spin = 0; spin < spin_count; spin++)
+			{
+				if (current->version.load() != version)
+				{
+					return;
+				} // else, keep spinning, do_nothing();
+			}
+			std::lock_guard<node_lock> guard(current->lock);
+		}
+
+		/**
+		 * Find the calling thread's record, adding one the first time the
+		 * thread uses this tree. The last one found is cached per thread.
+		 * @return the record of the calling thread.
+		 */
+		thread_record *local_record() const
+		{
+			struct cached_record
+			{
+				std::uint64_t tree = 0;
+				thread_record *record = nullptr;
+			};
+			thread_local cached_record last;
+			if (last.tree == this->id)
+			{
+				return last.record;
+			} // else, look it up, do_nothing();
+
+			const std::thread::id self = std::this_thread::get_id();
+			thread_record *found = this->records.load();
+			while (found != nullptr && found->owner != self)
+			{
+				found = found->next;
+			}
+			if (found == nullptr)
+			{
+				found = new thread_record();
+				found->owner = self;
+				found->next = this->records.load();
+				while (!this->records.compare_exchange_weak(found->next, found))
+				{
+					// another thread added its record first, try again
+				}
+			} // else, a thread with our id was here before, do_nothing();
+			last = { this->id, found };
+			return found;
+		}
+
+		/**
+		 * Move the global epoch on if every thread inside a call has
+		 * announced it.
+		 */
+		void try_advance() const
+		{
+			std::uint64_t current = this->epoch.load();
+			for (const thread_record *record = this->records.load(); record != nullptr; record = record->next)
+			{
+				const std::uint64_t announced = record->announced.load();
+				if (announced != 0 && (announced >> 1) != current)
+				{
+					return;
+				} // else, idle or caught up, do_nothing();
+			}
+			this->epoch.compare_exchange_strong(current, current + 1);
+		}
+
+		/**
+		 * Free the front of a retire list, every entry retired before
+		 * epoch - 1.
+		 * @param retired
+		 * @param epoch the global epoch
+		 * @return how many entries were freed.
+		 */
+		template<typename Pointer>
+		static std::size_t release(std::vector<std::pair<Pointer, std::uint64_t>> &retired, std::uint64_t epoch)
+		{
+			std::size_t count = 0;
+			while (count < retired.size() && retired[count].second + 2 <= epoch)
+			{
+				delete retired[count].first;
+				count += 1;
+			}
+			retired.erase(retired.begin(), retired.begin() + count);
+			return count;
+		}
+
+		/**
+		 * Free the entries of record that no call can see any more.
+		 * record.busy must be held.
+		 * @param record
+		 * @param epoch the global epoch
+		 * @return how many entries are left.
+		 */
+		static std::size_t release(thread_record &record, std::uint64_t epoch)
+		{
+			const std::size_t freed = release(record.retired_nodes, epoch) + release(record.retired_values, epoch);
+			const std::size_t left = record.retired_count.load(std::memory_order_relaxed) - freed;
+			record.retired_count.store(left, std::memory_order_relaxed);
+			return left;
+		}
+
+		/**
+		 * Free what the calling thread retired that no call can see any
+		 * more, then the same for every thread between calls whose list
+		 * is not busy. The calling thread must be between calls.
+		 * @param record the calling thread's record
+		 */
+		void collect(thread_record &record) const
+		{
+			this->try_advance();
+			const std::uint64_t current = this->epoch.load();
+			{
+				std::lock_guard<node_lock> guard(record.busy);
+				record.next_collect = release(record, current) + reclaim_batch;
+			}
+
+			for (thread_record *other = this->records.load(); other != nullptr; other = other->next)
+			{
+				if (other == &record || other->announced.load() != 0 ||
+					other->retired_count.load(std::memory_order_relaxed) == 0 || !other->busy.try_lock())
+				{
+					continue;
+				} // else, the list is ours for now, do_nothing();
+				release(*other, current);
+				other->busy.unlock();
+			}
+		}
+
+		void retire(node *current)
+		{
+			thread_record *record = this->local_record();
+			std::lock_guard<node_lock> guard(record->busy);
+			record->retired_nodes.emplace_back(current, this->epoch.load());
+			record->retired_count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void retire(const T *value)
+		{
+			thread_record *record = this->local_record();
+			std::lock_guard<node_lock> guard(record->busy);
+			record->retired_values.emplace_back(value, this->epoch.load());
+			record->retired_count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Find the value at key without taking a lock. Each step reads a
+		 * child and then checks that the node we came from has not been
+		 * rotated down since, so the child is still the right way to go.
+		 * If it has, the search starts over from the root; that is rare
+		 * enough that keeping no path is cheaper than retrying from the
+		 * parent.
+		 * @param key
+		 * @return the value or a null pointer if the key is missing.
+		 */
+		const T *find_value(const K &key) const
+		{
+			while (true)
+			{
+				const node_base *current = &this->holder;
+				std::uint64_t version = 0;
+				int direction = 1;
+				while (true)
+				{
+					node *child = current->child(direction);
+					if (child == nullptr)
+					{
+						if (current->version.load() != version)
+						{
+							break;
+						} // else, the key is not in the tree, do_nothing();
+						return nullptr;
+					} // else, keep going down, do_nothing();
+
+					const int next = this->order(key, child->key);
+					if (next == 0)
+					{
+						return child->value.load();
+					} // else, do_nothing();
+
+					const std::uint64_t child_version = child->version.load();
+					if (is_changing(child_version))
+					{
+						wait_until_not_changing(child);
+					}
+					else if (child == current->child(direction))
+					{
+						if (current->version.load() != version)
+						{
+							break;
+						} // else, child is still the right way, do_nothing();
+						current = child;
+						version = child_version;
+						direction = next;
+						continue;
+					} // else, the child moved, do_nothing();
+
+					if (current->version.load() != version)
+					{
+						break;
+					} // else, try the same step again, do_nothing();
+				}
+			}
+		}
+
+		/**
+		 * Set the value at key, or remove the key when value is null.
+		 * @param key
+		 * @param value
+		 * @return the value the key had before, null if it had none.
+		 */
+		const T *update(const K &key, const T *value)
+		{
+			while (true)
+			{
+				node *root = this->holder.right.load();
+				if (root == nullptr)
+				{
+					if (value == nullptr)
+					{
+						return nullptr;
+					} // else, insert into the empty tree, do_nothing();
+
+					std::lock_guard<node_lock> guard(this->holder.lock);
+					if (this->holder.right.load() == nullptr)
+					{
+						this->holder.right.store(new node(key, value, &this->holder));
+						return nullptr;
+					} // else, somebody got there first, do_nothing();
+				}
+				else
+				{
+					const std::uint64_t root_version = root->version.load();
+					if (is_changing(root_version))
+					{
+						wait_until_not_changing(root);
+					}
+					else if (root == this->holder.right.load())
+					{
+						attempt result = this->attempt_update(key, value, &this->holder, root, root_version);
+						if (result.status != outcome::retry)
+						{
+							return result.value;
+						} // else, try again from the top, do_nothing();
+					} // else, the root changed, do_nothing();
+				}
+			}
+		}
+
+		/**
+		 * Walk down from current like attempt_get, then lock only the node
+		 * that changes.
+		 * @param key
+		 * @param value the new value, or null to remove
+		 * @param parent
+		 * @param current
+		 * @param version the version current had when we arrived
+		 * @return the old value, or retry if current changed.
+		 */
+		attempt attempt_update(const K &key, const T *value, node_base *parent, node *current, std::uint64_t version)
+		{
+			const int direction = this->order(key, current->key);
+			if (direction == 0)
+			{
+				return this->attempt_node_update(value, parent, current);
+			} // else, keep going down, do_nothing();
+
+			while (true)
+			{
+				node *child = current->child(direction);
+				if (current->version.load() != version)
+				{
+					return { outcome::retry, nullptr };
+				} // else, do_nothing();
+
+				if (child == nullptr)
+				{
+					if (value == nullptr)
+					{
+						return { outcome::done, nullptr };
+					} // else, hang a new leaf here, do_nothing();
+
+					node_base *damaged = nullptr;
+					{
+						std::lock_guard<node_lock> guard(current->lock);
+						if (current->version.load() != version)
+						{
+							return { outcome::retry, nullptr };
+						} // else, do_nothing();
+						if (current->child(direction) != nullptr)
+						{
+							continue;
+						} // else, the spot is still free, do_nothing();
+						current->set_child(direction, new node(key, value, current));
+						damaged = this->fix_height(current);
+					}
+					this->fix_height_and_rebalance(damaged);
+					return { outcome::done, nullptr };
+				} // else, do_nothing();
+
+				const std::uint64_t child_version = child->version.load();
+				if (is_changing(child_version))
+				{
+					wait_until_not_changing(child);
+				}
+				else if (child == current->child(direction))
+				{
+					if (current->version.load() != version)
+					{
+						return { outcome::retry, nullptr };
+					} // else, do_nothing();
+
+					attempt result = this->attempt_update(key, value, current, child, child_version);
+					if (result.status != outcome::retry)
+					{
+						return result;
+					} // else, child changed, try the same step again, do_nothing();
+				} // else, the child moved, do_nothing();
+			}
+		}
+
+		/**
+		 * Change the value of current, the node that holds the key. A
+		 * removal unlinks current when it has at most one child, which
+		 * needs the parent locked too; otherwise current just becomes a
+		 * routing node.
+		 * @param value the new value, or null to remove
+		 * @param parent
+		 * @param current
+		 * @return the old value, or retry if the shape changed.
+		 */
+		attempt attempt_node_update(const T *value, node_base *parent, node *current)
+		{
+			if (value == nullptr && current->value.load() == nullptr)
+			{
+				return { outcome::done, nullptr };
+			} // else, do_nothing();
+
+			if (value == nullptr && (current->left.load() == nullptr || current->right.load() == nullptr))
+			{
+				const T *previous = nullptr;
+				node_base *damaged = nullptr;
+				{
+					std::lock_guard<node_lock> parent_guard(parent->lock);
+					if ((parent->version.load() & unlinked) != 0 || current->parent.load() != parent)
+					{
+						return { outcome::retry, nullptr };
+					} // else, do_nothing();
+
+					{
+						std::lock_guard<node_lock> guard(current->lock);
+						previous = current->value.load();
+						if (previous == nullptr)
+						{
+							return { outcome::done, nullptr };
+						} // else, do_nothing();
+						if (!this->attempt_unlink(parent, current))
+						{
+							return { outcome::retry, nullptr };
+						} // else, do_nothing();
+					}
+					damaged = this->fix_height(parent);
+				}
+				this->fix_height_and_rebalance(damaged);
+				return { outcome::done, previous };
+			} // else, no unlink, do_nothing();
+
+			std::lock_guard<node_lock> guard(current->lock);
+			if ((current->version.load() & unlinked) != 0)
+			{
+				return { outcome::retry, nullptr };
+			} // else, do_nothing();
+			if (value == nullptr && (current->left.load() == nullptr || current->right.load() == nullptr))
+			{
+				return { outcome::retry, nullptr };
+			} // else, do_nothing();
+
+			const T *previous = current->value.load();
+			current->value.store(value);
+			return { outcome::done, previous };
+		}
+
+		/**
+		 * Splice current, which has at most one child, out from under
+		 * parent. Both must be locked.
+		 * @param parent
+		 * @param current
+		 * @return false if the shape is no longer right for it.
+		 */
+		bool attempt_unlink(node_base *parent, node *current)
+		{
+			node *parent_left = parent->left.load();
+			node *parent_right = parent->right.load();
+			if (parent_left != current && parent_right != current)
+			{
+				return false;
+			} // else, do_nothing();
+
+			node *left = current->left.load();
+			node *right = current->right.load();
+			if (left != nullptr && right != nullptr)
+			{
+				return false;
+			} // else, do_nothing();
+
+			node *splice = left != nullptr ? left : right;
+			if (parent_left == current)
+			{
+				parent->left.store(splice);
+			}
+			else
+			{
+				parent->right.store(splice);
+			}
+			if (splice != nullptr)
+			{
+				splice->parent.store(parent);
+			} // else, do_nothing();
+
+			current->version.store(unlinked);
+			current->value.store(nullptr);
+			this->retire(current);
+			return true;
+		}
+
+		/**
+		 * What current needs: an unlink, a rotation, a new height, or
+		 * nothing.
+		 * @param current
+		 * @return one of the *_required constants or the new height.
+		 */
+		static int node_condition(node_base *current)
+		{
+			node *left = current->left.load();
+			node *right = current->right.load();
+			if ((left == nullptr || right == nullptr) && current->value.load() == nullptr)
+			{
+				return unlink_required;
+			} // else, do_nothing();
+
+			const int current_height = current->height.load();
+			const int left_height = height(left);
+			const int right_height = height(right);
+			const int new_height = std::max(left_height, right_height) + 1;
+			const int balance = left_height - right_height;
+			if (balance < -1 || balance > 1)
+			{
+				return rebalance_required;
+			} // else, do_nothing();
+			return current_height != new_height ? new_height : nothing_required;
+		}
+
+		/**
+		 * Repair the height of current, which must be locked.
+		 * @param current
+		 * @return the next node that may need work, or null.
+		 */
+		static node_base *fix_height(node_base *current)
+		{
+			const int condition = node_condition(current);
+			switch (condition)
+			{
+			case rebalance_required:
+			case unlink_required:
+				return current;
+			case nothing_required:
+				return nullptr;
+			default:
+				current->height.store(condition);
+				return current->parent.load();
+			}
+		}
+
+		/**
+		 * Walk up from current repairing heights, unlinking routing nodes
+		 * and rotating, holding at most the locks of the few nodes being
+		 * changed at each step. A rotation hands back only the lowest node
+		 * it left damaged, so the parent it rotated under is kept and
+		 * looked at again once the walk from below stops.
+		 * @param current
+		 */
+		void fix_height_and_rebalance(node_base *current)
+		{
+			node_base *pending[max_pending];
+			int pending_count = 0;
+			std::vector<node_base *> overflow;
+			while (true)
+			{
+				if (current == nullptr || current->parent.load() == nullptr ||
+					(current->version.load() & unlinked) != 0)
+				{
+					if (!overflow.empty())
+					{
+						current = overflow.back();
+						overflow.pop_back();
+					}
+					else if (pending_count != 0)
+					{
+						current = pending[--pending_count];
+					}
+					else
+					{
+						return;
+					}
+					continue;
+				} // else, do_nothing();
+
+				const int condition = node_condition(current);
+				if (condition == nothing_required)
+				{
+					current = nullptr;
+				}
+				else if (condition != unlink_required && condition != rebalance_required)
+				{
+					std::lock_guard<node_lock> guard(current->lock);
+					current = fix_height(current);
+				}
+				else
+				{
+					node_base *parent = current->parent.load();
+					std::lock_guard<node_lock> parent_guard(parent->lock);
+					if ((parent->version.load() & unlinked) == 0 && current->parent.load() == parent)
+					{
+						std::lock_guard<node_lock> guard(current->lock);
+						current = this->rebalance(parent, static_cast<node *>(current));
+						if (current != parent)
+						{
+							if (pending_count < max_pending)
+							{
+								pending[pending_count++] = parent;
+							}
+							else
+							{
+								overflow.push_back(parent);
+							}
+						} // else, the walk goes through parent anyway, do_nothing();
+					} // else, current moved, look at it again, do_nothing();
+				}
+			}
+		}
+
+
+		/**
+		 * Unlink, rotate or fix the height of current. parent and current
+		 * must be locked.
+		 * @param parent
+		 * @param current
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *rebalance(node_base *parent, node *current)
+		{
+			node *left = current->left.load();
+			node *right = current->right.load();
+			if ((left == nullptr || right == nullptr) && current->value.load() == nullptr)
+			{
+				if (this->attempt_unlink(parent, current))
+				{
+					return fix_height(parent);
+				} // else, do_nothing();
+				return current;
+			} // else, do_nothing();
+
+			const int current_height = current->height.load();
+			const int left_height = height(left);
+			const int right_height = height(right);
+			const int new_height = std::max(left_height, right_height) + 1;
+			const int balance = left_height - right_height;
+			if (balance > 1)
+			{
+				return this->rebalance_to_right(parent, current, left, right_height);
+			}
+			else if (balance < -1)
+			{
+				return this->rebalance_to_left(parent, current, right, left_height);
+			}
+			else if (new_height != current_height)
+			{
+				current->height.store(new_height);
+				return fix_height(parent);
+			}
+			else
+			{
+				return nullptr;
+			}
+		}
+
+		/**
+		 * current is too heavy on the left. Lock the left child, and the
+		 * left-right grandchild if a double rotation is needed.
+		 * @param parent
+		 * @param current
+		 * @param left
+		 * @param right_height
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *rebalance_to_right(node_base *parent, node *current, node *left, int right_height)
+		{
+			std::lock_guard<node_lock> left_guard(left->lock);
+			const int left_height = left->height.load();
+			if (left_height - right_height <= 1)
+			{
+				return current;
+			} // else, do_nothing();
+
+			node *left_right = left->right.load();
+			const int left_left_height = height(left->left.load());
+			const int left_right_height = height(left_right);
+			if (left_left_height >= left_right_height)
+			{
+				return this->rotate_with_left_child(parent, current, left, right_height, left_left_height,
+													left_right, left_right_height);
+			} // else, do_nothing();
+
+			{
+				std::lock_guard<node_lock> left_right_guard(left_right->lock);
+				const int locked_left_right_height = left_right->height.load();
+				if (left_left_height >= locked_left_right_height)
+				{
+					return this->rotate_with_left_child(parent, current, left, right_height, left_left_height,
+														left_right, locked_left_right_height);
+				} // else, do_nothing();
+
+				const int left_right_left_height = height(left_right->left.load());
+				const int balance = left_left_height - left_right_left_height;
+				if (balance >= -1 && balance <= 1)
+				{
+					return this->double_with_left_child(parent, current, left, right_height, left_left_height,
+														left_right, left_right_left_height);
+				} // else, do_nothing();
+			}
+
+			// a double rotation would leave left unbalanced, so fix left first
+			return this->rebalance_to_left(current, left, left_right, left_left_height);
+		}
+
+		/**
+		 * current is too heavy on the right. The mirror of
+		 * rebalance_to_right.
+		 * @param parent
+		 * @param current
+		 * @param right
+		 * @param left_height
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *rebalance_to_left(node_base *parent, node *current, node *right, int left_height)
+		{
+			std::lock_guard<node_lock> right_guard(right->lock);
+			const int right_height = right->height.load();
+			if (left_height - right_height >= -1)
+			{
+				return current;
+			} // else, do_nothing();
+
+			node *right_left = right->left.load();
+			const int right_left_height = height(right_left);
+			const int right_right_height = height(right->right.load());
+			if (right_right_height >= right_left_height)
+			{
+				return this->rotate_with_right_child(parent, current, left_height, right, right_left,
+													 right_left_height, right_right_height);
+			} // else, do_nothing();
+
+			{
+				std::lock_guard<node_lock> right_left_guard(right_left->lock);
+				const int locked_right_left_height = right_left->height.load();
+				if (right_right_height >= locked_right_left_height)
+				{
+					return this->rotate_with_right_child(parent, current, left_height, right, right_left,
+														 locked_right_left_height, right_right_height);
+				} // else, do_nothing();
+
+				const int right_left_right_height = height(right_left->right.load());
+				const int balance = right_right_height - right_left_right_height;
+				if (balance >= -1 && balance <= 1)
+				{
+					return this->double_with_right_child(parent, current, left_height, right, right_left,
+														 right_right_height, right_left_right_height);
+				} // else, do_nothing();
+			}
+
+			return this->rebalance_to_right(current, right, right_left, right_right_height);
+		}
+
+		/**
+		 * Rotate current down to the right under its left child. parent,
+		 * current and left are locked; current is marked shrinking while
+		 * its links change.
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *rotate_with_left_child(node_base *parent, node *current, node *left, int right_height,
+										  int left_left_height, node *left_right, int left_right_height)
+		{
+			const std::uint64_t version = current->version.load();
+			node *parent_left = parent->left.load();
+
+			current->version.store(version | shrinking);
+			current->left.store(left_right);
+			if (left_right != nullptr)
+			{
+				left_right->parent.store(current);
+			} // else, do_nothing();
+			left->right.store(current);
+			current->parent.store(left);
+			if (parent_left == current)
+			{
+				parent->left.store(left);
+			}
+			else
+			{
+				parent->right.store(left);
+			}
+			left->parent.store(parent);
+
+			const int current_height = std::max(left_right_height, right_height) + 1;
+			current->height.store(current_height);
+			left->height.store(std::max(left_left_height, current_height) + 1);
+			current->version.store(version + shrink_count);
+
+			const int current_balance = left_right_height - right_height;
+			if (current_balance < -1 || current_balance > 1)
+			{
+				return current;
+			} // else, do_nothing();
+			if ((left_right == nullptr || right_height == 0) && current->value.load() == nullptr)
+			{
+				return current;
+			} // else, do_nothing();
+
+			const int left_balance = left_left_height - current_height;
+			if (left_balance < -1 || left_balance > 1)
+			{
+				return left;
+			} // else, do_nothing();
+			if (left_left_height == 0 && left->value.load() == nullptr)
+			{
+				return left;
+			} // else, do_nothing();
+			return fix_height(parent);
+		}
+
+		/**
+		 * Rotate current down to the left under its right child. The
+		 * mirror of rotate_with_left_child.
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *rotate_with_right_child(node_base *parent, node *current, int left_height, node *right,
+										   node *right_left, int right_left_height, int right_right_height)
+		{
+			const std::uint64_t version = current->version.load();
+			node *parent_left = parent->left.load();
+
+			current->version.store(version | shrinking);
+			current->right.store(right_left);
+			if (right_left != nullptr)
+			{
+				right_left->parent.store(current);
+			} // else, do_nothing();
+			right->left.store(current);
+			current->parent.store(right);
+			if (parent_left == current)
+			{
+				parent->left.store(right);
+			}
+			else
+			{
+				parent->right.store(right);
+			}
+			right->parent.store(parent);
+
+			const int current_height = std::max(left_height, right_left_height) + 1;
+			current->height.store(current_height);
+			right->height.store(std::max(current_height, right_right_height) + 1);
+			current->version.store(version + shrink_count);
+
+			const int current_balance = right_left_height - left_height;
+			if (current_balance < -1 || current_balance > 1)
+			{
+				return current;
+			} // else, do_nothing();
+			if ((right_left == nullptr || left_height == 0) && current->value.load() == nullptr)
+			{
+				return current;
+			} // else, do_nothing();
+
+			const int right_balance = right_right_height - current_height;
+			if (right_balance < -1 || right_balance > 1)
+			{
+				return right;
+			} // else, do_nothing();
+			if (right_right_height == 0 && right->value.load() == nullptr)
+			{
+				return right;
+			} // else, do_nothing();
+			return fix_height(parent);
+		}
+
+		/**
+		 * Lift the left-right grandchild above current and left. parent,
+		 * current, left and left_right are locked; current and left both
+		 * shrink.
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *double_with_left_child(node_base *parent, node *current, node *left, int right_height,
+										  int left_left_height, node *left_right, int left_right_left_height)
+		{
+			const std::uint64_t version = current->version.load();
+			const std::uint64_t left_version = left->version.load();
+			node *parent_left = parent->left.load();
+			node *left_right_left = left_right->left.load();
+			node *left_right_right = left_right->right.load();
+			const int left_right_right_height = height(left_right_right);
+
+			current->version.store(version | shrinking);
+			left->version.store(left_version | shrinking);
+
+			current->left.store(left_right_right);
+			if (left_right_right != nullptr)
+			{
+				left_right_right->parent.store(current);
+			} // else, do_nothing();
+			left->right.store(left_right_left);
+			if (left_right_left != nullptr)
+			{
+				left_right_left->parent.store(left);
+			} // else, do_nothing();
+			left_right->left.store(left);
+			left->parent.store(left_right);
+			left_right->right.store(current);
+			current->parent.store(left_right);
+			if (parent_left == current)
+			{
+				parent->left.store(left_right);
+			}
+			else
+			{
+				parent->right.store(left_right);
+			}
+			left_right->parent.store(parent);
+
+			const int current_height = std::max(left_right_right_height, right_height) + 1;
+			current->height.store(current_height);
+			int left_height = std::max(left_left_height, left_right_left_height) + 1;
+			left->height.store(left_height);
+
+			current->version.store(version + shrink_count);
+			left->version.store(left_version + shrink_count);
+
+			if ((left_left_height == 0 || left_right_left == nullptr) && left->value.load() == nullptr)
+			{
+				// left is a routing node down to one child, and its new
+				// parent is locked too, so it can go right away
+				this->attempt_unlink(left_right, left);
+				left_height -= 1;
+			} // else, do_nothing();
+			left_right->height.store(std::max(left_height, current_height) + 1);
+
+			const int current_balance = left_right_right_height - right_height;
+			if (current_balance < -1 || current_balance > 1)
+			{
+				return current;
+			} // else, do_nothing();
+			if ((left_right_right == nullptr || right_height == 0) && current->value.load() == nullptr)
+			{
+				return current;
+			} // else, do_nothing();
+
+			const int left_right_balance = left_height - current_height;
+			if (left_right_balance < -1 || left_right_balance > 1)
+			{
+				return left_right;
+			} // else, do_nothing();
+			return fix_height(parent);
+		}
+
+		/**
+		 * Lift the right-left grandchild above current and right. The
+		 * mirror of double_with_left_child.
+		 * @return the next node that may need work, or null.
+		 */
+		node_base *double_with_right_child(node_base *parent, node *current, int left_height, node *right,
+										   node *right_left, int right_right_height, int right_left_right_height)
+		{
+			const std::uint64_t version = current->version.load();
+			const std::uint64_t right_version = right->version.load();
+			node *parent_left = parent->left.load();
+			node *right_left_left = right_left->left.load();
+			node *right_left_right = right_left->right.load();
+			const int right_left_left_height = height(right_left_left);
+
+			current->version.store(version | shrinking);
+			right->version.store(right_version | shrinking);
+
+			current->right.store(right_left_left);
+			if (right_left_left != nullptr)
+			{
+				right_left_left->parent.store(current);
+			} // else, do_nothing();
+			right->left.store(right_left_right);
+			if (right_left_right != nullptr)
+			{
+				right_left_right->parent.store(right);
+			} // else, do_nothing();
+			right_left->right.store(right);
+			right->parent.store(right_left);
+			right_left->left.store(current);
+			current->parent.store(right_left);
+			if (parent_left == current)
+			{
+				parent->left.store(right_left);
+			}
+			else
+			{
+				parent->right.store(right_left);
+			}
+			right_left->parent.store(parent);
+
+			const int current_height = std::max(left_height, right_left_left_height) + 1;
+			current->height.store(current_height);
+			int right_height = std::max(right_left_right_height, right_right_height) + 1;
+			right->height.store(right_height);
+
+			current->version.store(version + shrink_count);
+			right->version.store(right_version + shrink_count);
+
+			if ((right_right_height == 0 || right_left_right == nullptr) && right->value.load() == nullptr)
+			{
+				// right is a routing node down to one child, and its new
+				// parent is locked too, so it can go right away
+				this->attempt_unlink(right_left, right);
+				right_height -= 1;
+			} // else, do_nothing();
+			right_left->height.store(std::max(current_height, right_height) + 1);
+
+			const int current_balance = right_left_left_height - left_height;
+			if (current_balance < -1 || current_balance > 1)
+			{
+				return current;
+			} // else, do_nothing();
+			if ((right_left_left == nullptr || left_height == 0) && current->value.load() == nullptr)
+			{
+				return current;
+			} // else, do_nothing();
+
+			const int right_left_balance = right_height - current_height;
+			if (right_left_balance < -1 || right_left_balance > 1)
+			{
+				return right_left;
+			} // else, do_nothing();
+			return fix_height(parent);
+		}
+	};
+}
+
+#endif // CONCURRENT_AVL_TREE_H_
@@ -0,0 +1,425 @@
+#ifndef DURABLE_AVL_TREE_H_
+#define DURABLE_AVL_TREE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "avl_tree.h"
+#include "frozen_avl_tree.h"
+#include "write_ahead_log.h"
+
+namespace nwacc
+{
+	/**
+	 * An avl_tree that keeps its contents on disk. Every insert, remove
+	 * and assignment through operator[] appends a small record to a write
+	 * ahead log before it returns, and writers that arrive together share
+	 * one write and one sync (see write_ahead_log). From time to time, or
+	 * when asked, a checkpoint saves the whole tree as a frozen_avl_tree
+	 * image and starts the log again, so the log and the time to recover
+	 * stay bounded.
+	 *
+	 * Opening loads the latest snapshot and replays the log after it. A
+	 * record the machine went down in the middle of is dropped, along
+	 * with anything after it.
+	 *
+	 * The files are path + ".snapshot", path + ".wal" and, during a
+	 * checkpoint, path + ".wal.old". Keys and values are written as their
+	 * bytes, so both must be trivially copyable. Every member may be
+	 * called from several threads at once.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Compare orders the keys
+	 */
+	template<typename T, typename K, typename Compare = std::less<K>>
+	class durable_avl_tree
+	{
+		static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+					  "durable_avl_tree needs trivially copyable keys and values");
+
+	public:
+		class value_reference;
+
+		/**
+		 * Open the tree stored at path, or start an empty one there.
+		 * @param path the files are named after this
+		 * @param options when to sync and when to checkpoint
+		 * @param compare
+		 */
+		explicit durable_avl_tree(const std::string &path, const wal_options &options = wal_options(),
+								  const Compare &compare = Compare())
+			: path{ path }, options{ options }, tree{ compare }, log{ path + ".wal", options }
+		{
+			this->recover();
+		}
+
+		durable_avl_tree(const durable_avl_tree &) = delete;
+		durable_avl_tree &operator=(const durable_avl_tree &) = delete;
+
+		/**
+		 * Insert a value at the key, replacing the value already there.
+		 * Returns once the change is in the log.
+		 * @param value
+		 * @param key
+		 */
+		void insert(const T &value, const K &key)
+		{
+			std::uint64_t ticket;
+			{
+				std::unique_lock<std::shared_mutex> guard(this->lock);
+				ticket = this->log_insert(value, key);
+				this->tree.insert(value, key);
+			}
+			this->finish(ticket);
+		}
+
+		/**
+		 * Remove the key and its value. Returns once the change is in the
+		 * log. Nothing is logged for a key that is not there.
+		 * @param key
+		 * @return true if the key was found and removed.
+		 */
+		bool remove(const K &key)
+		{
+			std::uint64_t ticket;
+			{
+				std::unique_lock<std::shared_mutex> guard(this->lock);
+				if (!this->tree.contains(key))
+				{
+					return false;
+				} // else, do_nothing();
+				ticket = this->log_remove(key);
+				this->tree.remove(key);
+			}
+			this->finish(ticket);
+			return true;
+		}
+
+		/**
+		 * Get the value at the key, inserting a default value if the key
+		 * is not in the tree yet. Assigning to the result logs the new
+		 * value.
+		 * @param key
+		 * @return a value_reference to the key.
+		 */
+		value_reference operator[](const K &key)
+		{
+			std::uint64_t ticket = 0;
+			{
+				std::unique_lock<std::shared_mutex> guard(this->lock);
+				if (!this->tree.contains(key))
+				{
+					const T value{};
+					ticket = this->log_insert(value, key);
+					this->tree.insert(value, key);
+				} // else, the key is already there, do_nothing();
+			}
+			if (ticket != 0)
+			{
+				this->finish(ticket);
+			} // else, nothing was logged, do_nothing();
+			return value_reference(this, key);
+		}
+
+		/**
+		 * Determine if the key is in the tree.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		bool contains(const K &key) const
+		{
+			std::shared_lock<std::shared_mutex> guard(this->lock);
+			return this->tree.contains(key);
+		}
+
+		/**
+		 * Get the value associated with a key.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		T get(const K &key) const
+		{
+			std::shared_lock<std::shared_mutex> guard(this->lock);
+			return this->tree.get(key);
+		}
+
+		/**
+		 * @return the number of keys in the tree.
+		 */
+		std::size_t size() const
+		{
+			std::shared_lock<std::shared_mutex> guard(this->lock);
+			return this->tree.size();
+		}
+
+		/**
+		 * Call visit(key, value) for every key in order. Writers wait
+		 * until the walk is done.
+		 * @param visit
+		 */
+		template<typename Visitor>
+		void for_each(Visitor visit) const
+		{
+			std::shared_lock<std::shared_mutex> guard(this->lock);
+			for (auto item = this->tree.first_element(); item != this->tree.end(); ++item)
+			{
+				visit(item.get_key(), static_cast<const T &>(*item));
+			}
+		}
+
+		/**
+		 * Put every logged change on disk now, whatever the sync policy.
+		 */
+		void sync()
+		{
+			std::lock_guard<std::mutex> one_at_a_time(this->checkpointing);
+			this->log.sync();
+		}
+
+		/**
+		 * Save the tree as a snapshot and start the log again. Writers
+		 * wait only while the tree is copied, not while the copy is
+		 * written out. A crash at any point leaves either the old
+		 * snapshot with both logs or the new one; replaying a log over a
+		 * snapshot that already holds its changes gives the same tree.
+		 */
+		void checkpoint()
+		{
+			std::lock_guard<std::mutex> one_at_a_time(this->checkpointing);
+			this->checkpoint_locked();
+		}
+
+#pragma region value_reference
+		/**
+		 * What operator[] returns. It reads like a T and logs every
+		 * assignment as an insert.
+		 */
+		class value_reference
+		{
+		public:
+			/**
+			 * Replace the value and log it.
+			 * @param value
+			 * @return this reference
+			 */
+			value_reference &operator=(const T &value)
+			{
+				this->tree->insert(value, this->key);
+				return *this;
+			}
+
+			/**
+			 * Read the value.
+			 * @return the value
+			 */
+			operator T() const
+			{
+				return this->tree->get(this->key);
+			}
+
+			/**
+			 * Read the value.
+			 * @return the value
+			 */
+			T get() const
+			{
+				return this->tree->get(this->key);
+			}
+
+		private:
+			durable_avl_tree *tree;
+			K key;
+
+			value_reference(durable_avl_tree *tree, const K &key) : tree{ tree }, key{ key } {}
+
+			friend class durable_avl_tree;
+		};
+#pragma endregion
+
+	private:
+		/**
+		 * The first byte of each log record.
+		 */
+		enum record_type : unsigned char
+		{
+			insert_record = 1,
+			remove_record = 2
+		};
+
+		std::string path;
+		wal_options options;
+
+		/**
+		 * Orders writers, so records reach the log in the order the tree
+		 * changes, and lets readers share the tree.
+		 */
+		mutable std::shared_mutex lock;
+
+		avl_tree<T, K, Compare> tree;
+		write_ahead_log log;
+
+		/**
+		 * Lets one checkpoint or sync run at a time.
+		 */
+		std::mutex checkpointing;
+
+		std::string snapshot_path() const
+		{
+			return this->path + ".snapshot";
+		}
+
+		std::string old_log_path() const
+		{
+			return this->path + ".wal.old";
+		}
+
+		/**
+		 * Append an insert record: the type, the key and the value.
+		 * @param value
+		 * @param key
+		 * @return the ticket to commit.
+		 */
+		std::uint64_t log_insert(const T &value, const K &key)
+		{
+			unsigned char record[1 + sizeof(K) + sizeof(T)];
+			record[0] = insert_record;
+			std::memcpy(record + 1, &key, sizeof(K));
+			std::memcpy(record + 1 + sizeof(K), &value, sizeof(T));
+			return this->log.append(record, sizeof(record));
+		}
+
+		/**
+		 * Append a remove record: the type and the key.
+		 * @param key
+		 * @return the ticket to commit.
+		 */
+		std::uint64_t log_remove(const K &key)
+		{
+			unsigned char record[1 + sizeof(K)];
+			record[0] = remove_record;
+			std::memcpy(record + 1, &key, sizeof(K));
+			return this->log.append(record, sizeof(record));
+		}
+
+		/**
+		 * Wait for the record to be committed, then checkpoint if the log
+		 * has grown past checkpoint_bytes and no checkpoint is running.
+		 * @param ticket
+		 */
+		void finish(std::uint64_t ticket)
+		{
+			this->log.commit(ticket);
+			if (this->options.checkpoint_bytes != 0 && this->log.bytes() >= this->options.checkpoint_bytes)
+			{
+				std::unique_lock<std::mutex> one_at_a_time(this->checkpointing, std::try_to_lock);
+				if (one_at_a_time.owns_lock() && this->log.bytes() >= this->options.checkpoint_bytes)
+				{
+					this->checkpoint_locked();
+				} // else, another writer is taking one or just took it, do_nothing();
+			} // else, do_nothing();
+		}
+
+		/**
+		 * The work of checkpoint. checkpointing must be held.
+		 */
+		void checkpoint_locked()
+		{
+			frozen_avl_tree<T, K, Compare> image;
+			{
+				std::shared_lock<std::shared_mutex> guard(this->lock);
+				image = freeze(this->tree);
+				this->log.rotate(this->old_log_path());
+			}
+			this->write_snapshot(image);
+			std::filesystem::remove(this->old_log_path());
+		}
+
+		/**
+		 * Apply a record read back from a log.
+		 * @param record
+		 * @param bytes
+		 */
+		void apply(const char *record, std::size_t bytes)
+		{
+			K key;
+			if (bytes == 1 + sizeof(K) + sizeof(T) && record[0] == insert_record)
+			{
+				T value;
+				std::memcpy(&key, record + 1, sizeof(K));
+				std::memcpy(&value, record + 1 + sizeof(K), sizeof(T));
+				this->tree.insert(value, key);
+			}
+			else if (bytes == 1 + sizeof(K) && record[0] == remove_record)
+			{
+				std::memcpy(&key, record + 1, sizeof(K));
+				this->tree.erase(key);
+			}
+			else
+			{
+				throw std::runtime_error(this->path + " has a log record of an unknown kind");
+			}
+		}
+
+		/**
+		 * Load the snapshot, replay the old log left by a checkpoint that
+		 * did not finish and then the log. If there was anything to
+		 * replay, checkpoint so the next open starts from the snapshot.
+		 */
+		void recover()
+		{
+			if (std::filesystem::exists(this->snapshot_path()))
+			{
+				const auto image = frozen_avl_tree<T, K, Compare>::open_mapped(
+					this->snapshot_path(), true, this->tree.key_comp());
+				std::vector<std::pair<K, T>> pairs;
+				pairs.reserve(image.size());
+				for (auto item = image.first_element(); item != image.end(); ++item)
+				{
+					pairs.emplace_back(item.get_key(), *item);
+				}
+				this->tree.bulk_load(pairs.begin(), pairs.end());
+			} // else, a new tree, do_nothing();
+
+			const bool interrupted = std::filesystem::exists(this->old_log_path());
+			auto apply = [this](const char *record, std::size_t bytes) { this->apply(record, bytes); };
+			if (interrupted)
+			{
+				write_ahead_log::replay(this->old_log_path(), apply);
+			} // else, do_nothing();
+			write_ahead_log::replay(this->path + ".wal", apply);
+
+			if (interrupted || this->log.bytes() != 0)
+			{
+				// nothing else runs yet, so the log can simply start over
+				this->write_snapshot(freeze(this->tree));
+				std::filesystem::remove(this->old_log_path());
+				this->log.reset();
+			} // else, the snapshot is current, do_nothing();
+		}
+
+		/**
+		 * Write image next to the snapshot, put it on disk and rename it
+		 * over the snapshot, so the snapshot is always whole.
+		 * @param image
+		 */
+		void write_snapshot(const frozen_avl_tree<T, K, Compare> &image)
+		{
+			const std::string temporary = this->snapshot_path() + ".tmp";
+			image.save(temporary);
+			log_file::sync_path(temporary);
+			std::filesystem::rename(temporary, this->snapshot_path());
+			log_file::sync_directory(this->snapshot_path());
+		}
+	};
+}
+
+#endif // DURABLE_AVL_TREE_H_
@@ -0,0 +1,772 @@
+#ifndef FROZEN_AVL_TREE_H_
+#define FROZEN_AVL_TREE_H_
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+#include "avl_tree.h"
+#include "checksum.h"
+#include "mapped_file.h"
+#include "prefetch.h"
+
+namespace nwacc
+{
+	/**
+	 * Hands out memory aligned to a 64 byte cache line, so a block of
+	 * frozen_avl_tree keys never straddles two lines.
+	 * @param U the element type
+	 */
+	template<typename U>
+	struct cache_line_allocator
+	{
+		using value_type = U;
+
+		static constexpr std::size_t alignment = 64;
+
+		cache_line_allocator() = default;
+
+		template<typename V>
+		cache_line_allocator(const cache_line_allocator<V> &) noexcept {}
+
+		U *allocate(std::size_t count)
+		{
+			return static_cast<U *>(::operator new(count * sizeof(U), std::align_val_t{ alignment }));
+		}
+
+		void deallocate(U *pointer, std::size_t) noexcept
+		{
+			::operator delete(pointer, std::align_val_t{ alignment });
+		}
+
+		template<typename V>
+		bool operator==(const cache_line_allocator<V> &) const noexcept
+		{
+			return true;
+		}
+
+		template<typename V>
+		bool operator!=(const cache_line_allocator<V> &) const noexcept
+		{
+			return false;
+		}
+	};
+
+	/**
+	 * An immutable copy of an ordered map with no pointers at all: the
+	 * keys sit in one array in Eytzinger (breadth first) order, so the
+	 * top levels every lookup passes through share a few cache lines,
+	 * and a node's children sit at computed positions instead of behind
+	 * pointers. Lookups do the same work for every key, with no branch on
+	 * the comparison to mispredict.
+	 *
+	 * Arithmetic keys are grouped into blocks of one cache line each,
+	 * laid out in Eytzinger order as a tree of fanout block + 1. A lookup
+	 * counts the keys in a block below the one it wants, and that count
+	 * picks the child block, so every level costs one cache line. For
+	 * std::int32_t and std::int64_t keys under std::less the count is an
+	 * AVX2 or SSE2 compare when the target has it. Other keys use blocks
+	 * of one and prefetch the lines four levels below while they compare.
+	 *
+	 * Build one with freeze(tree), or from keys in increasing order.
+	 * With trivially copyable keys and values, save writes the layout to
+	 * a file and open_mapped maps such a file and searches it in place,
+	 * so a saved tree of any size is ready to query as soon as it is
+	 * opened.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Compare orders the keys
+	 */
+	template<typename T, typename K, typename Compare = std::less<K>>
+	class frozen_avl_tree
+	{
+	public:
+		/**
+		 * Keys per block: a cache line of arithmetic keys, or one key.
+		 */
+		static constexpr std::size_t block = std::is_arithmetic<K>::value && sizeof(K) <= 64 ? 64 / sizeof(K) : 1;
+
+	private:
+		static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+		/**
+		 * Slots are stored one place to the right when blocks hold one
+		 * key, so the sixteen descendants four levels below a slot start
+		 * on a cache line boundary whenever the key size is a multiple of
+		 * four, and span no more lines than they must.
+		 */
+		static constexpr std::size_t lead = block == 1 ? 1 : 0;
+
+		/**
+		 * Bytes taken by the sixteen descendants four levels below a slot
+		 * when blocks hold one key; a std::string key spreads them over
+		 * eight cache lines.
+		 */
+		static constexpr std::size_t descendant_bytes = 16 * sizeof(K);
+
+		/**
+		 * Whether the block search can compare a whole block of keys with
+		 * SIMD instructions.
+		 */
+		static constexpr bool signed_less =
+			(std::is_same<Compare, std::less<K>>::value || std::is_same<Compare, std::less<>>::value) &&
+			std::is_integral<K>::value && std::is_signed<K>::value;
+
+		/**
+		 * The arrays of a tree built in memory.
+		 */
+		struct layout
+		{
+			std::vector<K, cache_line_allocator<K>> keys;
+			std::vector<T> values;
+		};
+
+		/**
+		 * Owns the memory the slots live in: a layout, or the mapped_file
+		 * of a saved image. Nothing is ever written through the slots, so
+		 * copies of a frozen tree share it.
+		 */
+		std::shared_ptr<const void> storage;
+
+		/**
+		 * Keys in Eytzinger order of blocks. The slots after the largest
+		 * key in order hold copies of it, so every block is full and the
+		 * search needs no bounds test inside a block.
+		 */
+		const K *key_slots = nullptr;
+
+		/**
+		 * The value of every slot, at the same place as its key.
+		 */
+		const T *value_slots = nullptr;
+
+		/**
+		 * Represents the number of items in the tree.
+		 */
+		std::size_t tree_size = 0;
+
+		/**
+		 * The number of blocks.
+		 */
+		std::size_t blocks = 0;
+
+		/**
+		 * The slots of the smallest and largest keys.
+		 */
+		std::size_t first_slot = npos;
+		std::size_t last_slot = npos;
+
+		/**
+		 * Orders the keys.
+		 */
+		Compare compare;
+
+	public:
+		/**
+		 * Create an empty frozen tree.
+		 */
+		frozen_avl_tree() = default;
+
+		/**
+		 * Create an empty frozen tree that orders its keys with compare.
+		 * @param compare
+		 */
+		explicit frozen_avl_tree(const Compare &compare) : compare{ compare } {}
+
+		/**
+		 * Lay out keys and values, which must be in increasing key order
+		 * with no key repeated.
+		 * @param sorted_keys
+		 * @param sorted_values one for each key
+		 * @param compare
+		 */
+		frozen_avl_tree(std::vector<K> sorted_keys, std::vector<T> sorted_values, const Compare &compare = Compare())
+			: tree_size{ sorted_keys.size() }, compare{ compare }
+		{
+			if (sorted_keys.size() != sorted_values.size())
+			{
+				throw std::invalid_argument("frozen_avl_tree needs one value for each key");
+			} // else, do_nothing();
+
+			for (std::size_t index = 1; index < this->tree_size; index++)
+			{
+				if (!this->compare(sorted_keys[index - 1], sorted_keys[index]))
+				{
+					throw std::invalid_argument("frozen_avl_tree keys are not sorted");
+				} // else, do_nothing();
+			}
+
+			if (this->tree_size == 0)
+			{
+				return;
+			} // else, do_nothing();
+
+			this->blocks = (this->tree_size + block - 1) / block;
+			const std::size_t slots = this->blocks * block + lead;
+			auto built = std::make_shared<layout>();
+			built->keys.assign(slots, sorted_keys.back());
+			built->values.assign(slots, sorted_values.back());
+
+			std::size_t next = 0;
+			this->place(*built, 0, next, sorted_keys, sorted_values);
+			this->key_slots = built->keys.data() + lead;
+			this->value_slots = built->values.data() + lead;
+			this->storage = std::move(built);
+
+			this->first_slot = 0;
+			while (this->child(this->first_slot / block, 0) < this->blocks)
+			{
+				this->first_slot = this->child(this->first_slot / block, 0) * block;
+			}
+		}
+
+		/**
+		 * Determine if the tree has no keys.
+		 * @return true if the tree is empty.
+		 */
+		bool is_empty() const
+		{
+			return this->tree_size == 0;
+		}
+
+		/**
+		 * @return the number of keys in the tree.
+		 */
+		std::size_t size() const
+		{
+			return this->tree_size;
+		}
+
+		/**
+		 * Determine if the key is in the tree.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		bool contains(const K &key) const
+		{
+			return this->find_slot(key) != npos;
+		}
+
+		/**
+		 * Get the value associated with a key.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		T get(const K &key) const
+		{
+			const std::size_t slot = this->find_slot(key);
+			if (slot == npos)
+			{
+				throw std::length_error("Data not Found....");
+			} // else, we found the key, do_nothing();
+			return this->value_slots[slot];
+		}
+
+#pragma region const_iterator
+		class const_iterator
+		{
+		public:
+			/**
+			 * Construct the const_iterator at the end of the tree.
+			 */
+			const_iterator() : tree{ nullptr }, slot{ npos } {}
+
+			/**
+			 * Overload the pointer operator.
+			 * @return the value at the current slot.
+			 */
+			const T &operator*() const
+			{
+				return this->tree->value_slots[this->slot];
+			}
+
+			/**
+			 * Return the current key.
+			 * @return current key.
+			 */
+			const K &get_key() const
+			{
+				return this->tree->key_slots[this->slot];
+			}
+
+			/**
+			 * Move to the next larger key.
+			 * @return const_iterator
+			 */
+			const_iterator &operator++()
+			{
+				this->slot = this->tree->next_slot(this->slot);
+				return *this;
+			}
+
+			/**
+			 * This is the postfix operator.
+			 * @return const_iterator
+			 */
+			const_iterator operator++(int)
+			{
+				auto old = *this;
+				++(*this);
+				return old;
+			}
+
+			bool operator== (const const_iterator &rhs) const
+			{
+				return this->slot == rhs.slot;
+			}
+
+			bool operator!= (const const_iterator &rhs) const
+			{
+				return !(*this == rhs);
+			}
+
+		private:
+			const frozen_avl_tree *tree;
+			std::size_t slot;
+
+			const_iterator(const frozen_avl_tree *tree, std::size_t slot) : tree{ tree }, slot{ slot } {}
+
+			friend class frozen_avl_tree;
+		};
+#pragma endregion
+
+		const_iterator first_element() const
+		{
+			return const_iterator(this, this->first_slot);
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, npos);
+		}
+
+		/**
+		 * Find the key in the tree.
+		 * @param key
+		 * @return an iterator to the key or end() if it is not there.
+		 */
+		const_iterator find(const K &key) const
+		{
+			return const_iterator(this, this->find_slot(key));
+		}
+
+		/**
+		 * Find the first key that is not less than key.
+		 * @param key
+		 * @return an iterator to that key or end() if there is none.
+		 */
+		const_iterator lower_bound(const K &key) const
+		{
+			return const_iterator(this, this->search(key));
+		}
+
+		/**
+		 * Write the tree to path as a binary image: a checksummed header,
+		 * then the key slots and the value slots exactly as they sit in
+		 * memory, each starting on a cache line. open_mapped serves
+		 * lookups straight from such a file. The image is only readable
+		 * on machines with the same byte order and type sizes.
+		 * @param path
+		 */
+		void save(const std::string &path) const
+		{
+			static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+						  "save needs trivially copyable keys and values");
+
+			const std::size_t slots = this->blocks == 0 ? 0 : this->blocks * block + lead;
+			const char *keys = reinterpret_cast<const char *>(this->key_slots - (slots == 0 ? 0 : lead));
+			const char *values = reinterpret_cast<const char *>(this->value_slots - (slots == 0 ? 0 : lead));
+
+			image_header header{};
+			std::memcpy(header.magic, image_magic, sizeof(header.magic));
+			header.version = image_version;
+			header.byte_order = image_byte_order;
+			header.key_bytes = sizeof(K);
+			header.value_bytes = sizeof(T);
+			header.block_keys = block;
+			header.lead_slots = lead;
+			header.count = this->tree_size;
+			header.blocks = this->blocks;
+			header.first_slot = this->first_slot;
+			header.last_slot = this->last_slot;
+			header.slots = slots;
+			header.keys_offset = align_up(sizeof(image_header), cache_line_allocator<K>::alignment);
+			header.values_offset = align_up(header.keys_offset + slots * sizeof(K), cache_line_allocator<K>::alignment);
+			header.file_bytes = header.values_offset + slots * sizeof(T);
+			header.data_checksum = fnv1a_checksum(fnv1a_checksum(fnv1a_seed, keys, slots * sizeof(K)), values, slots * sizeof(T));
+			header.header_checksum = fnv1a_checksum(fnv1a_seed, &header, offsetof(image_header, header_checksum));
+
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			const char padding[cache_line_allocator<K>::alignment] = {};
+			out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			out.write(padding, static_cast<std::streamsize>(header.keys_offset - sizeof(header)));
+			out.write(keys, static_cast<std::streamsize>(slots * sizeof(K)));
+			out.write(padding, static_cast<std::streamsize>(header.values_offset - header.keys_offset - slots * sizeof(K)));
+			out.write(values, static_cast<std::streamsize>(slots * sizeof(T)));
+			out.flush();
+			if (!out)
+			{
+				throw std::runtime_error("could not write " + path);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Map an image written by save and serve lookups and iteration
+		 * from the mapped pages without reading them in first. Opening
+		 * checks the header, so it takes about the same time for any size
+		 * of file. The pages are read as lookups reach them.
+		 * @param path
+		 * @param verify_data also check the checksum of the slots, which
+		 * reads the whole file
+		 * @param compare must order keys as the saved tree did
+		 * @return a frozen tree backed by the file.
+		 */
+		static frozen_avl_tree open_mapped(const std::string &path, bool verify_data = false,
+										   const Compare &compare = Compare())
+		{
+			static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+						  "open_mapped needs trivially copyable keys and values");
+
+			auto file = std::make_shared<mapped_file>(path);
+			image_header header;
+			if (file->size() < sizeof(header))
+			{
+				throw std::runtime_error(path + " is not a frozen_avl_tree image");
+			} // else, do_nothing();
+			std::memcpy(&header, file->data(), sizeof(header));
+
+			if (std::memcmp(header.magic, image_magic, sizeof(header.magic)) != 0 ||
+				header.header_checksum != fnv1a_checksum(fnv1a_seed, &header, offsetof(image_header, header_checksum)))
+			{
+				throw std::runtime_error(path + " is not a frozen_avl_tree image");
+			} // else, do_nothing();
+
+			if (header.version != image_version || header.byte_order != image_byte_order ||
+				header.key_bytes != sizeof(K) || header.value_bytes != sizeof(T) ||
+				header.block_keys != block || header.lead_slots != lead)
+			{
+				throw std::runtime_error(path + " was saved for a different version, machine or type");
+			} // else, do_nothing();
+
+			const bool fits =
+				header.slots == (header.blocks == 0 ? 0 : header.blocks * block + lead) &&
+				header.count <= header.blocks * block && header.count + block > header.blocks * block &&
+				header.keys_offset % cache_line_allocator<K>::alignment == 0 &&
+				header.values_offset % alignof(T) == 0 &&
+				header.keys_offset + header.slots * sizeof(K) <= header.values_offset &&
+				header.values_offset + header.slots * sizeof(T) == header.file_bytes &&
+				header.file_bytes == file->size() &&
+				(header.count == 0 || (header.first_slot < header.blocks * block && header.last_slot < header.blocks * block));
+			if (!fits)
+			{
+				throw std::runtime_error(path + " is damaged");
+			} // else, do_nothing();
+
+			const unsigned char *keys = file->data() + header.keys_offset;
+			const unsigned char *values = file->data() + header.values_offset;
+			if (verify_data &&
+				header.data_checksum !=
+					fnv1a_checksum(fnv1a_checksum(fnv1a_seed, keys, header.slots * sizeof(K)), values, header.slots * sizeof(T)))
+			{
+				throw std::runtime_error(path + " is damaged");
+			} // else, do_nothing();
+
+			frozen_avl_tree tree(compare);
+			tree.tree_size = static_cast<std::size_t>(header.count);
+			tree.blocks = static_cast<std::size_t>(header.blocks);
+			tree.first_slot = header.count == 0 ? npos : static_cast<std::size_t>(header.first_slot);
+			tree.last_slot = header.count == 0 ? npos : static_cast<std::size_t>(header.last_slot);
+			if (header.slots != 0)
+			{
+				tree.key_slots = reinterpret_cast<const K *>(keys) + lead;
+				tree.value_slots = reinterpret_cast<const T *>(values) + lead;
+			} // else, an empty image has no slots, do_nothing();
+			tree.storage = std::move(file);
+			return tree;
+		}
+
+	private:
+		/**
+		 * The fixed size header at the start of a saved image. Sizes and
+		 * offsets are 64 bit on every platform.
+		 */
+		struct image_header
+		{
+			char magic[8];
+			std::uint32_t version;
+			std::uint32_t byte_order;
+			std::uint32_t key_bytes;
+			std::uint32_t value_bytes;
+			std::uint64_t block_keys;
+			std::uint64_t lead_slots;
+			std::uint64_t count;
+			std::uint64_t blocks;
+			std::uint64_t first_slot;
+			std::uint64_t last_slot;
+			std::uint64_t slots;
+			std::uint64_t keys_offset;
+			std::uint64_t values_offset;
+			std::uint64_t file_bytes;
+			std::uint64_t data_checksum;
+			std::uint64_t header_checksum;
+		};
+
+		static constexpr char image_magic[8] = { 'N', 'W', 'F', 'R', 'O', 'Z', 'E', 'N' };
+		static constexpr std::uint32_t image_version = 1;
+
+		/**
+		 * Written as a number, so an image saved with the other byte order
+		 * reads back as a different one.
+		 */
+		static constexpr std::uint32_t image_byte_order = 0x01020304;
+
+		static std::uint64_t align_up(std::uint64_t offset, std::uint64_t alignment)
+		{
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		/**
+		 * The block below child index of parent.
+		 * @param parent
+		 * @param index 0 to block
+		 * @return the child block, which exists if it is below blocks.
+		 */
+		static std::size_t child(std::size_t parent, std::size_t index)
+		{
+			return parent * (block + 1) + index + 1;
+		}
+
+		/**
+		 * Fill the slots of the subtree at current in order, taking keys
+		 * and values from next on.
+		 * @param target
+		 * @param current a block
+		 * @param next the first sorted key not placed yet
+		 * @param sorted_keys
+		 * @param sorted_values
+		 */
+		void place(layout &target, std::size_t current, std::size_t &next, std::vector<K> &sorted_keys,
+				   std::vector<T> &sorted_values)
+		{
+			if (current >= this->blocks)
+			{
+				return;
+			} // else, do_nothing();
+
+			for (std::size_t index = 0; index < block; index++)
+			{
+				this->place(target, child(current, index), next, sorted_keys, sorted_values);
+				if (next < this->tree_size)
+				{
+					const std::size_t slot = current * block + index;
+					target.keys[slot + lead] = std::move(sorted_keys[next]);
+					target.values[slot + lead] = std::move(sorted_values[next]);
+					this->last_slot = slot;
+					next += 1;
+				} // else, the slot keeps its copy of the largest key, do_nothing();
+			}
+			this->place(target, child(current, block), next, sorted_keys, sorted_values);
+		}
+
+		/**
+		 * Count the keys of a block that are less than key.
+		 * @param first the first key of the block
+		 * @param key
+		 * @return the count, 0 to block.
+		 */
+		std::size_t rank_in_block(const K *first, const K &key) const
+		{
+#if defined(__AVX2__)
+			if constexpr (signed_less && sizeof(K) == 4 && block == 16)
+			{
+				const __m256i needle = _mm256_set1_epi32(static_cast<int>(key));
+				const __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i *>(first));
+				const __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i *>(first + 8));
+				const unsigned mask =
+					static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, low)))) |
+					static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, high)))) << 8;
+				return std::bitset<16>(mask).count();
+			}
+			else if constexpr (signed_less && sizeof(K) == 8 && block == 8)
+			{
+				const __m256i needle = _mm256_set1_epi64x(static_cast<long long>(key));
+				const __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i *>(first));
+				const __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i *>(first + 4));
+				const unsigned mask =
+					static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, low)))) |
+					static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, high)))) << 4;
+				return std::bitset<8>(mask).count();
+			}
+			else
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+			if constexpr (signed_less && sizeof(K) == 4 && block == 16)
+			{
+				const __m128i needle = _mm_set1_epi32(static_cast<int>(key));
+				unsigned mask = 0;
+				for (int part = 0; part < 4; part++)
+				{
+					const __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i *>(first + part * 4));
+					mask |= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, chunk)))) << (part * 4);
+				}
+				return std::bitset<16>(mask).count();
+			}
+			else
+#endif
+			{
+				// adding up the comparisons keeps the loop free of branches
+				std::size_t count = 0;
+				for (std::size_t index = 0; index < block; index++)
+				{
+					count += this->compare(first[index], key) ? 1 : 0;
+				}
+				return count;
+			}
+		}
+
+		/**
+		 * Walk from the root block to a leaf, remembering the last slot
+		 * whose key was not less than key. Every lookup walks the same
+		 * number of levels, so the loop has no data dependent branch.
+		 * @param key
+		 * @return the slot of the first key not less than key, or npos.
+		 */
+		std::size_t search(const K &key) const
+		{
+			const K *base = this->key_slots;
+			std::size_t found = npos;
+			std::size_t current = 0;
+			while (current < this->blocks)
+			{
+				if (block == 1 && current * 16 + 15 < this->blocks)
+				{
+					// fetch every line the sixteen slots four levels down span
+					const char *first = reinterpret_cast<const char *>(base + current * 16 + 15);
+					const char *end = reinterpret_cast<const char *>(base + std::min(current * 16 + 31, this->blocks));
+					for (const char *line = first; line < end; line += 64)
+					{
+						prefetch(line);
+					}
+					if (descendant_bytes % 64 != 0)
+					{
+						// the run does not start on a line boundary
+						prefetch(end - 1);
+					} // else, the loop reached the last line, do_nothing();
+				} // else, each level is a single line or the walk ends within four levels, do_nothing();
+
+				const std::size_t rank = this->rank_in_block(base + current * block, key);
+				found = rank < block ? current * block + rank : found;
+				current = child(current, rank);
+			}
+			return found;
+		}
+
+		/**
+		 * Find the slot holding key.
+		 * @param key
+		 * @return the slot, or npos when the key is missing.
+		 */
+		std::size_t find_slot(const K &key) const
+		{
+			const std::size_t slot = this->search(key);
+			if (slot == npos || this->compare(key, this->key_slots[slot]))
+			{
+				return npos;
+			} // else, we found the key, do_nothing();
+			return slot;
+		}
+
+		/**
+		 * Find the slot of the next larger key: the leftmost slot under
+		 * the child that follows this slot, or else the next slot in the
+		 * block, or else the first ancestor slot this subtree sits left of.
+		 * @param slot
+		 * @return the next slot, or npos after the largest key.
+		 */
+		std::size_t next_slot(std::size_t slot) const
+		{
+			if (slot == this->last_slot)
+			{
+				return npos;
+			} // else, do_nothing();
+
+			std::size_t current = slot / block;
+			const std::size_t index = slot % block;
+			std::size_t below = child(current, index + 1);
+			if (below < this->blocks)
+			{
+				while (child(below, 0) < this->blocks)
+				{
+					below = child(below, 0);
+				}
+				return below * block;
+			} // else, do_nothing();
+
+			if (index + 1 < block)
+			{
+				return slot + 1;
+			} // else, the block is done, climb, do_nothing();
+
+			while (current > 0)
+			{
+				const std::size_t from = (current - 1) % (block + 1);
+				current = (current - 1) / (block + 1);
+				if (from < block)
+				{
+					return current * block + from;
+				} // else, we came up from the last child, keep climbing, do_nothing();
+			}
+			return npos;
+		}
+	};
+
+	/**
+	 * Copy an avl_tree into a frozen_avl_tree that orders its keys the
+	 * same way. The copy does not follow later changes to the tree.
+	 * @param tree
+	 * @return the frozen copy.
+	 */
+	template<typename T, typename K, typename Compare, template<typename> class Allocator, typename Options>
+	frozen_avl_tree<T, K, Compare> freeze(const avl_tree<T, K, Compare, Allocator, Options> &tree)
+	{
+		std::vector<K> keys;
+		std::vector<T> values;
+		keys.reserve(tree.size());
+		values.reserve(tree.size());
+		for (auto item = tree.first_element(); item != tree.end(); ++item)
+		{
+			keys.push_back(item.get_key());
+			values.push_back(static_cast<const T &>(*item));
+		}
+		return frozen_avl_tree<T, K, Compare>(std::move(keys), std::move(values), tree.key_comp());
+	}
+
+	/**
+	 * Write an avl_tree to path as a frozen_avl_tree image, which
+	 * frozen_avl_tree::open_mapped can serve lookups from without loading
+	 * it. Needs trivially copyable keys and values, and builds the frozen
+	 * copy in memory first.
+	 * @param tree
+	 * @param path
+	 */
+	template<typename T, typename K, typename Compare, template<typename> class Allocator, typename Options>
+	void save(const avl_tree<T, K, Compare, Allocator, Options> &tree, const std::string &path)
+	{
+		freeze(tree).save(path);
+	}
+}
+
+#endif // FROZEN_AVL_TREE_H_
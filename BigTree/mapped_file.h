@@ -0,0 +1,134 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nwacc
+{
+	/**
+	 * A whole file mapped read only into memory. Pages are read from disk
+	 * the first time they are touched, so opening costs the same for a
+	 * small file and a large one. The mapping lives until the
+	 * mapped_file is destroyed.
+	 */
+	class mapped_file
+	{
+	public:
+		/**
+		 * Map the file at path.
+		 * @param path
+		 */
+		explicit mapped_file(const std::string &path)
+		{
+#if defined(_WIN32)
+			HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+										FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				throw std::runtime_error("could not open " + path);
+			} // else, do_nothing();
+
+			LARGE_INTEGER length;
+			if (!::GetFileSizeEx(file, &length))
+			{
+				::CloseHandle(file);
+				throw std::runtime_error("could not read the size of " + path);
+			} // else, do_nothing();
+			this->length = static_cast<std::size_t>(length.QuadPart);
+
+			if (this->length > 0)
+			{
+				HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping != nullptr)
+				{
+					this->address = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					::CloseHandle(mapping);
+				} // else, do_nothing();
+			} // else, an empty file cannot be mapped, do_nothing();
+			::CloseHandle(file);
+#else
+			const int file = ::open(path.c_str(), O_RDONLY);
+			if (file < 0)
+			{
+				throw std::runtime_error("could not open " + path);
+			} // else, do_nothing();
+
+			struct stat status;
+			if (::fstat(file, &status) != 0)
+			{
+				::close(file);
+				throw std::runtime_error("could not read the size of " + path);
+			} // else, do_nothing();
+			this->length = static_cast<std::size_t>(status.st_size);
+
+			if (this->length > 0)
+			{
+				void *mapped = ::mmap(nullptr, this->length, PROT_READ, MAP_SHARED, file, 0);
+				if (mapped != MAP_FAILED)
+				{
+					this->address = mapped;
+				} // else, do_nothing();
+			} // else, an empty file cannot be mapped, do_nothing();
+			::close(file);
+#endif
+			if (this->length > 0 && this->address == nullptr)
+			{
+				throw std::runtime_error("could not map " + path);
+			} // else, do_nothing();
+		}
+
+		mapped_file(const mapped_file &) = delete;
+		mapped_file &operator=(const mapped_file &) = delete;
+
+		~mapped_file()
+		{
+			if (this->address != nullptr)
+			{
+#if defined(_WIN32)
+				::UnmapViewOfFile(this->address);
+#else
+				::munmap(this->address, this->length);
+#endif
+			} // else, nothing was mapped, do_nothing();
+		}
+
+		/**
+		 * @return the first byte of the file.
+		 */
+		const unsigned char *data() const
+		{
+			return static_cast<const unsigned char *>(this->address);
+		}
+
+		/**
+		 * @return the length of the file in bytes.
+		 */
+		std::size_t size() const
+		{
+			return this->length;
+		}
+
+	private:
+		void *address = nullptr;
+		std::size_t length = 0;
+	};
+}
+
+#endif // MAPPED_FILE_H_
@@ -0,0 +1,266 @@
+#ifndef NODE_POOL_H_
+#define NODE_POOL_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace nwacc
+{
+	/**
+	 * A slab allocator for fixed size tree nodes. Nodes are carved out of
+	 * large slabs and removed nodes are kept on a free list so they can be
+	 * handed out again without going back to the heap. Every slab is given
+	 * back in one pass when the pool is released or destroyed.
+	 *
+	 * The pool follows the std::allocator interface so it can be used as the
+	 * Allocator argument of avl_tree. Unlike std::allocator it is stateful and
+	 * a copy starts out with its own, empty set of slabs.
+	 */
+	template<typename U>
+	class node_pool
+	{
+	public:
+		using value_type = U;
+
+		/**
+		 * Build an empty pool. No memory is taken until the first allocate.
+		 */
+		node_pool() noexcept = default;
+
+		/**
+		 * A copied pool does not share slabs with the original.
+		 */
+		node_pool(const node_pool &) noexcept : node_pool() {}
+
+		/**
+		 * Take ownership of every slab held by rhs.
+		 * @param rhs
+		 */
+		node_pool(node_pool &&rhs) noexcept
+			: slabs{ rhs.slabs }, free_list{ rhs.free_list },
+			next_slot{ rhs.next_slot }, slab_end{ rhs.slab_end }
+		{
+			rhs.slabs = nullptr;
+			rhs.free_list = nullptr;
+			rhs.next_slot = nullptr;
+			rhs.slab_end = nullptr;
+		}
+
+		/**
+		 * Release every slab back to the heap.
+		 */
+		~node_pool()
+		{
+			this->release();
+		}
+
+		node_pool &operator=(const node_pool &) = delete;
+
+		/**
+		 * Release our slabs and take ownership of the slabs held by rhs.
+		 * @param rhs
+		 */
+		node_pool &operator=(node_pool &&rhs) noexcept
+		{
+			if (this != &rhs)
+			{
+				this->release();
+				std::swap(this->slabs, rhs.slabs);
+				std::swap(this->free_list, rhs.free_list);
+				std::swap(this->next_slot, rhs.next_slot);
+				std::swap(this->slab_end, rhs.slab_end);
+			} // else, self assignment, do_nothing();
+			return *this;
+		}
+
+		/**
+		 * Hand out storage for count objects. Single objects come from the
+		 * free list first, then from the current slab. Anything larger goes
+		 * straight to the heap.
+		 * @param count
+		 * @return uninitialized storage for count objects.
+		 */
+		U *allocate(std::size_t count)
+		{
+			if (count != 1)
+			{
+				return static_cast<U *>(::operator new(count * sizeof(U)));
+			} // else, a single node, take it from the pool do_nothing();
+
+			if (this->free_list != nullptr)
+			{
+				slot *reused = this->free_list;
+				this->free_list = reused->next;
+				return reinterpret_cast<U *>(reused);
+			} // else, nothing to reuse, do_nothing();
+
+			if (this->next_slot == this->slab_end)
+			{
+				this->grow();
+			} // else, the current slab still has room, do_nothing();
+
+			return reinterpret_cast<U *>(this->next_slot++);
+		}
+
+		/**
+		 * Return storage obtained from allocate. Single objects are pushed
+		 * on the free list and stay owned by the pool.
+		 * @param value
+		 * @param count
+		 */
+		void deallocate(U *value, std::size_t count) noexcept
+		{
+			if (count != 1)
+			{
+				::operator delete(value);
+				return;
+			} // else, a pooled node, do_nothing();
+
+			slot *freed = reinterpret_cast<slot *>(value);
+			freed->next = this->free_list;
+			this->free_list = freed;
+		}
+
+		/**
+		 * Give every slab back to the heap at once. Any object still living
+		 * in the pool must already be destroyed.
+		 */
+		void release() noexcept
+		{
+			while (this->slabs != nullptr)
+			{
+				slab *old_slab = this->slabs;
+				this->slabs = old_slab->next;
+				::operator delete(old_slab);
+			}
+			this->free_list = nullptr;
+			this->next_slot = nullptr;
+			this->slab_end = nullptr;
+		}
+
+		/**
+		 * Take over every slab held by rhs, so the objects rhs handed out
+		 * now belong to this pool. rhs is left empty. Free and not yet
+		 * carved slots of rhs join our free list.
+		 * @param rhs
+		 */
+		void adopt(node_pool &rhs) noexcept
+		{
+			if (this == &rhs || rhs.slabs == nullptr)
+			{
+				return;
+			} // else, there are slabs to take, do_nothing();
+
+			slab *last = rhs.slabs;
+			while (last->next != nullptr)
+			{
+				last = last->next;
+			}
+			last->next = this->slabs;
+			this->slabs = rhs.slabs;
+
+			while (rhs.free_list != nullptr)
+			{
+				slot *moved = rhs.free_list;
+				rhs.free_list = moved->next;
+				moved->next = this->free_list;
+				this->free_list = moved;
+			}
+			while (rhs.next_slot != rhs.slab_end)
+			{
+				slot *moved = rhs.next_slot++;
+				moved->next = this->free_list;
+				this->free_list = moved;
+			}
+
+			rhs.slabs = nullptr;
+			rhs.next_slot = nullptr;
+			rhs.slab_end = nullptr;
+		}
+
+		friend void swap(node_pool &lhs, node_pool &rhs) noexcept
+		{
+			std::swap(lhs.slabs, rhs.slabs);
+			std::swap(lhs.free_list, rhs.free_list);
+			std::swap(lhs.next_slot, rhs.next_slot);
+			std::swap(lhs.slab_end, rhs.slab_end);
+		}
+
+		bool operator==(const node_pool &rhs) const noexcept
+		{
+			return this == &rhs;
+		}
+
+		bool operator!=(const node_pool &rhs) const noexcept
+		{
+			return !(*this == rhs);
+		}
+
+	private:
+		/**
+		 * One node worth of storage. While a slot is free it holds the link
+		 * to the next free slot instead of a node.
+		 */
+		union slot
+		{
+			slot *next;
+			alignas(U) unsigned char storage[sizeof(U)];
+		};
+
+		/**
+		 * Number of slots carved from a single slab, about 64KB worth.
+		 */
+		static constexpr std::size_t slots_per_slab =
+			(64 * 1024) / sizeof(slot) > 16 ? (64 * 1024) / sizeof(slot) : 16;
+
+		/**
+		 * A block of slots, linked to the slab allocated before it.
+		 */
+		struct slab
+		{
+			slab *next;
+			slot slots[slots_per_slab];
+		};
+
+		slab *slabs = nullptr;
+		slot *free_list = nullptr;
+		slot *next_slot = nullptr;
+		slot *slab_end = nullptr;
+
+		/**
+		 * Allocate a fresh slab and start carving slots from it.
+		 */
+		void grow()
+		{
+			slab *fresh = static_cast<slab *>(::operator new(sizeof(slab)));
+			fresh->next = this->slabs;
+			this->slabs = fresh;
+			this->next_slot = fresh->slots;
+			this->slab_end = fresh->slots + slots_per_slab;
+		}
+	};
+
+	/**
+	 * Allocators that can drop every node at once when the tree is torn
+	 * down. For these the tree skips the per node deallocate.
+	 */
+	template<typename Allocator>
+	struct releases_in_bulk : std::false_type {};
+
+	template<typename U>
+	struct releases_in_bulk<node_pool<U>> : std::true_type {};
+
+	/**
+	 * Allocators that can take over the storage of another instance, so
+	 * nodes can move from one tree to another without being copied.
+	 */
+	template<typename Allocator>
+	struct adopts_storage : std::false_type {};
+
+	template<typename U>
+	struct adopts_storage<node_pool<U>> : std::true_type {};
+}
+
+#endif // NODE_POOL_H_
@@ -0,0 +1,637 @@
+#ifndef PERSISTENT_AVL_TREE_H_
+#define PERSISTENT_AVL_TREE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace nwacc
+{
+	/**
+	 * The persistent mode of avl_tree. Nodes are never changed once they
+	 * are built: insert and remove copy only the O(log n) nodes on the
+	 * path they walk and share every other subtree with the version
+	 * before. snapshot() hands out the current version in O(1) as a
+	 * reference counted, read only snapshot_view.
+	 *
+	 * One thread writes at a time; the caller serializes writers. Any
+	 * number of threads may take snapshots while it does and read them
+	 * with no locks at all, since nothing they can reach ever changes. A
+	 * node is freed when the last version that uses it is released.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Compare orders the keys
+	 */
+	template<typename T, typename K, typename Compare = std::less<K>>
+	class persistent_avl_tree
+	{
+	private:
+		struct node;
+
+		using node_ptr = std::shared_ptr<const node>;
+
+		/**
+		 * A node of one or more versions of the tree. There is no parent
+		 * pointer because a node can have a different parent in every
+		 * version that shares it.
+		 */
+		struct node
+		{
+			T element;
+			K key;
+			node_ptr left;
+			node_ptr right;
+			int height;
+
+			template<typename V, typename Key>
+			node(V &&the_element, Key &&the_key, node_ptr the_left, node_ptr the_right, int the_height)
+				: element(std::forward<V>(the_element)), key(std::forward<Key>(the_key)),
+				left{ std::move(the_left) }, right{ std::move(the_right) }, height{ the_height } {}
+		};
+
+		/**
+		 * The deepest path an iterator may need to stack. An AVL tree of n
+		 * nodes is at most 1.44 log2(n) deep.
+		 */
+		static constexpr int max_depth = 96;
+
+		/**
+		 * One published version: its root and the number of keys under
+		 * it. Neither changes once the version is built, so a reader that
+		 * loads it sees a size that matches its root.
+		 */
+		struct version
+		{
+			node_ptr root;
+			std::size_t tree_size;
+
+			version(node_ptr the_root, std::size_t the_size) : root{ std::move(the_root) }, tree_size{ the_size } {}
+		};
+
+		using version_ptr = std::shared_ptr<const version>;
+
+		/**
+		 * The current version. Writers publish a new one and readers load
+		 * it, both atomically.
+		 */
+		version_ptr current = std::make_shared<const version>(nullptr, 0);
+
+		/**
+		 * Orders the keys.
+		 */
+		Compare compare;
+
+	public:
+#pragma region snapshot_view
+		/**
+		 * One read only version of the tree. Copying a snapshot_view only
+		 * bumps a reference count, and every node it can reach stays
+		 * alive until it is destroyed.
+		 */
+		class snapshot_view
+		{
+		public:
+			/**
+			 * Walks a version in key order. The iterator keeps the path
+			 * from the root on a small stack, so it stays valid as long as
+			 * the snapshot_view it came from.
+			 */
+			class const_iterator
+			{
+			public:
+				/**
+				 * Construct the const_iterator at the end of the tree.
+				 */
+				const_iterator() = default;
+
+				/**
+				 * Overload the pointer operator.
+				 * @return the value at the current node.
+				 */
+				const T &operator*() const
+				{
+					return this->path[this->depth - 1]->element;
+				}
+
+				/**
+				 * Return the current key.
+				 * @return current key.
+				 */
+				const K &get_key() const
+				{
+					return this->path[this->depth - 1]->key;
+				}
+
+				/**
+				 * Move to the next larger key.
+				 * @return const_iterator
+				 */
+				const_iterator &operator++()
+				{
+					const node *current = this->path[--this->depth];
+					this->push_left(current->right.get());
+					return *this;
+				}
+
+				/**
+				 * This is the postfix operator.
+				 * @return const_iterator
+				 */
+				const_iterator operator++(int)
+				{
+					auto old = *this;
+					++(*this);
+					return old;
+				}
+
+				bool operator== (const const_iterator &rhs) const
+				{
+					if (this->depth == 0 || rhs.depth == 0)
+					{
+						return this->depth == rhs.depth;
+					} // else, both point at a node, do_nothing();
+					return this->path[this->depth - 1] == rhs.path[rhs.depth - 1];
+				}
+
+				bool operator!= (const const_iterator &rhs) const
+				{
+					return !(*this == rhs);
+				}
+
+			private:
+				/**
+				 * Every node still to be visited whose left subtree is
+				 * done. The top of the stack is the current node.
+				 */
+				const node *path[max_depth];
+				int depth = 0;
+
+				/**
+				 * Stack current and its chain of left children.
+				 * @param current
+				 */
+				void push_left(const node *current)
+				{
+					while (current != nullptr)
+					{
+						this->path[this->depth++] = current;
+						current = current->left.get();
+					}
+				}
+
+				friend class snapshot_view;
+			};
+
+			/**
+			 * Construct an empty snapshot.
+			 */
+			snapshot_view() = default;
+
+			/**
+			 * Determine if this version has no nodes.
+			 * @return true if the root is equal to a null pointer.
+			 */
+			bool is_empty() const
+			{
+				return this->root == nullptr;
+			}
+
+			/**
+			 * @return the number of keys in this version.
+			 */
+			std::size_t size() const
+			{
+				return this->tree_size;
+			}
+
+			/**
+			 * Determine if the key is in this version.
+			 * @param key
+			 * @return true if the key is in this version.
+			 */
+			bool contains(const K &key) const
+			{
+				return persistent_avl_tree::find_node(this->root.get(), key, this->compare) != nullptr;
+			}
+
+			/**
+			 * Get the value associated with a key.
+			 * If the key does not exist in this version throw an exception.
+			 * @param key
+			 */
+			const T &get(const K &key) const
+			{
+				const node *found = persistent_avl_tree::find_node(this->root.get(), key, this->compare);
+				if (found == nullptr)
+				{
+					throw std::length_error("Data not Found....");
+				} // else, we found the key, do_nothing();
+				return found->element;
+			}
+
+			/**
+			 * Return a const_iterator at the smallest key.
+			 * @return const_iterator
+			 */
+			const_iterator begin() const
+			{
+				const_iterator first;
+				first.push_left(this->root.get());
+				return first;
+			}
+
+			/**
+			 * Return a const_iterator past the largest key.
+			 * @return const_iterator
+			 */
+			const_iterator end() const
+			{
+				return const_iterator();
+			}
+
+			/**
+			 * Return a const_iterator at the first key not less than key.
+			 * @param key
+			 * @return const_iterator
+			 */
+			const_iterator lower_bound(const K &key) const
+			{
+				const_iterator found;
+				const node *current = this->root.get();
+				while (current != nullptr)
+				{
+					if (this->compare(current->key, key))
+					{
+						current = current->right.get();
+					}
+					else
+					{
+						found.path[found.depth++] = current;
+						current = current->left.get();
+					}
+				}
+				return found;
+			}
+
+		private:
+			node_ptr root;
+			std::size_t tree_size = 0;
+			Compare compare;
+
+			snapshot_view(const version &published, const Compare &compare)
+				: root{ published.root }, tree_size{ published.tree_size }, compare{ compare } {}
+
+			friend class persistent_avl_tree;
+		};
+#pragma endregion
+
+		/**
+		 * Create an empty tree.
+		 */
+		persistent_avl_tree() = default;
+
+		/**
+		 * Create an empty tree that orders its keys with compare.
+		 * @param compare
+		 */
+		explicit persistent_avl_tree(const Compare &compare) : compare{ compare } {}
+
+		/**
+		 * Start from a copy of another tree's current version. No node is
+		 * copied; both trees share them until one of them writes.
+		 * @param rhs
+		 */
+		persistent_avl_tree(const persistent_avl_tree &rhs)
+			: current{ std::atomic_load(&rhs.current) }, compare{ rhs.compare } {}
+
+		persistent_avl_tree &operator=(const persistent_avl_tree &rhs)
+		{
+			if (this != &rhs)
+			{
+				this->publish(std::atomic_load(&rhs.current));
+				this->compare = rhs.compare;
+			} // else, self assignment, do_nothing();
+			return *this;
+		}
+
+		/**
+		 * Hand out the current version. This costs one reference count
+		 * increment whatever the size of the tree, and the version stays
+		 * readable however the tree changes afterwards. Its size always
+		 * matches its keys, since both come from one published version.
+		 * @return a read only view of the current version.
+		 */
+		snapshot_view snapshot() const
+		{
+			return snapshot_view(*std::atomic_load(&this->current), this->compare);
+		}
+
+		/**
+		 * Determine if the current version has no nodes.
+		 * @return true if the root is equal to a null pointer.
+		 */
+		bool is_empty() const
+		{
+			return std::atomic_load(&this->current)->root == nullptr;
+		}
+
+		/**
+		 * @return the number of keys in the current version.
+		 */
+		std::size_t size() const
+		{
+			return std::atomic_load(&this->current)->tree_size;
+		}
+
+		/**
+		 * Determine if the key is in the current version.
+		 * @param key
+		 * @return true if the key is in the tree.
+		 */
+		bool contains(const K &key) const
+		{
+			const version_ptr latest = std::atomic_load(&this->current);
+			return find_node(latest->root.get(), key, this->compare) != nullptr;
+		}
+
+		/**
+		 * Get the value associated with a key in the current version.
+		 * If the key does not exist in the tree throw an exception.
+		 * @param key
+		 */
+		T get(const K &key) const
+		{
+			const version_ptr latest = std::atomic_load(&this->current);
+			const node *found = find_node(latest->root.get(), key, this->compare);
+			if (found == nullptr)
+			{
+				throw std::length_error("Data not Found....");
+			} // else, we found the key, do_nothing();
+			return found->element;
+		}
+
+		/**
+		 * Insert the value at the key, or replace the value if the key is
+		 * already in the tree. Only the path down to the key is copied.
+		 * @param value
+		 * @param key
+		 * @return true if the key was not in the tree before.
+		 */
+		bool insert(const T &value, const K &key)
+		{
+			bool inserted = false;
+			const version_ptr latest = std::atomic_load(&this->current);
+			node_ptr updated = this->insert(latest->root, value, key, inserted);
+			this->publish(std::move(updated), latest->tree_size + (inserted ? 1 : 0));
+			return inserted;
+		}
+
+		/**
+		 * Remove the value referenced by the key. Only the path down to
+		 * the key is copied, and nothing is copied when it is missing.
+		 * @param key
+		 * @return true if the key was found and removed.
+		 */
+		bool remove(const K &key)
+		{
+			bool removed = false;
+			const version_ptr latest = std::atomic_load(&this->current);
+			node_ptr updated = this->remove(latest->root, key, removed);
+			if (removed)
+			{
+				this->publish(std::move(updated), latest->tree_size - 1);
+			} // else, the key is missing, do_nothing();
+			return removed;
+		}
+
+		/**
+		 * Drop the current version. Nodes still used by a snapshot stay
+		 * alive with it.
+		 */
+		void empty()
+		{
+			this->publish(nullptr, 0);
+		}
+
+	private:
+		/**
+		 * Make the new version visible to readers, its root and size in
+		 * one atomic store.
+		 * @param updated
+		 * @param tree_size
+		 */
+		void publish(node_ptr updated, std::size_t tree_size)
+		{
+			this->publish(std::make_shared<const version>(std::move(updated), tree_size));
+		}
+
+		/**
+		 * Make a version that is already built visible to readers.
+		 * @param latest
+		 */
+		void publish(version_ptr latest)
+		{
+			std::atomic_store(&this->current, std::move(latest));
+		}
+
+		/**
+		 * Finds the node holding key.
+		 * @param current
+		 * @param key
+		 * @param compare
+		 * @return the node or a null pointer.
+		 */
+		static const node *find_node(const node *current, const K &key, const Compare &compare)
+		{
+			while (current != nullptr)
+			{
+				if (compare(key, current->key))
+				{
+					current = current->left.get();
+				}
+				else if (compare(current->key, key))
+				{
+					current = current->right.get();
+				}
+				else
+				{
+					return current;
+				}
+			}
+			return nullptr;
+		}
+
+		/**
+		 * Finds the height of the current tree.
+		 * @param current
+		 * @return the height of the current tree.
+		 */
+		static int height(const node_ptr &current)
+		{
+			return current == nullptr ? -1 : current->height;
+		}
+
+		/**
+		 * Build a new node over two subtrees that are already balanced
+		 * against each other.
+		 * @param element
+		 * @param key
+		 * @param left
+		 * @param right
+		 * @return the new node.
+		 */
+		template<typename V, typename Key>
+		static node_ptr make_node(V &&element, Key &&key, node_ptr left, node_ptr right)
+		{
+			const int new_height = std::max(height(left), height(right)) + 1;
+			return std::make_shared<const node>(std::forward<V>(element), std::forward<Key>(key),
+												std::move(left), std::move(right), new_height);
+		}
+
+		/**
+		 * Build a new node over two subtrees whose heights differ by at
+		 * most two, rotating with new nodes where avl_tree would rotate in
+		 * place. The old nodes are left as they were for older versions.
+		 * @param element
+		 * @param key
+		 * @param left
+		 * @param right
+		 * @return the root of the balanced subtree.
+		 */
+		template<typename V, typename Key>
+		static node_ptr balance(V &&element, Key &&key, node_ptr left, node_ptr right)
+		{
+			if (height(left) - height(right) > 1)
+			{
+				if (height(left->left) >= height(left->right))
+				{
+					// rotate with left child
+					return make_node(left->element, left->key, left->left,
+									 make_node(std::forward<V>(element), std::forward<Key>(key), left->right, std::move(right)));
+				}
+				else
+				{
+					// double with left child
+					const node_ptr &middle = left->right;
+					return make_node(middle->element, middle->key,
+									 make_node(left->element, left->key, left->left, middle->left),
+									 make_node(std::forward<V>(element), std::forward<Key>(key), middle->right, std::move(right)));
+				}
+			}
+			else if (height(right) - height(left) > 1)
+			{
+				if (height(right->right) >= height(right->left))
+				{
+					// rotate with right child
+					return make_node(right->element, right->key,
+									 make_node(std::forward<V>(element), std::forward<Key>(key), std::move(left), right->left),
+									 right->right);
+				}
+				else
+				{
+					// double with right child
+					const node_ptr &middle = right->left;
+					return make_node(middle->element, middle->key,
+									 make_node(std::forward<V>(element), std::forward<Key>(key), std::move(left), middle->left),
+									 make_node(right->element, right->key, middle->right, right->right));
+				}
+			} // else, already balanced, do_nothing();
+
+			return make_node(std::forward<V>(element), std::forward<Key>(key), std::move(left), std::move(right));
+		}
+
+		/**
+		 * Copy the path down to key and insert or replace the value. The
+		 * recursion is as deep as the tree, at most 1.44 log2(n).
+		 * @param current
+		 * @param value
+		 * @param key
+		 * @param inserted set when the key is new
+		 * @return the root of the new version of this subtree.
+		 */
+		node_ptr insert(const node_ptr &current, const T &value, const K &key, bool &inserted) const
+		{
+			if (current == nullptr)
+			{
+				inserted = true;
+				return make_node(value, key, nullptr, nullptr);
+			}
+			else if (this->compare(key, current->key))
+			{
+				return balance(current->element, current->key,
+							   this->insert(current->left, value, key, inserted), current->right);
+			}
+			else if (this->compare(current->key, key))
+			{
+				return balance(current->element, current->key,
+							   current->left, this->insert(current->right, value, key, inserted));
+			}
+			else
+			{
+				return make_node(value, current->key, current->left, current->right);
+			}
+		}
+
+		/**
+		 * Copy the path down to key and leave the key out. A subtree that
+		 * does not hold the key is returned as it is.
+		 * @param current
+		 * @param key
+		 * @param removed set when the key was found
+		 * @return the root of the new version of this subtree.
+		 */
+		node_ptr remove(const node_ptr &current, const K &key, bool &removed) const
+		{
+			if (current == nullptr)
+			{
+				return nullptr;
+			}
+			else if (this->compare(key, current->key))
+			{
+				node_ptr left = this->remove(current->left, key, removed);
+				return removed ? balance(current->element, current->key, std::move(left), current->right) : current;
+			}
+			else if (this->compare(current->key, key))
+			{
+				node_ptr right = this->remove(current->right, key, removed);
+				return removed ? balance(current->element, current->key, current->left, std::move(right)) : current;
+			} // else, this is the node to remove, do_nothing();
+
+			removed = true;
+			if (current->left == nullptr)
+			{
+				return current->right;
+			}
+			else if (current->right == nullptr)
+			{
+				return current->left;
+			} // else, two children, the successor takes its place, do_nothing();
+
+			const node *successor = current->right.get();
+			while (successor->left != nullptr)
+			{
+				successor = successor->left.get();
+			}
+			return balance(successor->element, successor->key, current->left, remove_min(current->right));
+		}
+
+		/**
+		 * Copy the path down to the smallest key and leave it out.
+		 * @param current
+		 * @return the root of the new version of this subtree.
+		 */
+		static node_ptr remove_min(const node_ptr &current)
+		{
+			if (current->left == nullptr)
+			{
+				return current->right;
+			} // else, keep going left, do_nothing();
+			return balance(current->element, current->key, remove_min(current->left), current->right);
+		}
+	};
+}
+
+#endif // PERSISTENT_AVL_TREE_H_
@@ -0,0 +1,26 @@
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+#if !defined(__GNUC__) && !defined(__clang__) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <xmmintrin.h>
+#endif
+
+namespace nwacc
+{
+	/**
+	 * Ask for the cache line holding address ahead of time.
+	 * @param address
+	 */
+	inline void prefetch(const void *address)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(address);
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		_mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#else
+		(void)address;
+#endif
+	}
+}
+
+#endif // PREFETCH_H_
@@ -0,0 +1,362 @@
+#ifndef SHARDED_AVL_MAP_H_
+#define SHARDED_AVL_MAP_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "avl_tree.h"
+
+namespace nwacc
+{
+	/**
+	 * Sends each key to a shard by its hash. Keys spread evenly whatever
+	 * their order, so writers on different keys rarely meet.
+	 * @param K the key type
+	 * @param Hash hashes the keys
+	 */
+	template<typename K, typename Hash = std::hash<K>>
+	struct hash_partition
+	{
+		Hash hash;
+
+		std::size_t operator()(const K &key, std::size_t shards) const
+		{
+			return this->hash(key) % shards;
+		}
+	};
+
+	/**
+	 * Sends each key to a shard by where it falls among a sorted list of
+	 * split keys: shard i holds the keys from bounds[i - 1] up to but not
+	 * including bounds[i]. Neighbouring keys share a shard, which suits
+	 * range scans over keys that are written together.
+	 * @param K the key type
+	 * @param Compare orders the keys, as it does in the shards
+	 */
+	template<typename K, typename Compare = std::less<K>>
+	struct range_partition
+	{
+		std::vector<K> bounds;
+		Compare compare;
+
+		range_partition() = default;
+
+		/**
+		 * @param bounds sorted split keys, one fewer than the shards
+		 * @param compare
+		 */
+		explicit range_partition(std::vector<K> bounds, const Compare &compare = Compare())
+			: bounds{ std::move(bounds) }, compare{ compare } {}
+
+		std::size_t operator()(const K &key, std::size_t shards) const
+		{
+			const std::size_t index = static_cast<std::size_t>(
+				std::upper_bound(this->bounds.begin(), this->bounds.end(), key, this->compare) - this->bounds.begin());
+			return std::min(index, shards - 1);
+		}
+	};
+
+	/**
+	 * A map split over N avl_tree shards, each behind its own reader/writer
+	 * lock. A single key operation locks only the shard its key belongs
+	 * to, so threads working on different shards never wait on each
+	 * other. This is the simple alternative to concurrent_avl_tree: the
+	 * trees themselves are the ordinary single threaded ones.
+	 *
+	 * Ordered walks lock every shard for reading, in shard order, and
+	 * merge the shards with a k-way merge. Writers wait until the walk
+	 * is done.
+	 * @param K the key type
+	 * @param V the value type
+	 * @param N the number of shards
+	 * @param Partition picks the shard of a key, hash_partition by default
+	 * @param Compare orders the keys inside each shard and in merged walks
+	 */
+	template<typename K, typename V, std::size_t N, typename Partition = hash_partition<K>,
+			 typename Compare = std::less<K>>
+	class sharded_avl_map
+	{
+		static_assert(N > 0, "sharded_avl_map needs at least one shard");
+
+	private:
+		using tree_type = avl_tree<V, K, Compare>;
+		using tree_iterator = typename tree_type::iterator;
+
+		/**
+		 * One tree and its lock. Each shard sits on its own cache line so
+		 * writers on neighbouring shards do not bounce a line between
+		 * them.
+		 */
+		struct alignas(64) shard
+		{
+			mutable std::shared_mutex lock;
+			tree_type tree;
+		};
+
+		/**
+		 * Where the k-way merge stands in one shard. The key is kept as a
+		 * pointer so the heap can compare cursors without touching the
+		 * iterator.
+		 */
+		struct cursor
+		{
+			tree_iterator current;
+			const K *key;
+			std::size_t index;
+		};
+
+		std::array<shard, N> shards;
+
+		/**
+		 * Picks the shard of a key.
+		 */
+		Partition partition;
+
+		/**
+		 * Orders the keys of different shards during a merge.
+		 */
+		Compare compare;
+
+	public:
+		/**
+		 * Create an empty map.
+		 */
+		sharded_avl_map() = default;
+
+		/**
+		 * Create an empty map with the given partition and key order.
+		 * @param partition
+		 * @param compare
+		 */
+		explicit sharded_avl_map(const Partition &partition, const Compare &compare = Compare())
+			: partition{ partition }, compare{ compare } {}
+
+		sharded_avl_map(const sharded_avl_map &) = delete;
+		sharded_avl_map &operator=(const sharded_avl_map &) = delete;
+
+		/**
+		 * Insert the value at the key, or replace the value if the key is
+		 * already in the map. Locks only the shard of the key.
+		 * @param value
+		 * @param key
+		 */
+		void insert(const V &value, const K &key)
+		{
+			shard &target = this->shard_for(key);
+			std::unique_lock<std::shared_mutex> guard(target.lock);
+			target.tree.insert(value, key);
+		}
+
+		/**
+		 * Remove the key and its value. Locks only the shard of the key.
+		 * @param key
+		 * @return true if the key was found and removed.
+		 */
+		bool remove(const K &key)
+		{
+			shard &target = this->shard_for(key);
+			std::unique_lock<std::shared_mutex> guard(target.lock);
+			return target.tree.erase(key) != 0;
+		}
+
+		/**
+		 * Determine if the key is in the map.
+		 * @param key
+		 * @return true if the key is in the map.
+		 */
+		bool contains(const K &key) const
+		{
+			const shard &target = this->shard_for(key);
+			std::shared_lock<std::shared_mutex> guard(target.lock);
+			return target.tree.contains(key);
+		}
+
+		/**
+		 * Get the value associated with a key.
+		 * If the key does not exist in the map throw an exception.
+		 * @param key
+		 */
+		V get(const K &key) const
+		{
+			const shard &target = this->shard_for(key);
+			std::shared_lock<std::shared_mutex> guard(target.lock);
+			return target.tree.get(key);
+		}
+
+		/**
+		 * Copy the value associated with a key into value.
+		 * @param key
+		 * @param value left alone when the key is missing
+		 * @return true if the key was found.
+		 */
+		bool try_get(const K &key, V &value) const
+		{
+			const shard &target = this->shard_for(key);
+			std::shared_lock<std::shared_mutex> guard(target.lock);
+			tree_iterator found = target.tree.find(key);
+			if (found == target.tree.end())
+			{
+				return false;
+			} // else, we found the key, do_nothing();
+			value = *found;
+			return true;
+		}
+
+		/**
+		 * Count the keys. Each shard is counted under its own lock, so
+		 * with writers running the total may never have held at any one
+		 * moment.
+		 * @return the number of keys in the map.
+		 */
+		std::size_t size() const
+		{
+			std::size_t total = 0;
+			for (const shard &current : this->shards)
+			{
+				std::shared_lock<std::shared_mutex> guard(current.lock);
+				total += current.tree.size();
+			}
+			return total;
+		}
+
+		/**
+		 * Remove every key from every shard.
+		 */
+		void empty()
+		{
+			for (shard &current : this->shards)
+			{
+				std::unique_lock<std::shared_mutex> guard(current.lock);
+				current.tree.empty();
+			}
+		}
+
+		/**
+		 * Call visit(key, value) for every key in order, merging the
+		 * shards. Every shard is locked for reading until the walk ends.
+		 * @param visit
+		 */
+		template<typename Visitor>
+		void for_each(Visitor visit) const
+		{
+			auto guards = this->lock_all();
+			std::vector<cursor> heap;
+			heap.reserve(N);
+			for (std::size_t index = 0; index < N; index++)
+			{
+				this->push_cursor(heap, this->shards[index].tree.first_element(), index);
+			}
+			this->merge(heap, visit, nullptr);
+		}
+
+		/**
+		 * Call visit(key, value) for every key k with low <= k < high, in
+		 * order, merging the shards. Each shard is entered with one
+		 * lower_bound, so this costs O(N log n + k log N) for k keys
+		 * visited. Every shard is locked for reading until the walk ends.
+		 * @param low
+		 * @param high
+		 * @param visit
+		 */
+		template<typename Visitor>
+		void for_each_in_range(const K &low, const K &high, Visitor visit) const
+		{
+			auto guards = this->lock_all();
+			std::vector<cursor> heap;
+			heap.reserve(N);
+			for (std::size_t index = 0; index < N; index++)
+			{
+				this->push_cursor(heap, this->shards[index].tree.lower_bound(low), index);
+			}
+			this->merge(heap, visit, &high);
+		}
+
+	private:
+		shard &shard_for(const K &key)
+		{
+			return this->shards[this->partition(key, N)];
+		}
+
+		const shard &shard_for(const K &key) const
+		{
+			return this->shards[this->partition(key, N)];
+		}
+
+		/**
+		 * Lock every shard for reading. Shards are always locked in index
+		 * order, so two walks cannot deadlock.
+		 * @return the held locks
+		 */
+		std::array<std::shared_lock<std::shared_mutex>, N> lock_all() const
+		{
+			std::array<std::shared_lock<std::shared_mutex>, N> guards;
+			for (std::size_t index = 0; index < N; index++)
+			{
+				guards[index] = std::shared_lock<std::shared_mutex>(this->shards[index].lock);
+			}
+			return guards;
+		}
+
+		/**
+		 * Heap order for the merge: the smallest key is on top.
+		 */
+		bool later(const cursor &lhs, const cursor &rhs) const
+		{
+			return this->compare(*rhs.key, *lhs.key);
+		}
+
+		/**
+		 * Add a shard's position to the merge unless it is at the end.
+		 * @param heap
+		 * @param current
+		 * @param index
+		 */
+		void push_cursor(std::vector<cursor> &heap, tree_iterator current, std::size_t index) const
+		{
+			if (current == this->shards[index].tree.end())
+			{
+				return;
+			} // else, the shard has keys left, do_nothing();
+
+			heap.push_back({ current, &current.get_key(), index });
+			std::push_heap(heap.begin(), heap.end(),
+				[this](const cursor &lhs, const cursor &rhs) { return this->later(lhs, rhs); });
+		}
+
+		/**
+		 * Pop the smallest key from the heap until it is empty or the key
+		 * reaches high, visiting each one and moving its shard forward.
+		 * @param heap
+		 * @param visit
+		 * @param high the first key not to visit, or null for no limit
+		 */
+		template<typename Visitor>
+		void merge(std::vector<cursor> &heap, Visitor &visit, const K *high) const
+		{
+			auto order = [this](const cursor &lhs, const cursor &rhs) { return this->later(lhs, rhs); };
+			while (!heap.empty())
+			{
+				std::pop_heap(heap.begin(), heap.end(), order);
+				cursor next = heap.back();
+				heap.pop_back();
+				if (high != nullptr && !this->compare(*next.key, *high))
+				{
+					// every other shard is at an even larger key
+					return;
+				} // else, do_nothing();
+
+				visit(*next.key, static_cast<const V &>(*next.current));
+				++next.current;
+				this->push_cursor(heap, next.current, next.index);
+			}
+		}
+	};
+}
+
+#endif // SHARDED_AVL_MAP_H_
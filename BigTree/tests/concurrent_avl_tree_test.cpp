@@ -0,0 +1,234 @@
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../concurrent_avl_tree.h"
+#include "test_util.h"
+
+/**
+ * Checks concurrent_avl_tree against std::map while several threads
+ * write and read it at once. Each writer owns the keys equal to its
+ * number modulo the writer count, so the result of every insert and
+ * remove is known from its own std::map, while the rotations and
+ * unlinks it causes reach nodes the other threads are using. Every
+ * value is twice its key, so a reader can tell a torn or misplaced
+ * read from a key that is simply not there yet.
+ */
+
+namespace
+{
+	constexpr int writers = 4;
+	constexpr int readers = 2;
+	constexpr int key_range = 4000;
+	constexpr int operations = 100000;
+
+	/**
+	 * The keys below zero never change while the writers run.
+	 */
+	constexpr int stable_keys = 500;
+
+	using tree_type = nwacc::concurrent_avl_tree<long long, int>;
+
+	/**
+	 * Compare every key below last the writers could have touched with
+	 * the model.
+	 * @param tree
+	 * @param model
+	 * @param last
+	 */
+	void compare_with(const tree_type &tree, const std::map<int, long long> &model, int last)
+	{
+		for (int key = -stable_keys; key < last; key++)
+		{
+			const auto found = model.find(key);
+			long long value = 0;
+			const bool present = tree.try_get(key, value);
+			if (!nwacc::test::check(present == (found != model.end()), "key " + std::to_string(key) + " presence"))
+			{
+				return;
+			} // else, do_nothing();
+			if (present && !nwacc::test::check(value == found->second, "key " + std::to_string(key) + " value"))
+			{
+				return;
+			} // else, do_nothing();
+		}
+	}
+
+	/**
+	 * Writers insert and remove at random while readers look keys up.
+	 * @param seed
+	 * @param range the writers pick keys below this
+	 */
+	void random_writes(unsigned seed, int range)
+	{
+		tree_type tree;
+		std::map<int, long long> model;
+		for (int key = -stable_keys; key < 0; key++)
+		{
+			tree.insert(2ll * key, key);
+			model[key] = 2ll * key;
+		}
+
+		std::vector<std::map<int, long long>> owned(writers);
+		std::atomic<int> running{ writers };
+		std::vector<std::thread> threads;
+		for (int writer = 0; writer < writers; writer++)
+		{
+			threads.emplace_back([&, writer]()
+			{
+				std::mt19937 random(seed + writer);
+				std::map<int, long long> &mine = owned[writer];
+				for (int index = 0; index < operations; index++)
+				{
+					const int key = static_cast<int>(random() % (range / writers)) * writers + writer;
+					if (random() % 3 != 0)
+					{
+						const bool inserted = tree.insert(2ll * key, key);
+						nwacc::test::check(inserted == (mine.count(key) == 0), "insert result");
+						mine[key] = 2ll * key;
+					}
+					else
+					{
+						const bool removed = tree.remove(key);
+						nwacc::test::check(removed == (mine.erase(key) == 1), "remove result");
+					}
+				}
+				running -= 1;
+			});
+		}
+		for (int reader = 0; reader < readers; reader++)
+		{
+			threads.emplace_back([&, reader]()
+			{
+				std::mt19937 random(seed + writers + reader);
+				while (running != 0)
+				{
+					const int stable = -1 - static_cast<int>(random() % stable_keys);
+					long long value = 0;
+					nwacc::test::check(tree.try_get(stable, value) && value == 2ll * stable, "stable key found");
+					const int key = static_cast<int>(random() % range);
+					if (tree.try_get(key, value))
+					{
+						nwacc::test::check(value == 2ll * key, "value matches its key");
+					} // else, not inserted yet or removed, do_nothing();
+				}
+			});
+		}
+		for (std::thread &thread : threads)
+		{
+			thread.join();
+		}
+
+		for (const auto &mine : owned)
+		{
+			model.insert(mine.begin(), mine.end());
+		}
+		compare_with(tree, model, range);
+		tree.reclaim();
+		compare_with(tree, model, range);
+	}
+
+	/**
+	 * Every writer inserts an increasing run of keys and then removes
+	 * them in the same order, which rotates at the same edge of the tree
+	 * over and over.
+	 */
+	void increasing_writes()
+	{
+		tree_type tree;
+		std::vector<std::thread> threads;
+		for (int writer = 0; writer < writers; writer++)
+		{
+			threads.emplace_back([&tree, writer]()
+			{
+				for (int key = writer; key < key_range * 4; key += writers)
+				{
+					tree.insert(2ll * key, key);
+				}
+				for (int key = writer; key < key_range * 2; key += writers)
+				{
+					nwacc::test::check(tree.remove(key), "remove an inserted key");
+				}
+			});
+		}
+		for (std::thread &thread : threads)
+		{
+			thread.join();
+		}
+
+		std::map<int, long long> model;
+		for (int key = key_range * 2; key < key_range * 4; key++)
+		{
+			model[key] = 2ll * key;
+		}
+		compare_with(tree, model, key_range * 4);
+	}
+
+	/**
+	 * Writers overwrite the same few keys over and over while readers
+	 * copy their values out. The replaced values must be freed by the
+	 * threads that keep calling, not held until reclaim. How many wait
+	 * while every thread runs depends on how often a thread is switched
+	 * out in the middle of a call, so the backlog is checked once one
+	 * thread carries on alone.
+	 */
+	void overwrites()
+	{
+		tree_type tree;
+		std::atomic<int> running{ writers };
+		std::vector<std::thread> threads;
+		for (int writer = 0; writer < writers; writer++)
+		{
+			threads.emplace_back([&, writer]()
+			{
+				std::mt19937 random(writer);
+				for (int index = 0; index < operations; index++)
+				{
+					const int key = static_cast<int>(random() % 64);
+					tree.insert(2ll * key, key);
+				}
+				running -= 1;
+			});
+		}
+		for (int reader = 0; reader < readers; reader++)
+		{
+			threads.emplace_back([&, reader]()
+			{
+				std::mt19937 random(writers + reader);
+				while (running != 0)
+				{
+					const int key = static_cast<int>(random() % 64);
+					long long value = 0;
+					if (tree.try_get(key, value))
+					{
+						nwacc::test::check(value == 2ll * key, "overwritten value matches its key");
+					} // else, not inserted yet, do_nothing();
+				}
+			});
+		}
+		for (std::thread &thread : threads)
+		{
+			thread.join();
+		}
+
+		for (int index = 0; index < 512; index++)
+		{
+			tree.insert(2ll * (index % 64), index % 64);
+		}
+		nwacc::test::check(tree.retired() < 256, "replaced values are freed without reclaim, "
+						   + std::to_string(tree.retired()) + " left");
+		tree.reclaim();
+		nwacc::test::check(tree.retired() == 0, "reclaim frees the rest");
+	}
+}
+
+int main()
+{
+	nwacc::test::run("random writes, narrow keys", []() { random_writes(1, 256); });
+	nwacc::test::run("random writes, wide keys", []() { random_writes(2, key_range); });
+	nwacc::test::run("increasing writes", increasing_writes);
+	nwacc::test::run("overwrites", overwrites);
+	return nwacc::test::result();
+}
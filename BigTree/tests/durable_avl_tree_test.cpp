@@ -0,0 +1,239 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../durable_avl_tree.h"
+#include "test_util.h"
+
+/**
+ * Checks that durable_avl_tree recovers what it promises after the
+ * crashes a test can stage on disk: a log whose last record was cut
+ * short or has a damaged length, and the old log a checkpoint leaves
+ * behind when it stops before writing its snapshot.
+ */
+
+namespace
+{
+	using tree_type = nwacc::durable_avl_tree<long long, int>;
+
+	/**
+	 * The bytes of one logged insert: its length, the record type, the
+	 * key, the value and the checksum.
+	 */
+	constexpr std::uintmax_t insert_bytes = 4 + 1 + sizeof(int) + sizeof(long long) + 4;
+
+	/**
+	 * A directory of its own for each test, removed when it is done.
+	 */
+	class scratch_directory
+	{
+	public:
+		explicit scratch_directory(const std::string &name)
+			: directory{ std::filesystem::temp_directory_path() / ("bigtree_" + name) }
+		{
+			std::filesystem::remove_all(this->directory);
+			std::filesystem::create_directories(this->directory);
+		}
+
+		~scratch_directory()
+		{
+			std::error_code error;
+			std::filesystem::remove_all(this->directory, error);
+		}
+
+		std::string path(const std::string &name) const
+		{
+			return (this->directory / name).string();
+		}
+
+	private:
+		std::filesystem::path directory;
+	};
+
+	/**
+	 * Settings that keep every change in the log until a test asks for
+	 * a checkpoint.
+	 */
+	nwacc::wal_options no_checkpoints()
+	{
+		nwacc::wal_options options;
+		options.checkpoint_bytes = 0;
+		return options;
+	}
+
+	/**
+	 * Compare the whole tree at path with the model.
+	 * @param path
+	 * @param model
+	 */
+	void compare_with(const std::string &path, const std::map<int, long long> &model)
+	{
+		tree_type tree(path, no_checkpoints());
+		std::map<int, long long> found;
+		tree.for_each([&found](int key, long long value) { found[key] = value; });
+		nwacc::test::check(found == model, path + " holds the expected keys");
+	}
+
+	/**
+	 * A log cut off in its last record loses only that record.
+	 */
+	void torn_tail()
+	{
+		scratch_directory directory("torn_tail");
+		const std::string path = directory.path("tree");
+		std::map<int, long long> model;
+		{
+			tree_type tree(path, no_checkpoints());
+			for (int key = 0; key < 100; key++)
+			{
+				tree.insert(10ll * key, key);
+				model[key] = 10ll * key;
+			}
+			tree.remove(50);
+			model.erase(50);
+			tree.insert(-1, 1000);
+		}
+
+		const std::string log = path + ".wal";
+		nwacc::test::check(std::filesystem::file_size(log) == 101 * insert_bytes + 4 + 1 + sizeof(int) + 4,
+						   "every change is in the log");
+		std::filesystem::resize_file(log, std::filesystem::file_size(log) - 3);
+		compare_with(path, model);
+		compare_with(path, model);
+	}
+
+	/**
+	 * A damaged length in the last record stops the replay there
+	 * instead of asking for that many bytes.
+	 */
+	void damaged_length()
+	{
+		scratch_directory directory("damaged_length");
+		const std::string path = directory.path("tree");
+		std::map<int, long long> model;
+		{
+			tree_type tree(path, no_checkpoints());
+			for (int key = 0; key < 10; key++)
+			{
+				tree.insert(key, key);
+				model[key] = key;
+			}
+			tree.insert(-1, 10);
+		}
+
+		{
+			std::fstream log(path + ".wal", std::ios::binary | std::ios::in | std::ios::out);
+			log.seekp(static_cast<std::streamoff>(10 * insert_bytes));
+			const std::uint32_t length = 0xfffffff0u;
+			log.write(reinterpret_cast<const char *>(&length), sizeof(length));
+		}
+		compare_with(path, model);
+	}
+
+	/**
+	 * A checkpoint that renamed the log but never wrote its snapshot
+	 * leaves the old log behind. Opening replays it before the new log,
+	 * so a later remove still wins, and then cleans it up.
+	 */
+	void interrupted_checkpoint()
+	{
+		scratch_directory directory("interrupted_checkpoint");
+		const std::string path = directory.path("tree");
+		const std::string newer = directory.path("newer");
+		std::map<int, long long> model;
+		{
+			tree_type tree(path, no_checkpoints());
+			for (int key = 0; key < 100; key++)
+			{
+				tree.insert(key, key);
+				model[key] = key;
+			}
+			tree.checkpoint();
+			for (int key = 100; key < 200; key++)
+			{
+				tree.insert(key, key);
+				model[key] = key;
+			}
+		}
+		std::filesystem::rename(path + ".wal", path + ".wal.old");
+
+		{
+			// the changes made after the rotation, logged on their own
+			tree_type tree(newer, no_checkpoints());
+			for (int key = 150; key < 250; key++)
+			{
+				tree.insert(-key, key);
+				model[key] = -key;
+			}
+			tree.remove(160);
+			model.erase(160);
+		}
+		std::filesystem::copy_file(newer + ".wal", path + ".wal");
+
+		compare_with(path, model);
+		nwacc::test::check(!std::filesystem::exists(path + ".wal.old"), "the old log is gone after recovery");
+		compare_with(path, model);
+	}
+
+	/**
+	 * Writers on several threads fill a log that checkpoints every few
+	 * kilobytes, so many writers find the log long at once and one of
+	 * them checkpoints while the others keep logging. Reopening gives
+	 * back every change.
+	 */
+	void concurrent_checkpoints()
+	{
+		scratch_directory directory("concurrent_checkpoints");
+		const std::string path = directory.path("tree");
+		constexpr int threads = 4;
+		constexpr int per_thread = 2000;
+		std::map<int, long long> model;
+		{
+			nwacc::wal_options options;
+			options.sync = nwacc::sync_policy::never;
+			options.checkpoint_bytes = 4096;
+			tree_type tree(path, options);
+			std::vector<std::thread> writers;
+			for (int writer = 0; writer < threads; writer++)
+			{
+				writers.emplace_back([&tree, writer]()
+				{
+					for (int index = 0; index < per_thread; index++)
+					{
+						const int key = index * threads + writer;
+						tree.insert(3ll * key, key);
+						if (key % 5 == 0)
+						{
+							tree.remove(key);
+						} // else, do_nothing();
+					}
+				});
+			}
+			for (std::thread &writer : writers)
+			{
+				writer.join();
+			}
+		}
+		for (int key = 0; key < threads * per_thread; key++)
+		{
+			if (key % 5 != 0)
+			{
+				model[key] = 3ll * key;
+			} // else, do_nothing();
+		}
+		compare_with(path, model);
+	}
+}
+
+int main()
+{
+	nwacc::test::run("torn tail", torn_tail);
+	nwacc::test::run("damaged length", damaged_length);
+	nwacc::test::run("interrupted checkpoint", interrupted_checkpoint);
+	nwacc::test::run("concurrent checkpoints", concurrent_checkpoints);
+	return nwacc::test::result();
+}
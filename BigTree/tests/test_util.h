@@ -0,0 +1,68 @@
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <string>
+
+namespace nwacc
+{
+	namespace test
+	{
+		/**
+		 * The number of checks that failed so far, from any thread.
+		 */
+		inline std::atomic<int> &failures()
+		{
+			static std::atomic<int> count{ 0 };
+			return count;
+		}
+
+		/**
+		 * Report a failed check on stderr and count it.
+		 * @param condition
+		 * @param what describes the check
+		 * @return condition, so a test can stop early.
+		 */
+		inline bool check(bool condition, const std::string &what)
+		{
+			if (!condition)
+			{
+				std::cerr << "FAILED: " << what << "\n";
+				failures() += 1;
+			} // else, do_nothing();
+			return condition;
+		}
+
+		/**
+		 * Run one named test and report it.
+		 * @param name
+		 * @param run
+		 */
+		template<typename Test>
+		void run(const char *name, Test run)
+		{
+			const int before = failures();
+			try
+			{
+				run();
+			}
+			catch (const std::exception &error)
+			{
+				check(false, std::string(name) + " threw " + error.what());
+			}
+			std::cout << (failures() == before ? "ok     " : "FAILED ") << name << "\n";
+		}
+
+		/**
+		 * @return the exit code of the test program.
+		 */
+		inline int result()
+		{
+			return failures() == 0 ? 0 : 1;
+		}
+	}
+}
+
+#endif // TEST_UTIL_H_
@@ -0,0 +1,407 @@
+#ifndef TREE_CODEC_H_
+#define TREE_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "checksum.h"
+
+namespace nwacc
+{
+	/**
+	 * Reads the bytes a codec wrote, failing on a stream that ends early.
+	 */
+	class byte_reader
+	{
+	public:
+		byte_reader(const char *first, const char *last) : current{ first }, last{ last } {}
+
+		/**
+		 * Copy the next bytes out.
+		 * @param target
+		 * @param bytes
+		 */
+		void read(void *target, std::size_t bytes)
+		{
+			if (this->remaining() < bytes)
+			{
+				throw std::runtime_error("tree stream ends inside a record");
+			} // else, do_nothing();
+			std::memcpy(target, this->current, bytes);
+			this->current += bytes;
+		}
+
+		/**
+		 * Read an unsigned LEB128 varint: seven bits per byte, low bits
+		 * first, with the top bit set on every byte but the last.
+		 * @return the number.
+		 */
+		std::uint64_t varint()
+		{
+			std::uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				if (this->current == this->last)
+				{
+					throw std::runtime_error("tree stream ends inside a record");
+				} // else, do_nothing();
+				const unsigned char next = static_cast<unsigned char>(*this->current++);
+				value |= static_cast<std::uint64_t>(next & 0x7f) << shift;
+				if ((next & 0x80) == 0)
+				{
+					return value;
+				} // else, more bytes follow, do_nothing();
+			}
+			throw std::runtime_error("tree stream has a varint longer than 64 bits");
+		}
+
+		bool at_end() const
+		{
+			return this->current == this->last;
+		}
+
+		/**
+		 * @return the number of bytes left.
+		 */
+		std::size_t remaining() const
+		{
+			return static_cast<std::size_t>(this->last - this->current);
+		}
+
+	private:
+		const char *current;
+		const char *last;
+	};
+
+	/**
+	 * Append value as an unsigned LEB128 varint.
+	 * @param out
+	 * @param value
+	 */
+	inline void write_varint(std::string &out, std::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	/**
+	 * Map signed numbers to unsigned ones with small magnitudes first, so
+	 * -1 and 1 both take one varint byte.
+	 */
+	inline std::uint64_t zigzag(std::int64_t value)
+	{
+		return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+	}
+
+	inline std::int64_t unzigzag(std::uint64_t value)
+	{
+		return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+	}
+
+	/**
+	 * How avl_tree::serialize writes and reads one key or value. A codec
+	 * is made fresh for each stream, so it may remember what it saw last.
+	 * Write your own with the same two members to serialize other types.
+	 *
+	 * This one copies the bytes of trivially copyable types, so the
+	 * stream is only readable on machines with the same layout.
+	 * @param V the type to encode
+	 */
+	template<typename V, typename Enable = void>
+	struct codec
+	{
+		static_assert(std::is_trivially_copyable<V>::value,
+					  "serialize needs a codec for keys and values that are not trivially copyable");
+
+		void encode(std::string &out, const V &value)
+		{
+			out.append(reinterpret_cast<const char *>(&value), sizeof(V));
+		}
+
+		V decode(byte_reader &in)
+		{
+			V value;
+			in.read(&value, sizeof(V));
+			return value;
+		}
+	};
+
+	/**
+	 * Integers as varints, zigzagged when signed, so small numbers take a
+	 * byte or two whatever the width of the type.
+	 */
+	template<typename V>
+	struct codec<V, typename std::enable_if<std::is_integral<V>::value>::type>
+	{
+		void encode(std::string &out, const V &value)
+		{
+			if constexpr (std::is_signed<V>::value)
+			{
+				write_varint(out, zigzag(static_cast<std::int64_t>(value)));
+			}
+			else
+			{
+				write_varint(out, static_cast<std::uint64_t>(value));
+			}
+		}
+
+		V decode(byte_reader &in)
+		{
+			if constexpr (std::is_signed<V>::value)
+			{
+				return static_cast<V>(unzigzag(in.varint()));
+			}
+			else
+			{
+				return static_cast<V>(in.varint());
+			}
+		}
+	};
+
+	/**
+	 * Strings as a varint length and then their bytes.
+	 */
+	template<>
+	struct codec<std::string>
+	{
+		void encode(std::string &out, const std::string &value)
+		{
+			write_varint(out, value.size());
+			out.append(value);
+		}
+
+		std::string decode(byte_reader &in)
+		{
+			const std::uint64_t length = in.varint();
+			if (length > in.remaining())
+			{
+				throw std::runtime_error("tree stream ends inside a record");
+			} // else, do_nothing();
+			std::string value(static_cast<std::size_t>(length), '\0');
+			in.read(&value[0], value.size());
+			return value;
+		}
+	};
+
+	/**
+	 * Integer keys as the zigzagged varint difference from the key
+	 * before. Keys arrive in order, so dense keys take one byte each.
+	 * @param K an integer type
+	 */
+	template<typename K>
+	struct delta_codec
+	{
+		static_assert(std::is_integral<K>::value, "delta_codec needs integer keys");
+
+		using unsigned_key = typename std::make_unsigned<K>::type;
+		using signed_key = typename std::make_signed<K>::type;
+
+		void encode(std::string &out, const K &key)
+		{
+			// wrapping unsigned arithmetic keeps every difference exact
+			const unsigned_key difference = static_cast<unsigned_key>(static_cast<unsigned_key>(key) - this->previous);
+			write_varint(out, zigzag(static_cast<std::int64_t>(static_cast<signed_key>(difference))));
+			this->previous = static_cast<unsigned_key>(key);
+		}
+
+		K decode(byte_reader &in)
+		{
+			const auto difference = static_cast<signed_key>(unzigzag(in.varint()));
+			this->previous = static_cast<unsigned_key>(this->previous + static_cast<unsigned_key>(difference));
+			return static_cast<K>(this->previous);
+		}
+
+	private:
+		unsigned_key previous = 0;
+	};
+
+	/**
+	 * The codec serialize uses for keys unless told otherwise:
+	 * delta_codec for integers and codec for everything else.
+	 */
+	template<typename K>
+	using default_key_codec = typename std::conditional<std::is_integral<K>::value && !std::is_same<K, bool>::value,
+														delta_codec<K>, codec<K>>::type;
+
+	/**
+	 * Writes the stream avl_tree::serialize produces: a magic number and
+	 * version, then chunks of records, each with its record count, byte
+	 * count and checksum, and a chunk of no records at the end. Records
+	 * are buffered until a chunk is full, so a large tree streams out in
+	 * pieces of about chunk_bytes.
+	 */
+	class tree_stream_writer
+	{
+	public:
+		static constexpr std::size_t chunk_bytes = 64 * 1024;
+
+		explicit tree_stream_writer(std::ostream &out) : out{ out }
+		{
+			this->out.write(magic, sizeof(magic));
+			this->out.put(static_cast<char>(version));
+			this->buffer.reserve(chunk_bytes + 256);
+		}
+
+		/**
+		 * The buffer the next record is encoded into.
+		 */
+		std::string &record_buffer()
+		{
+			return this->buffer;
+		}
+
+		/**
+		 * Count the record just encoded, writing the chunk once it is full.
+		 */
+		void end_record()
+		{
+			this->records += 1;
+			if (this->buffer.size() >= chunk_bytes)
+			{
+				this->write_chunk();
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Write what is buffered and the closing chunk.
+		 */
+		void finish()
+		{
+			if (this->records != 0)
+			{
+				this->write_chunk();
+			} // else, do_nothing();
+			this->write_chunk();
+			if (!this->out)
+			{
+				throw std::runtime_error("could not write the tree stream");
+			} // else, do_nothing();
+		}
+
+		static constexpr char magic[8] = { 'N', 'W', 'S', 'T', 'R', 'E', 'A', 'M' };
+		static constexpr unsigned char version = 1;
+
+		/**
+		 * The checksum of a chunk, written little endian after it.
+		 */
+		static std::uint32_t chunk_checksum(const char *data, std::size_t bytes)
+		{
+			const std::uint64_t hash = fnv1a_checksum(fnv1a_seed, data, bytes);
+			return static_cast<std::uint32_t>(hash ^ (hash >> 32));
+		}
+
+	private:
+		std::ostream &out;
+		std::string buffer;
+		std::uint64_t records = 0;
+
+		void write_chunk()
+		{
+			std::string header;
+			write_varint(header, this->records);
+			write_varint(header, this->buffer.size());
+			const std::uint32_t check = chunk_checksum(this->buffer.data(), this->buffer.size());
+			const char trailer[4] = { static_cast<char>(check), static_cast<char>(check >> 8),
+									  static_cast<char>(check >> 16), static_cast<char>(check >> 24) };
+			this->out.write(header.data(), static_cast<std::streamsize>(header.size()));
+			this->out.write(this->buffer.data(), static_cast<std::streamsize>(this->buffer.size()));
+			this->out.write(trailer, sizeof(trailer));
+			this->buffer.clear();
+			this->records = 0;
+		}
+	};
+
+	/**
+	 * Reads a stream written by tree_stream_writer one chunk at a time.
+	 */
+	class tree_stream_reader
+	{
+	public:
+		explicit tree_stream_reader(std::istream &in) : in{ in }
+		{
+			char magic[sizeof(tree_stream_writer::magic)];
+			if (!this->in.read(magic, sizeof(magic)) ||
+				std::memcmp(magic, tree_stream_writer::magic, sizeof(magic)) != 0)
+			{
+				throw std::runtime_error("not a tree stream");
+			} // else, do_nothing();
+			if (this->in.get() != tree_stream_writer::version)
+			{
+				throw std::runtime_error("tree stream of an unknown version");
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Read the next chunk, checking its checksum.
+		 * @param records set to the number of records in the chunk
+		 * @return a reader over the chunk, empty at the end of the stream.
+		 */
+		byte_reader next_chunk(std::uint64_t &records)
+		{
+			records = this->varint();
+			const std::uint64_t bytes = this->varint();
+			if (bytes > max_chunk_bytes)
+			{
+				throw std::runtime_error("tree stream chunk is damaged");
+			} // else, do_nothing();
+			this->buffer.resize(static_cast<std::size_t>(bytes));
+			unsigned char trailer[4];
+			if (!this->in.read(&this->buffer[0], static_cast<std::streamsize>(bytes)) ||
+				!this->in.read(reinterpret_cast<char *>(trailer), sizeof(trailer)))
+			{
+				throw std::runtime_error("tree stream ends inside a chunk");
+			} // else, do_nothing();
+
+			const std::uint32_t check = static_cast<std::uint32_t>(trailer[0]) |
+										static_cast<std::uint32_t>(trailer[1]) << 8 |
+										static_cast<std::uint32_t>(trailer[2]) << 16 |
+										static_cast<std::uint32_t>(trailer[3]) << 24;
+			if (check != tree_stream_writer::chunk_checksum(this->buffer.data(), this->buffer.size()))
+			{
+				throw std::runtime_error("tree stream chunk is damaged");
+			} // else, do_nothing();
+			return byte_reader(this->buffer.data(), this->buffer.data() + this->buffer.size());
+		}
+
+	private:
+		/**
+		 * Chunks hold about chunk_bytes plus one record, so a length past
+		 * this comes from a damaged stream, not a huge record.
+		 */
+		static constexpr std::uint64_t max_chunk_bytes = 1ull << 30;
+
+		std::istream &in;
+		std::string buffer;
+
+		std::uint64_t varint()
+		{
+			std::uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				const int next = this->in.get();
+				if (next == std::char_traits<char>::eof())
+				{
+					throw std::runtime_error("tree stream ends before its closing chunk");
+				} // else, do_nothing();
+				value |= static_cast<std::uint64_t>(next & 0x7f) << shift;
+				if ((next & 0x80) == 0)
+				{
+					return value;
+				} // else, more bytes follow, do_nothing();
+			}
+			throw std::runtime_error("tree stream has a varint longer than 64 bits");
+		}
+	};
+}
+
+#endif // TREE_CODEC_H_
@@ -0,0 +1,45 @@
+#ifndef TREE_ENGINE_H_
+#define TREE_ENGINE_H_
+
+#include <functional>
+
+#include "avl_tree.h"
+#include "b_plus_tree.h"
+
+namespace nwacc
+{
+	/**
+	 * Selects avl_tree: one key per node, cheap inserts and removes, and
+	 * iterators that stay valid while other keys change.
+	 */
+	struct avl_engine
+	{
+		template<typename T, typename K, typename Compare>
+		using tree = avl_tree<T, K, Compare>;
+	};
+
+	/**
+	 * Selects b_plus_tree: wide nodes and linked leaves, for lookups and
+	 * scans over trees too big for the cache.
+	 */
+	struct b_plus_tree_engine
+	{
+		template<typename T, typename K, typename Compare>
+		using tree = b_plus_tree<T, K, Compare>;
+	};
+
+	/**
+	 * An ordered map built on the engine given as a policy. Both engines
+	 * offer insert, get, contains, remove, find, lower_bound and the same
+	 * iterators, so code written against ordered_tree switches engines by
+	 * changing one template argument.
+	 * @param T the value type
+	 * @param K the key type
+	 * @param Engine avl_engine or b_plus_tree_engine
+	 * @param Compare orders the keys
+	 */
+	template<typename T, typename K, typename Engine = avl_engine, typename Compare = std::less<K>>
+	using ordered_tree = typename Engine::template tree<T, K, Compare>;
+}
+
+#endif // TREE_ENGINE_H_
@@ -0,0 +1,552 @@
+#ifndef WRITE_AHEAD_LOG_H_
+#define WRITE_AHEAD_LOG_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "checksum.h"
+
+namespace nwacc
+{
+	/**
+	 * When a write_ahead_log asks the operating system to put its writes
+	 * on disk.
+	 */
+	enum class sync_policy
+	{
+		/**
+		 * Never. A write survives the process crashing but may be lost if
+		 * the machine goes down.
+		 */
+		never,
+
+		/**
+		 * After every group of commits, before any writer in the group
+		 * returns. A write that returned survives the machine going down.
+		 */
+		every_commit,
+
+		/**
+		 * After a group of commits when the last sync is older than
+		 * sync_interval, so at most that much recent work is at risk
+		 * while writes keep coming.
+		 */
+		periodic
+	};
+
+	/**
+	 * Settings for a write_ahead_log and the durable_avl_tree on top of it.
+	 */
+	struct wal_options
+	{
+		sync_policy sync = sync_policy::every_commit;
+
+		/**
+		 * How old the last sync may be under sync_policy::periodic.
+		 */
+		std::chrono::milliseconds sync_interval{ 100 };
+
+		/**
+		 * Take a checkpoint once the log is this long, 0 for never.
+		 */
+		std::uint64_t checkpoint_bytes = 64ull << 20;
+	};
+
+	/**
+	 * A file opened for appending, with the calls a log needs that the
+	 * standard streams do not offer: sync to disk and truncate.
+	 */
+	class log_file
+	{
+	public:
+		/**
+		 * Open the file at path for appending, creating it if needed.
+		 * @param path
+		 */
+		explicit log_file(const std::string &path)
+		{
+			this->open(path);
+		}
+
+		log_file(const log_file &) = delete;
+		log_file &operator=(const log_file &) = delete;
+
+		~log_file()
+		{
+			this->close();
+		}
+
+		/**
+		 * Open the file at path for appending, closing the one open now.
+		 * @param path
+		 */
+		void open(const std::string &path)
+		{
+			this->close();
+			this->path = path;
+#if defined(_WIN32)
+			this->handle = ::CreateFileA(path.c_str(), FILE_APPEND_DATA | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+										 OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (this->handle == INVALID_HANDLE_VALUE)
+#else
+			this->handle = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if (this->handle < 0)
+#endif
+			{
+				throw std::runtime_error("could not open " + path);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Close the file. Does nothing if it is not open.
+		 */
+		void close()
+		{
+#if defined(_WIN32)
+			if (this->handle != INVALID_HANDLE_VALUE)
+			{
+				::CloseHandle(this->handle);
+				this->handle = INVALID_HANDLE_VALUE;
+			} // else, do_nothing();
+#else
+			if (this->handle >= 0)
+			{
+				::close(this->handle);
+				this->handle = -1;
+			} // else, do_nothing();
+#endif
+		}
+
+		/**
+		 * Write bytes at the end of the file.
+		 * @param data
+		 * @param bytes
+		 */
+		void append(const char *data, std::size_t bytes)
+		{
+			while (bytes > 0)
+			{
+#if defined(_WIN32)
+				DWORD written = 0;
+				const DWORD chunk = static_cast<DWORD>(bytes < (1u << 30) ? bytes : (1u << 30));
+				if (!::WriteFile(this->handle, data, chunk, &written, nullptr))
+#else
+				const ::ssize_t written = ::write(this->handle, data, bytes);
+				if (written < 0)
+#endif
+				{
+					throw std::runtime_error("could not write " + this->path);
+				} // else, do_nothing();
+				data += written;
+				bytes -= static_cast<std::size_t>(written);
+			}
+		}
+
+		/**
+		 * Wait until everything written so far is on disk.
+		 */
+		void sync()
+		{
+#if defined(_WIN32)
+			if (!::FlushFileBuffers(this->handle))
+#else
+			if (::fsync(this->handle) != 0)
+#endif
+			{
+				throw std::runtime_error("could not sync " + this->path);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Cut the file down to bytes long.
+		 * @param bytes
+		 */
+		void truncate(std::uint64_t bytes)
+		{
+#if defined(_WIN32)
+			LARGE_INTEGER length;
+			length.QuadPart = static_cast<LONGLONG>(bytes);
+			if (!::SetFilePointerEx(this->handle, length, nullptr, FILE_BEGIN) || !::SetEndOfFile(this->handle))
+#else
+			if (::ftruncate(this->handle, static_cast<::off_t>(bytes)) != 0)
+#endif
+			{
+				throw std::runtime_error("could not truncate " + this->path);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Put a file that was written and closed on disk.
+		 * @param path
+		 */
+		static void sync_path(const std::string &path)
+		{
+#if defined(_WIN32)
+			HANDLE file = ::CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+										OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			const bool synced = file != INVALID_HANDLE_VALUE && ::FlushFileBuffers(file);
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				::CloseHandle(file);
+			} // else, do_nothing();
+#else
+			const int file = ::open(path.c_str(), O_RDONLY);
+			const bool synced = file >= 0 && ::fsync(file) == 0;
+			if (file >= 0)
+			{
+				::close(file);
+			} // else, do_nothing();
+#endif
+			if (!synced)
+			{
+				throw std::runtime_error("could not sync " + path);
+			} // else, do_nothing();
+		}
+
+		/**
+		 * Put the names in the directory holding path on disk, so a rename
+		 * into it survives the machine going down. Windows does this as
+		 * part of the rename.
+		 * @param path
+		 */
+		static void sync_directory(const std::string &path)
+		{
+#if !defined(_WIN32)
+			std::string directory = std::filesystem::path(path).parent_path().string();
+			if (directory.empty())
+			{
+				directory = ".";
+			} // else, do_nothing();
+			const int file = ::open(directory.c_str(), O_RDONLY);
+			if (file >= 0)
+			{
+				::fsync(file);
+				::close(file);
+			} // else, the rename is still done, just not yet on disk, do_nothing();
+#else
+			(void)path;
+#endif
+		}
+
+	private:
+		std::string path;
+#if defined(_WIN32)
+		HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+		int handle = -1;
+#endif
+	};
+
+	/**
+	 * An append only log of records with group commit. Writers append
+	 * their record, in whatever order they need replayed, and then
+	 * commit it. The first writer to commit writes every record waiting
+	 * at that moment with one write, and one sync if the policy asks,
+	 * while the writers behind it wait for that write instead of making
+	 * their own. Under load many commits share each sync.
+	 *
+	 * Each record is framed with its length and a checksum, so replay
+	 * stops cleanly at a record the machine went down in the middle of.
+	 */
+	class write_ahead_log
+	{
+	public:
+		/**
+		 * Open the log at path for appending, creating it if needed.
+		 * @param path
+		 * @param options
+		 */
+		write_ahead_log(const std::string &path, const wal_options &options)
+			: path{ path }, options{ options }, file{ path }, last_sync{ std::chrono::steady_clock::now() }
+		{
+			std::error_code error;
+			const auto length = std::filesystem::file_size(path, error);
+			this->file_bytes = error ? 0 : static_cast<std::uint64_t>(length);
+		}
+
+		write_ahead_log(const write_ahead_log &) = delete;
+		write_ahead_log &operator=(const write_ahead_log &) = delete;
+
+		/**
+		 * Sync what periodic syncing left behind.
+		 */
+		~write_ahead_log()
+		{
+			try
+			{
+				if (this->options.sync == sync_policy::periodic)
+				{
+					this->sync();
+				} // else, every commit already went as far as it will, do_nothing();
+			}
+			catch (...)
+			{
+				// a destructor cannot report it; the log is only shorter
+			}
+		}
+
+		/**
+		 * Queue a record. Records are written in the order they are
+		 * appended, so call this under whatever lock orders the changes.
+		 * @param record
+		 * @param bytes
+		 * @return the ticket to commit.
+		 * @throws std::invalid_argument if the record is too long for its
+		 * 32 bit length.
+		 */
+		std::uint64_t append(const void *record, std::size_t bytes)
+		{
+			if (bytes > std::numeric_limits<std::uint32_t>::max())
+			{
+				throw std::invalid_argument("write_ahead_log record is too long");
+			} // else, the length fits, do_nothing();
+			const std::uint32_t length = static_cast<std::uint32_t>(bytes);
+			const std::uint32_t check = frame_checksum(record, bytes);
+
+			std::lock_guard<std::mutex> guard(this->mutex);
+			const std::size_t start = this->pending.size();
+			this->pending.resize(start + sizeof(length) + bytes + sizeof(check));
+			std::memcpy(this->pending.data() + start, &length, sizeof(length));
+			std::memcpy(this->pending.data() + start + sizeof(length), record, bytes);
+			std::memcpy(this->pending.data() + start + sizeof(length) + bytes, &check, sizeof(check));
+			return ++this->appended;
+		}
+
+		/**
+		 * Wait until the record with ticket is written, and synced if the
+		 * policy says so. Becomes the writer for everything queued if no
+		 * one else is writing.
+		 * @param ticket
+		 */
+		void commit(std::uint64_t ticket)
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			while (this->written < ticket)
+			{
+				if (!this->failure.empty())
+				{
+					throw std::runtime_error(this->failure);
+				} // else, do_nothing();
+
+				if (this->writing)
+				{
+					this->done.wait(lock);
+					continue;
+				} // else, this thread writes the group, do_nothing();
+
+				this->writing = true;
+				std::vector<char> batch;
+				batch.swap(this->pending);
+				const std::uint64_t last = this->appended;
+				lock.unlock();
+				try
+				{
+					this->file.append(batch.data(), batch.size());
+					this->sync_batch();
+				}
+				catch (const std::exception &error)
+				{
+					lock.lock();
+					this->failure = error.what();
+					this->writing = false;
+					this->done.notify_all();
+					throw;
+				}
+				lock.lock();
+				this->written = last;
+				this->file_bytes += batch.size();
+				this->writing = false;
+				this->done.notify_all();
+			}
+		}
+
+		/**
+		 * Write everything queued and put it on disk, whatever the policy.
+		 */
+		void sync()
+		{
+			this->commit(this->last_ticket());
+			this->file.sync();
+		}
+
+		/**
+		 * @return the length of the log, counting records not written yet.
+		 */
+		std::uint64_t bytes() const
+		{
+			std::lock_guard<std::mutex> guard(this->mutex);
+			return this->file_bytes + this->pending.size();
+		}
+
+		/**
+		 * Write everything queued, then move the log to old_path and start
+		 * an empty one. The caller must stop appends until this returns.
+		 * @param old_path
+		 */
+		void rotate(const std::string &old_path)
+		{
+			this->sync();
+			std::lock_guard<std::mutex> guard(this->mutex);
+			this->file.close();
+			std::filesystem::rename(this->path, old_path);
+			log_file::sync_directory(this->path);
+			this->file.open(this->path);
+			this->file_bytes = 0;
+		}
+
+		/**
+		 * Drop every record. The caller must stop appends until this
+		 * returns.
+		 */
+		void reset()
+		{
+			this->commit(this->last_ticket());
+			std::lock_guard<std::mutex> guard(this->mutex);
+			this->file.truncate(0);
+			this->file.sync();
+			this->file_bytes = 0;
+		}
+
+		/**
+		 * Read the records of the log at path in order, stopping at the
+		 * end or at the first record that is cut short or damaged. A
+		 * length longer than the rest of the file is damage too, so a
+		 * garbage length never allocates.
+		 * @param path
+		 * @param visit called with the bytes of each record
+		 * @return the number of records read.
+		 */
+		template<typename Visitor>
+		static std::uint64_t replay(const std::string &path, Visitor visit)
+		{
+			std::ifstream in(path, std::ios::binary);
+			std::error_code error;
+			std::uint64_t remaining = std::filesystem::file_size(path, error);
+			if (error)
+			{
+				// no log, nothing to replay
+				return 0;
+			} // else, do_nothing();
+			std::uint64_t records = 0;
+			std::vector<char> record;
+			std::uint32_t length = 0;
+			while (remaining >= sizeof(length) && in.read(reinterpret_cast<char *>(&length), sizeof(length)))
+			{
+				remaining -= sizeof(length);
+				std::uint32_t check = 0;
+				if (length > remaining || remaining - length < sizeof(check))
+				{
+					// a damaged length, or the rest was never fully written
+					break;
+				} // else, the record fits in the file, do_nothing();
+				remaining -= length + sizeof(check);
+				record.resize(length);
+				if (!in.read(record.data(), length) || !in.read(reinterpret_cast<char *>(&check), sizeof(check)) ||
+					check != frame_checksum(record.data(), length))
+				{
+					// the record is damaged
+					break;
+				} // else, do_nothing();
+				visit(static_cast<const char *>(record.data()), static_cast<std::size_t>(length));
+				records += 1;
+			}
+			return records;
+		}
+
+	private:
+		std::string path;
+		wal_options options;
+		log_file file;
+
+		/**
+		 * Guards everything below.
+		 */
+		mutable std::mutex mutex;
+		std::condition_variable done;
+
+		/**
+		 * Framed records waiting for the next group write.
+		 */
+		std::vector<char> pending;
+
+		/**
+		 * The last ticket handed out and the last one written.
+		 */
+		std::uint64_t appended = 0;
+		std::uint64_t written = 0;
+
+		/**
+		 * Whether some thread is writing a group now.
+		 */
+		bool writing = false;
+
+		std::uint64_t file_bytes = 0;
+
+		/**
+		 * Only the writing thread touches this.
+		 */
+		std::chrono::steady_clock::time_point last_sync;
+
+		/**
+		 * Why a write failed. Once set every commit fails, since the
+		 * records after the failed ones cannot be trusted to replay.
+		 */
+		std::string failure;
+
+		std::uint64_t last_ticket() const
+		{
+			std::lock_guard<std::mutex> guard(this->mutex);
+			return this->appended;
+		}
+
+		/**
+		 * Sync the group just written if the policy asks for it.
+		 */
+		void sync_batch()
+		{
+			if (this->options.sync == sync_policy::every_commit)
+			{
+				this->file.sync();
+			}
+			else if (this->options.sync == sync_policy::periodic)
+			{
+				const auto now = std::chrono::steady_clock::now();
+				if (now - this->last_sync >= this->options.sync_interval)
+				{
+					this->file.sync();
+					this->last_sync = now;
+				} // else, the last sync is recent enough, do_nothing();
+			} // else, leave it to the operating system, do_nothing();
+		}
+
+		static std::uint32_t frame_checksum(const void *record, std::size_t bytes)
+		{
+			const std::uint64_t hash = fnv1a_checksum(fnv1a_seed, record, bytes);
+			return static_cast<std::uint32_t>(hash ^ (hash >> 32));
+		}
+	};
+}
+
+#endif // WRITE_AHEAD_LOG_H_